@@ -20,8 +20,11 @@
 #include <stdint.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
 #include <unistd.h>
 #include <getopt.h>
 #include <fcntl.h>
@@ -29,6 +32,8 @@
 #include <dirent.h>
 #include <libgen.h>
 #include <sys/sysmacros.h>
+#include <sys/wait.h>
+#include <sys/uio.h>
 #ifndef major
 #include <sys/types.h>
 #endif
@@ -42,6 +47,12 @@
 #include "config.h"
 #endif
 
+#if HAVE_IO_URING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
 #include "sg_unaligned.h"
 
 
@@ -83,12 +94,16 @@ static const char * version_str = "0.30  2018/06/12 [svn: r154]";
 
 #define UINT64_LAST ((uint64_t)~0)
 
-static int transport_id = TRANSPORT_UNKNOWN;
+#define MAX_JOBS 256    /* upper limit for --jobs=N */
+#define MAX_COLS 32     /* upper limit of names in --columns=LIST */
 
 
 static const char * sysfsroot = "/sys";
 static const char * bus_scsi_devs = "/bus/scsi/devices";
 static const char * class_scsi_dev = "/class/scsi_device/";
+static const char * scsi_generic = "/class/scsi_generic/";
+static const char * class_block = "/class/block/";
+static const char * scsi_disk = "/class/scsi_disk/";
 static const char * scsi_host = "/class/scsi_host/";
 static const char * spi_host = "/class/spi_host/";
 static const char * spi_transport = "/class/spi_transport/";
@@ -103,6 +118,7 @@ static const char * fc_remote_ports = "/class/fc_remote_ports/";
 static const char * iscsi_host = "/class/iscsi_host/";
 static const char * iscsi_session = "/class/iscsi_session/";
 static const char * srp_host = "/class/srp_host/";
+static const char * class_enclosure = "/class/enclosure/";
 static const char * dev_dir = "/dev";
 static const char * dev_disk_byid_dir = "/dev/disk/by-id";
 #if (HAVE_NVME && (! IGNORE_NVME))
@@ -128,13 +144,40 @@ struct addr_hctl {
         uint8_t lun_arr[8];   /* T10, SAM-5 order; NVME: little endian */
 };
 
-struct addr_hctl filter;
-static bool filter_active = false;
+/* What is read from sysfs for each device (LU or namespace), besides
+ * attributes of its directory (in a bit mask each, SA_BIT() and NA_BIT()).
+ * Worked out once from the options by make_col_plan(). */
+#define PLAN_TPORT      0x1     /* transport */
+#define PLAN_LU_NAME    0x2     /* from VPD page 0x83 */
+#define PLAN_NODE       0x4     /* block or char device node */
+#define PLAN_WWN        0x8     /* via /dev/disk/by-id/wwn* */
+#define PLAN_DEV        0x10    /* node's major:minor */
+#define PLAN_SCSI_ID    0x20
+#define PLAN_SG         0x40    /* sg device node */
+#define PLAN_SG_DEV     0x80    /* its major:minor */
+#define PLAN_PROT       0x100   /* protection type and integrity format */
+#define PLAN_PROTMODE   0x200
+#define PLAN_ENCL       0x400   /* enclosure slot */
+#define PLAN_SIZE       0x800
+#define PLAN_LBS        0x1000  /* logical block size */
+#define PLAN_RESOLVED   0x2000  /* --verbose: directory link resolved */
+#define PLAN_CTL_MODEL  0x4000  /* NVMe controller's model */
+
+struct col_plan {
+        uint32_t need;          /* OR-ed PLAN_* for SCSI devices */
+        uint32_t sdev_attrs;    /* SA_BIT()s */
+        uint32_t nvme_need;     /* OR-ed PLAN_* for NVMe namespaces */
+        uint32_t ndev_attrs;    /* NA_BIT()s */
+        int num_cols;           /* > 0 when --columns= given */
+        int cols[MAX_COLS];     /* enum col_id in the order given */
+};
 
 struct lsscsi_opts {
         bool brief;
         bool classic;
         bool dev_maj_min;        /* --device */
+        bool enclosure;         /* --enclosure: enclosure id and slot */
+        bool filter_active;     /* some part of 'filter' is given */
         bool generic;
         bool kname;
         bool no_nvme;
@@ -146,11 +189,16 @@ struct lsscsi_opts {
         bool wwn;
         int long_opt;           /* --long */
         int lunhex;
+        int jobs;               /* --jobs=N worker processes for devices */
+        int json;               /* 1: --json, 2: --json-seq */
         int ssize;              /* show storage size, once->base 10 (e.g. 3 GB
                                  * twice ->base 2 (e.g. 3.1 GiB)
                                  * thrice for number of logical blocks */
         int unit;               /* logical unit (LU) name: from vpd_pg83 */
         int verbose;
+        const char * columns;   /* --columns=LIST, NULL if not given */
+        struct addr_hctl filter;        /* <h:c:t:l> from command line */
+        struct col_plan plan;
 };
 
 static void tag_lun(const uint8_t * lunp, int * tag_arr);
@@ -196,15 +244,28 @@ static const char * scsi_short_device_types[] =
         "wlun   ", "no dev ",
 };
 
+/* Indexed by TRANSPORT_*, as --json names them */
+static const char * transport_names[] = {
+        NULL, "spi", "fc", "sas", "sas", "iscsi", "sbp", "usb", "ata",
+        "sata", "fcoe", "srp", "pcie",
+};
+
 /* '--name' ('-n') option removed in version 0.11 and can now be reused */
 static struct option long_options[] = {
         {"brief", no_argument, 0, 'b'},
+        {"cache", required_argument, 0, 'a'},
         {"classic", no_argument, 0, 'c'},
+        {"columns", required_argument, 0, 'o'},
         {"controllers", no_argument, 0, 'C'},
         {"device", no_argument, 0, 'd'},
+        {"enclosure", no_argument, 0, 'e'},
         {"generic", no_argument, 0, 'g'},
         {"help", no_argument, 0, 'h'},
         {"hosts", no_argument, 0, 'H'},
+        {"jobs", required_argument, 0, 'j'},
+        {"json", no_argument, 0, 'J'},
+        {"json-seq", no_argument, 0, 'Q'},
+        {"json_seq", no_argument, 0, 'Q'},  /* convenience, not documented */
         {"kname", no_argument, 0, 'k'},
         {"long", no_argument, 0, 'l'},
         {"list", no_argument, 0, 'L'},
@@ -240,6 +301,7 @@ struct dev_node_entry {
        unsigned int maj, min;
        enum dev_type type;
        time_t mtime;
+       struct dev_node_entry *hnext;    /* next in dev_node_hash bucket */
        char name[LMAX_DEVPATH];
 };
 
@@ -250,6 +312,11 @@ struct dev_node_list {
 };
 static struct dev_node_list* dev_node_listhead = NULL;
 
+/* Hash index over dev_node_list keyed on (maj, min, type). Only the newest
+ * (by mtime) node of each key is in the index. */
+static struct dev_node_entry ** dev_node_hash = NULL;
+static unsigned int dev_node_hash_mask = 0;
+
 /* WWN here is extracted from /dev/disk/by-id/wwn-<WWN> which is
  * created by udev 60-persistent-storage.rules using ID_WWN_WITH_EXTENSION.
  * The udev ID_WWN_WITH_EXTENSION is the combination of char wwn[17] and
@@ -263,6 +330,7 @@ struct disk_wwn_node_entry {
         char wwn[DISK_WWN_MAX_LEN]; /* '0x' + wwn<128-bit> + */
                                     /* <null-terminator> */
         char disk_bname[12];
+        struct disk_wwn_node_entry *hnext;  /* next in disk_wwn_hash bucket */
 };
 
 #define DISK_WWN_NODE_LIST_ENTRIES 16
@@ -273,52 +341,81 @@ struct disk_wwn_node_list {
 };
 static struct disk_wwn_node_list * disk_wwn_node_listhead = NULL;
 
+/* Hash index over disk_wwn_node_list keyed on disk_bname. Only the first
+ * entry found for each disk is in the index. */
+static struct disk_wwn_node_entry ** disk_wwn_hash = NULL;
+static unsigned int disk_wwn_hash_mask = 0;
+
 struct item_t {
         char name[LMAX_NAME];
         int ft;
         int d_type;
 };
 
-static struct item_t non_sg;
-static struct item_t aa_sg;
-static struct item_t aa_first;
-static struct item_t enclosure_device;
-
-static char sas_low_phy[LMAX_NAME];
-static char sas_hold_end_device[LMAX_NAME];
-
-/* Code analyzer states that the following two pointers may reference local
- * (auto or stack based) locations and thus may be dangling. However they
- * are only use by iscsi_target_scan() (plus functions it * calls) which is
- * invoked only in transport_tport(). And the local (auto or stack based)
- * locations flagged by the analyzer are defined in the function scope of
- * transport_tport(). Hence there is no problem.  */
-static const char * iscsi_dir_name;
-static const struct addr_hctl * iscsi_target_hct;
-
-static int iscsi_tsession_num;
-
-static char errpath[LMAX_PATH];
+/* State built up while scanning and outputting one SCSI device (or host).
+ * The *_scan() functions and their directory entry select callbacks fill
+ * this in rather than file scope variables, so that nothing is carried
+ * over from one entry to the next. Only that per-device state lives here;
+ * entries are NOT safe to produce from several threads. The sysfs
+ * directory fd cache (sysfs_dev_fds), the io_uring batch, the LU map, the
+ * /dev and by-id indexes, the scsi_id memo and the enclosure slots are
+ * process wide, some are built lazily, and none is locked. --jobs gets its
+ * concurrency by forking workers, each with its own copy of them. */
+struct scan_ctx {
+        int transport_id;       /* set by transport_init() or
+                                 * transport_tport() */
+        struct item_t non_sg;
+        struct item_t aa_sg;
+        struct item_t aa_first;
+        struct item_t enclosure_device;
+        char sas_low_phy[LMAX_NAME];
+        char sas_hold_end_device[LMAX_NAME];
+        /* iSCSI session of the device, set by transport_tport() */
+        struct iscsi_sess * iscsi_sess;
+        /* set by sdev_block_dir() and sdev_sd_dir(): 0 if not looked up
+         * yet, 1 if found (in blk_dir or sd_dir), -1 if there is none */
+        int blk_state;
+        int sd_state;
+        char blk_dir[LMAX_DEVPATH];
+        char sd_dir[LMAX_DEVPATH];
+        char errpath[LMAX_PATH];
+};
 
 
 static const char * usage_message1 =
-"Usage: lsscsi   [--brief] [--classic] [--controllers] [--device] "
-            "[--generic]\n"
-            "\t\t[--help] [--hosts] [--kname] [--list] [--long] "
-            "[--long-unit]\n"
-            "\t\t[--lunhex] [--no-nvme] [--pdt] [--protection] [--prot-mode]\n"
-            "\t\t[--scsi_id] [--size] [--sz-lbs] [--sysfsroot=PATH] "
-            "[--transport]\n"
-            "\t\t[--unit] [--verbose] [--version] [--wwn]  [<h:c:t:l>]\n"
+"Usage: lsscsi   [--brief] [--cache=DIR] [--classic] [--columns=LIST]\n"
+            "\t\t[--controllers] [--device] [--enclosure] [--generic] "
+            "[--help]\n"
+            "\t\t[--hosts] [--jobs=N] [--json] [--json-seq] [--kname] "
+            "[--list]\n"
+            "\t\t[--long] [--long-unit] [--lunhex] [--no-nvme] [--pdt]\n"
+            "\t\t[--protection] [--prot-mode] [--scsi_id] [--size] "
+            "[--sz-lbs]\n"
+            "\t\t[--sysfsroot=PATH] [--transport] [--unit] [--verbose]\n"
+            "\t\t[--version] [--wwn] [<h:c:t:l>]\n"
 "  where:\n"
 "    --brief|-b        tuple and device name only\n"
+"    --cache=DIR|-a DIR    keep the output in DIR and reuse it until the\n"
+"                          next uevent (device added, removed or changed)\n"
 "    --classic|-c      alternate output similar to 'cat /proc/scsi/scsi'\n"
+"    --columns=LIST|-o LIST    output only the columns named in LIST for\n"
+"                              each device (e.g. 'hctl,node,wwn,size');\n"
+"                              an unknown name lists the names\n"
 "    --controllers|-C   synonym for --hosts since NVMe controllers treated\n"
 "                       like SCSI hosts\n"
 "    --device|-d       show device node's major + minor numbers\n"
+"    --enclosure|-e    show enclosure id and slot of each device (from\n"
+"                      /sys/class/enclosure)\n"
 "    --generic|-g      show scsi generic device name\n"
 "    --help|-h         this usage information\n"
 "    --hosts|-H        lists scsi hosts rather than scsi devices\n"
+"    --jobs=N|-j N     use N worker processes to collect scsi device and\n"
+"                      nvme namespace information; output order is\n"
+"                      unchanged (def: 1)\n"
+"    --json|-J         output a JSON document, each device (or host) is an\n"
+"                      object on its own line in its array\n"
+"    --json-seq|-Q     output each device (or host) as a JSON object on its\n"
+"                      own line (newline delimited JSON)\n"
 "    --kname|-k        show kernel name instead of device node name\n"
 "    --list|-L         additional information output one\n"
 "                      attribute=value per line\n"
@@ -405,6 +502,413 @@ scnpr(char * cp, int cp_max_len, const char * fmt, ...)
         return (n < cp_max_len) ? n : (cp_max_len - 1);
 }
 
+/* Output layer. Lines written to stdout are formatted into an arena of up
+ * to OUT_CHUNKS buffers and handed to the kernel with one writev() when
+ * the arena is full and by out_flush() (e.g. at the end of a listing, or
+ * before a fork). When stdout is a terminal, or JSON records are being
+ * streamed, complete lines are written at once, much as stdio's line
+ * buffering would. stdio's stdout buffer is not
+ * used after out_init(). Each (forked) --jobs worker fills its own arena,
+ * the parent then appends a worker's output in order with out_write().
+ * With --cache, out_tee() has each flush written to the cache file too. */
+#define OUT_CHUNK_SZ 32768
+#define OUT_CHUNKS 16
+#define OUT_MAX_PIECE 1024      /* room reserved for one out_printf() */
+
+struct out_arena {
+        bool line_flush;        /* flush after each '\n' */
+        int cur;                /* chunk being filled */
+        int num_alloc;          /* chunks allocated, chunk[0] is static */
+        size_t len[OUT_CHUNKS];
+        char * chunk[OUT_CHUNKS];
+        int tee_fd;             /* also written to when >= 0 */
+        bool tee_err;           /* a write to tee_fd failed */
+};
+
+static char out_chunk0[OUT_CHUNK_SZ];
+static struct out_arena out_ar = {false, 0, 1, {0}, {out_chunk0}, -1, false};
+
+static void
+out_init(bool line_flush)
+{
+        out_ar.line_flush = line_flush || (1 == isatty(STDOUT_FILENO));
+}
+
+/* From now on write what is flushed to fd as well as to stdout; fd < 0
+ * stops that. */
+static void
+out_tee(int fd)
+{
+        out_ar.tee_fd = fd;
+        out_ar.tee_err = false;
+}
+
+/* Writes the n buffers at iovp to fd, retrying after a partial write.
+ * The iovec array is modified. Returns false if a write failed. */
+static bool
+out_writev(int fd, struct iovec * iovp, int n)
+{
+        ssize_t res;
+
+        while (n > 0) {
+                res = writev(fd, iovp, n);
+                if (res < 0) {
+                        if (EINTR == errno)
+                                continue;
+                        return false;
+                }
+                for ( ; (n > 0) && ((size_t)res >= iovp->iov_len); --n) {
+                        res -= iovp->iov_len;
+                        ++iovp;
+                }
+                if (n > 0) {
+                        iovp->iov_base = (char *)iovp->iov_base + res;
+                        iovp->iov_len -= res;
+                }
+        }
+        return true;
+}
+
+/* Writes out the arena to stdout (and to the tee fd, if any). Returns
+ * false if a write to stdout failed (the rest of the arena is dropped). */
+static bool
+out_flush(void)
+{
+        bool ok;
+        int k, n;
+        struct iovec iov[OUT_CHUNKS];
+        struct iovec tee_iov[OUT_CHUNKS];
+
+        for (k = 0, n = 0; k <= out_ar.cur; ++k) {
+                if (out_ar.len[k] > 0) {
+                        iov[n].iov_base = out_ar.chunk[k];
+                        iov[n++].iov_len = out_ar.len[k];
+                }
+                out_ar.len[k] = 0;
+        }
+        out_ar.cur = 0;
+        if (0 == n)
+                return true;
+        if (out_ar.tee_fd >= 0)
+                memcpy(tee_iov, iov, n * sizeof(struct iovec));
+        ok = out_writev(STDOUT_FILENO, iov, n);
+        if ((out_ar.tee_fd >= 0) && (! out_ar.tee_err) &&
+            (! out_writev(out_ar.tee_fd, tee_iov, n)))
+                out_ar.tee_err = true;
+        return ok;
+}
+
+/* Returns the free space in the current chunk after making it at least
+ * 'need' bytes (need <= OUT_CHUNK_SZ), by moving to the next chunk or
+ * flushing the arena. */
+static size_t
+out_room(size_t need)
+{
+        int k = out_ar.cur;
+
+        if ((OUT_CHUNK_SZ - out_ar.len[k]) >= need)
+                return OUT_CHUNK_SZ - out_ar.len[k];
+        if ((k + 1) < out_ar.num_alloc)
+                ++out_ar.cur;
+        else if (((k + 1) < OUT_CHUNKS) &&
+                 (out_ar.chunk[k + 1] = (char *)malloc(OUT_CHUNK_SZ))) {
+                ++out_ar.num_alloc;
+                ++out_ar.cur;
+        } else
+                out_flush();
+        return OUT_CHUNK_SZ;
+}
+
+/* Called after n bytes have been placed at the end of the current chunk */
+static inline void
+out_added(size_t n)
+{
+        char * p = out_ar.chunk[out_ar.cur] + out_ar.len[out_ar.cur];
+
+        out_ar.len[out_ar.cur] += n;
+        if (out_ar.line_flush && memchr(p, '\n', n))
+                out_flush();
+}
+
+static void
+out_write(const char * s, size_t n)
+{
+        size_t room, k;
+
+        while (n > 0) {
+                room = out_room(1);
+                k = (n < room) ? n : room;
+                memcpy(out_ar.chunk[out_ar.cur] + out_ar.len[out_ar.cur], s,
+                       k);
+                out_added(k);
+                s += k;
+                n -= k;
+        }
+}
+
+static inline void
+out_puts(const char * s)
+{
+        out_write(s, strlen(s));
+}
+
+/* Outputs s left justified in a field of 'width' characters, like
+ * printf("%-*s", width, s) */
+static void
+out_pad(const char * s, int width)
+{
+        int n = strlen(s);
+        char * p;
+
+        if (n >= width) {
+                out_write(s, n);
+                return;
+        }
+        if ((size_t)width > out_room(width)) {  /* wider than a chunk */
+                out_write(s, n);
+                for ( ; n < width; ++n)
+                        out_write(" ", 1);
+                return;
+        }
+        p = out_ar.chunk[out_ar.cur] + out_ar.len[out_ar.cur];
+        memcpy(p, s, n);
+        memset(p + n, ' ', width - n);
+        out_added(width);
+}
+
+/* Outputs s like out_pad() followed by the two spaces between columns */
+static inline void
+out_field(const char * s, int width)
+{
+        out_pad(s, width);
+        out_write("  ", 2);
+}
+
+#ifdef __GNUC__
+static int out_printf(const char * fmt, ...)
+        __attribute__ ((format (printf, 1, 2)));
+#else
+static int out_printf(const char * fmt, ...);
+#endif
+
+static int
+out_printf(const char * fmt, ...)
+{
+        va_list args;
+        int n;
+        size_t room = out_room(OUT_MAX_PIECE);
+        char * p = out_ar.chunk[out_ar.cur] + out_ar.len[out_ar.cur];
+        char * bp;
+
+        va_start(args, fmt);
+        n = vsnprintf(p, room, fmt, args);
+        va_end(args);
+        if (n < 0)
+                return n;
+        if ((size_t)n < room) {
+                out_added(n);
+                return n;
+        }
+        bp = (char *)malloc(n + 1);     /* longer than the chunk's room */
+        if (NULL == bp)
+                return -1;
+        va_start(args, fmt);
+        vsnprintf(bp, n + 1, fmt, args);
+        va_end(args);
+        out_write(bp, n);
+        free(bp);
+        return n;
+}
+
+/* --json and --json-seq output. Each device (or host) is a record, an
+ * object that is output as soon as it has been collected; members are
+ * written as they are produced, there is no tree of values. With --json
+ * the records are the elements of one array in a document, with
+ * --json-seq each record is a document of its own. Either way a record
+ * is one line, so it is written (see out_init()) once it is complete. */
+static int json_recs;           /* records started by this process */
+static bool json_more;          /* a member precedes in this object */
+
+/* Returns the length of the valid UTF-8 sequence of 2 to 4 bytes at s, or
+ * 0 if there is none (overlong forms and surrogates are not valid). */
+static int
+utf8_len(const uint8_t * s)
+{
+        int k, n;
+        uint8_t lo = 0x80;
+        uint8_t hi = 0xbf;
+
+        if ((s[0] >= 0xc2) && (s[0] <= 0xdf))
+                n = 2;
+        else if ((s[0] >= 0xe0) && (s[0] <= 0xef)) {
+                n = 3;
+                if (0xe0 == s[0])
+                        lo = 0xa0;
+                else if (0xed == s[0])
+                        hi = 0x9f;
+        } else if ((s[0] >= 0xf0) && (s[0] <= 0xf4)) {
+                n = 4;
+                if (0xf0 == s[0])
+                        lo = 0x90;
+                else if (0xf4 == s[0])
+                        hi = 0x8f;
+        } else
+                return 0;
+        if ((s[1] < lo) || (s[1] > hi))
+                return 0;
+        for (k = 2; k < n; ++k) {
+                if (0x80 != (s[k] & 0xc0))
+                        return 0;
+        }
+        return n;
+}
+
+/* Outputs s as a JSON string (in double quotes). sysfs strings are not
+ * always UTF-8 (e.g. INQUIRY data), each byte that is not part of a valid
+ * UTF-8 sequence is output as U+FFFD so the document stays valid. */
+static void
+json_str_val(const char * s)
+{
+        int n, k;
+        uint8_t c;
+        char b[8];
+
+        out_write("\"", 1);
+        while (*s) {
+                for (n = 0; ; n += k) {
+                        c = (uint8_t)s[n];
+                        if ((c < 0x20) || ('"' == c) || ('\\' == c))
+                                k = 0;
+                        else if (c < 0x80)
+                                k = 1;
+                        else
+                                k = utf8_len((const uint8_t *)s + n);
+                        if (0 == k)
+                                break;
+                }
+                if (n > 0) {
+                        out_write(s, n);
+                        s += n;
+                        continue;
+                }
+                if ((uint8_t)*s >= 0x80)
+                        out_write("\\ufffd", 6);
+                else if ('\n' == *s)
+                        out_write("\\n", 2);
+                else if ('\t' == *s)
+                        out_write("\\t", 2);
+                else if ((unsigned char)*s < 0x20) {
+                        snprintf(b, sizeof(b), "\\u%04x", *s);
+                        out_write(b, 6);
+                } else {
+                        b[0] = '\\';
+                        b[1] = *s;
+                        out_write(b, 2);
+                }
+                ++s;
+        }
+        out_write("\"", 1);
+}
+
+/* Starts the next member of the current object, "key": */
+static void
+json_key(const char * key)
+{
+        if (json_more)
+                out_write(",", 1);
+        json_more = true;
+        json_str_val(key);
+        out_write(":", 1);
+}
+
+/* "key":"val" or, if val is NULL, "key":null */
+static void
+json_str(const char * key, const char * val)
+{
+        json_key(key);
+        if (val)
+                json_str_val(val);
+        else
+                out_write("null", 4);
+}
+
+/* "key":val or, if ok is false, "key":null */
+static void
+json_num(const char * key, bool ok, int64_t val)
+{
+        json_key(key);
+        if (ok)
+                out_printf("%" PRId64, val);
+        else
+                out_write("null", 4);
+}
+
+/* "key":<s * mult> if ok and s is a decimal number, else "key":null */
+static void
+json_num_str(const char * key, bool ok, const char * s, int64_t mult)
+{
+        int64_t v = 0;
+
+        ok = ok && (1 == sscanf(s, "%" SCNd64, &v));
+        json_num(key, ok, v * mult);
+}
+
+/* "key":{ , members then follow until json_obj_end() */
+static void
+json_obj_begin(const char * key)
+{
+        json_key(key);
+        out_write("{", 1);
+        json_more = false;
+}
+
+static void
+json_obj_end(void)
+{
+        out_write("}", 1);
+        json_more = true;
+}
+
+/* With --json, starts the document; its records are in the array 'key' */
+static void
+json_begin(const char * key, const struct lsscsi_opts * op)
+{
+        if (1 != op->json)
+                return;
+        out_write("{", 1);
+        json_more = false;
+        json_str("lsscsi_version", version_str);
+        json_num("schema", true, 1);
+        json_key(key);
+        out_write("[\n", 2);
+}
+
+static void
+json_end(const struct lsscsi_opts * op)
+{
+        if (1 == op->json)
+                out_write("]}\n", 3);
+}
+
+/* Starts a record. With --json the records after the first are preceded
+ * by a comma, so the one just output is complete at its newline. */
+static void
+json_rec_begin(const struct lsscsi_opts * op)
+{
+        if ((1 == op->json) && (json_recs > 0))
+                out_write(",{", 2);
+        else
+                out_write("{", 1);
+        ++json_recs;
+        json_more = false;
+}
+
+static void
+json_rec_end(void)
+{
+        out_write("}\n", 2);
+}
+
 #if 0
 static bool
 all_zeros(const uint8_t * bp, int b_len)
@@ -481,79 +985,59 @@ trunc_pad2n(char * str, int n, bool trailing__on_trunc)
 
 static const char * bad_arg = "Bad_argument";
 
-/* Opens the file 'dirp/fname' and searches for 'name'=, the first one found
- * has its value (rest of line after "=") returned in 'b'. The 'name' is
- * typically in upper case. Example: 'MAJOR=253' if name is 'MAJOR' returns
- * pointer to string containing '253'. */
-static char *
-name_eq2value(const char * dirp, const char * fname, const char * name,
-              int b_len, char * b)
+/* Opens the file 'dirp/fname' and searches for each of names[0] to
+ * names[num - 1] followed by "=", the first one found has its value (rest
+ * of line after "=") returned in bs[k]; a name not found leaves bs[k]
+ * empty. The names are typically in upper case. Example: 'MAJOR=253' if
+ * names[0] is 'MAJOR' gives '253' in bs[0]. The file is read once for all
+ * names. Returns the number of names found. */
+static int
+name_eq2values(const char * dirp, const char * fname, int num,
+               const char * const * names, int b_len, char * const * bs)
 {
-        bool ok = false;
-        int k;
-        size_t len = 0;
+        int k, j;
+        int found = 0;
         size_t n;
-        char * full_name;
         FILE * fp = NULL;
+        char full_name[LMAX_DEVPATH];
         char line[132];
 
-        if (b_len > 0)
-                b[0] = '\0';
         if (b_len < 2)
-                return b;
-        if (dirp)
-                len = strlen(dirp);
-        if (fname)
-                len += strlen(fname);
-        if (len < 1) {
-                snprintf(b, b_len, "%s", bad_arg);
-                return b;
-        }
-        len += 20;
-        full_name = (char *)calloc(1, len);
-        if (NULL == full_name)
-                goto clean_up;
+                return 0;
+        for (j = 0; j < num; ++j)
+                bs[j][0] = '\0';
         if (dirp && fname)
-                snprintf(full_name, len - 2, "%s/%s", dirp, fname);
-        else if (dirp)
-                snprintf(full_name, len - 2, "%s", dirp);
-        else    /* fname must be nz (if zero(null) then len==0 above) */
-                snprintf(full_name, len - 2, "%s", fname);
-
-        fp = fopen(full_name, "r");
-        if (NULL == fp) {
-#if 0
-            pr2serr("%s: unable to open %s\n", __func__, full_name);
-#endif
-            goto clean_up;
-        }
-        if (strlen(name) >= (len - 2)) {
-                snprintf(b, b_len, "%s", bad_arg);
-                goto clean_up;
+                snprintf(full_name, sizeof(full_name), "%s/%s", dirp, fname);
+        else if (dirp || fname)
+                snprintf(full_name, sizeof(full_name), "%s",
+                         dirp ? dirp : fname);
+        else {
+                for (j = 0; j < num; ++j)
+                        snprintf(bs[j], b_len, "%s", bad_arg);
+                return 0;
         }
-        /* Re-use full_name as filename no longer needed */
-        snprintf(full_name, len - 1, "%s=", name);
-        n = strlen(full_name);
-
-        for (k = 0; k < 1024; ++k) {    /* shouldn't be that many lines */
+        fp = fopen(full_name, "r");
+        if (NULL == fp)
+                return 0;
+        for (k = 0; (k < 1024) && (found < num); ++k) {
+                /* shouldn't be that many lines */
                 if (NULL == fgets(line, sizeof(line), fp))
                         break;
-                if (0 == strncmp(line, full_name, n)) {
-                        ok = true;
+                for (j = 0; j < num; ++j) {
+                        n = strlen(names[j]);
+                        if (bs[j][0] || strncmp(line, names[j], n) ||
+                            ('=' != line[n]))
+                                continue;
+                        snprintf(bs[j], b_len, "%s", line + n + 1);
+                        n = strlen(bs[j]);
+                        if ((n > 0) && ('\n' == bs[j][n - 1]))
+                                bs[j][n - 1] = '\0';   /* remove trailing LF */
+                        ++found;
                         break;
                 }
         }
-        if (ok) {
-                snprintf(b, b_len, "%s", line + n);
-                n = strlen(b);
-                if ((n > 0) && ('\n' == b[n - 1]))
-                        b[n - 1] = '\0';        /* remove trailing LF */
-        }
-clean_up:
-        free(full_name);
-        if (fp)
-                fclose(fp);
-        return b;
+        fclose(fp);
+        return found;
 }
 
 #endif          /* (HAVE_NVME && (! IGNORE_NVME)) */
@@ -837,77 +1321,475 @@ invalidate_hctl(struct addr_hctl * p)
         }
 }
 
-/* Return 1 for directory entry that is link or directory (other than
- * a directory name starting with dot). Else return 0.  */
+/* Directory file descriptors for sysfs. The sysfsroot directory and each
+ * class (e.g. /sys/class/sas_phy) or bus device directory are opened once,
+ * when first needed, and kept open. The most recently used device
+ * directories are also kept open. Attributes and sub-directories are then
+ * resolved relative to those descriptors with openat(), fstatat() and
+ * readlinkat() so the kernel does not walk the whole path from the root for
+ * every probe. */
+#define SYSFS_CLASS_FDS 32
+#define SYSFS_DEV_FDS 8
+
+struct sysfs_dirfd {
+        int fd;
+        char * name;    /* class: relative to sysfsroot, device: full path */
+};
+
+static int sysfs_root_fd = -1;
+static int sysfs_class_fds_used = 0;
+static int sysfs_dev_fd_next = 0;
+static struct sysfs_dirfd sysfs_class_fds[SYSFS_CLASS_FDS];
+static struct sysfs_dirfd sysfs_dev_fds[SYSFS_DEV_FDS];
+
+/* If 'path' is sysfsroot or below it, returns the part of 'path' after
+ * sysfsroot without leading '/' characters. Else returns NULL. */
+static const char *
+sysfs_rel(const char * path)
+{
+        int len = strlen(sysfsroot);
+
+        while ((len > 1) && ('/' == sysfsroot[len - 1]))
+                --len;
+        if (strncmp(path, sysfsroot, len))
+                return NULL;
+        path += len;
+        if (('\0' != *path) && ('/' != *path) && ('/' != sysfsroot[len - 1]))
+                return NULL;
+        while ('/' == *path)
+                ++path;
+        return path;
+}
+
+/* Returns the length of the leading "class/<name>" or "bus/<name>/<dir>"
+ * part of 'rel' or 0 if there is none. */
 static int
-first_dir_scan_select(const struct dirent * s)
+sysfs_class_len(const char * rel)
 {
-        if (FT_OTHER != aa_first.ft)
+        int n, comps;
+        const char * cp;
+
+        if (0 == strncmp(rel, "class/", 6))
+                comps = 2;
+        else if (0 == strncmp(rel, "bus/", 4))
+                comps = 3;
+        else
                 return 0;
-        if (! dir_or_link(s, NULL))
+        for (cp = rel, n = 0; *cp; ++cp) {
+                if (('/' == *cp) && (++n == comps))
+                        break;
+        }
+        if (n < (comps - 1))
                 return 0;
-        my_strcopy(aa_first.name, s->d_name, LMAX_NAME);
-        aa_first.ft = FT_CHAR;  /* dummy */
-        aa_first.d_type =  s->d_type;
-        return 1;
+        return cp - rel;
 }
 
-/* Selects symlinks and directories that don't start with "." */
 static int
-sub_dir_scan_select(const struct dirent * s)
+sysfs_get_root_fd(void)
 {
-        return (dir_or_link(s, NULL)) ? 1 : 0;
+        if (sysfs_root_fd < 0)
+                sysfs_root_fd = open(sysfsroot,
+                                     O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        return sysfs_root_fd;
 }
 
-/* Selects symlinks and directories that don't start with "." as long as
- * they contain the string "scsi_disk". */
+/* Returns a descriptor for the directory that '*relp' is below. That is
+ * the class directory at the start of '*relp', opened on first use, in
+ * which case '*relp' is advanced past it. Otherwise it is sysfsroot. */
 static int
-sd_dir_scan_select(const struct dirent * s)
+sysfs_parent_fd(const char ** relp)
 {
-        return (dir_or_link(s, "scsi_disk")) ? 1 : 0;
+        int k, len, rfd, fd;
+        const char * rel = *relp;
+        char * cp;
+        struct sysfs_dirfd * dp;
+
+        rfd = sysfs_get_root_fd();
+        len = sysfs_class_len(rel);
+        if (len <= 0)
+                return rfd;
+        for (k = 0; k < sysfs_class_fds_used; ++k) {
+                dp = sysfs_class_fds + k;
+                if ((len == (int)strlen(dp->name)) &&
+                    (0 == strncmp(dp->name, rel, len))) {
+                        fd = dp->fd;
+                        goto found;
+                }
+        }
+        if ((rfd < 0) || (sysfs_class_fds_used >= SYSFS_CLASS_FDS))
+                return rfd;
+        if (NULL == (cp = strndup(rel, len)))
+                return rfd;
+        /* a missing class directory is remembered as well */
+        fd = openat(rfd, cp, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        dp = sysfs_class_fds + sysfs_class_fds_used++;
+        dp->fd = fd;
+        dp->name = cp;
+found:
+        rel += len;
+        while ('/' == *rel)
+                ++rel;
+        *relp = rel;
+        return fd;
 }
 
-/* Return 1 for directory entry that is link or directory (other than a
- * directory name starting with dot) that contains "block". Else return 0.
- */
+/* Returns a directory descriptor for 'dir_name' which must be at or below
+ * sysfsroot, or -1 (with errno set) if it cannot be opened. The caller
+ * must not close the returned descriptor. */
 static int
-block_dir_scan_select(const struct dirent * s)
+sysfs_dir_fd(const char * dir_name)
 {
-        return (dir_or_link(s, "block")) ? 1 : 0;
-}
+        int k, fd, pfd;
+        const char * rel;
+        struct sysfs_dirfd * dp;
 
-typedef int (* dirent_select_fn) (const struct dirent *);
+        if (NULL == (rel = sysfs_rel(dir_name))) {
+                errno = EINVAL;
+                return -1;
+        }
+        for (k = 0; k < SYSFS_DEV_FDS; ++k) {
+                dp = sysfs_dev_fds + k;
+                if (dp->name && (0 == strcmp(dp->name, dir_name)))
+                        return dp->fd;
+        }
+        pfd = sysfs_parent_fd(&rel);
+        if (pfd < 0) {
+                errno = ENOENT;
+                return -1;
+        }
+        if ('\0' == *rel)
+                return pfd;
+        fd = openat(pfd, rel, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd < 0)
+                return -1;
+        dp = sysfs_dev_fds + sysfs_dev_fd_next;
+        sysfs_dev_fd_next = (sysfs_dev_fd_next + 1) % SYSFS_DEV_FDS;
+        if (dp->name) {
+                close(dp->fd);
+                free(dp->name);
+        }
+        dp->fd = fd;
+        dp->name = strdup(dir_name);
+        if (NULL == dp->name) {
+                close(fd);
+                return -1;
+        }
+        return fd;
+}
 
-/* Scans directory dir_name, selecting elements on the basis of fn (NULL
- * select all), into an unsorted list. The first item is assumed to be
- * directories (or symlinks to) and it is appended, after a '/' to dir_name.
- * Then if sub_str is found in that dir_name, it selects items that are
- * directories or symlinks, the first of which is appended, after a '/',
- * to dir_name. If conditions are met true is return, elae false.
- */
-static bool
-sub_scan(char * dir_name, const char * sub_str, dirent_select_fn fn)
+/* Splits 'path' into its directory and last component, placing the
+ * directory in 'b' and returning a pointer to the last component. Returns
+ * NULL if 'path' has no '/' or is too long. */
+static const char *
+sysfs_split(const char * path, char * b, int b_len)
 {
-        int num, k, len;
-        struct dirent ** namelist;
+        const char * cp;
+        int len;
 
-        num = scandir(dir_name, &namelist, fn, NULL);
-        if (num <= 0)
-                return false;
-        len = strlen(dir_name);
-        if (len >= LMAX_PATH)
-                return false;
-        snprintf(dir_name + len, LMAX_PATH - len, "/%s", namelist[0]->d_name);
+        len = strlen(path);
+        while ((len > 1) && ('/' == path[len - 1]))
+                --len;
+        if (len >= b_len)
+                return NULL;
+        memcpy(b, path, len);
+        b[len] = '\0';
+        if (NULL == (cp = strrchr(b, '/')))
+                return NULL;
+        if (cp == b)
+                b[1] = '\0';
+        else
+                b[cp - b] = '\0';
+        return path + (cp - b) + 1;
+}
 
-        for (k = 0; k < num; ++k)
-                free(namelist[k]);
-        free(namelist);
+/* Opens 'dir_name'/'base_name' with 'flags'; relative to a kept directory
+ * descriptor when 'dir_name' is within sysfs. */
+static int
+sysfs_openat(const char * dir_name, const char * base_name, int flags)
+{
+        int dfd;
+        char b[LMAX_PATH];
 
-        if (strstr(dir_name, sub_str) == 0) {
-                num = scandir(dir_name, &namelist, sub_dir_scan_select, NULL);
-                if (num <= 0)
-                        return false;
-                len = strlen(dir_name);
+        if (sysfs_rel(dir_name)) {
+                if ((dfd = sysfs_dir_fd(dir_name)) < 0)
+                        return -1;
+                return openat(dfd, base_name, flags | O_CLOEXEC);
+        }
+        snprintf(b, sizeof(b), "%s/%s", dir_name, base_name);
+        return open(b, flags | O_CLOEXEC);
+}
+
+/* Like stat(2) but relative to a kept directory descriptor when 'path' is
+ * within sysfs. */
+static int
+sysfs_stat(const char * path, struct stat * st)
+{
+        int dfd;
+        const char * base;
+        char b[LMAX_PATH];
+
+        if (sysfs_rel(path) && (base = sysfs_split(path, b, sizeof(b)))) {
+                if ((dfd = sysfs_dir_fd(b)) < 0)
+                        return -1;
+                return fstatat(dfd, base, st, 0);
+        }
+        return stat(path, st);
+}
+
+/* Like readlink(2) but relative to a kept directory descriptor when 'path'
+ * is within sysfs. */
+static ssize_t
+sysfs_readlink(const char * path, char * buf, size_t bufsiz)
+{
+        int dfd;
+        const char * base;
+        char b[LMAX_PATH];
+
+        if (sysfs_rel(path) && (base = sysfs_split(path, b, sizeof(b)))) {
+                if ((dfd = sysfs_dir_fd(b)) < 0)
+                        return -1;
+                return readlinkat(dfd, base, buf, bufsiz);
+        }
+        return readlink(path, buf, bufsiz);
+}
+
+typedef int (* dirent_select_fn) (const struct dirent *);
+typedef int (* dirent_select_ctx_fn) (const struct dirent *, void *);
+typedef bool (* dirent_key_fn) (const char *, struct addr_hctl *);
+
+struct hctl_sort_ent {
+        struct addr_hctl key;
+        struct dirent * dep;
+};
+
+static int
+hctl_sort_ent_cmp(const void * a, const void * b)
+{
+        const struct hctl_sort_ent * le = (const struct hctl_sort_ent *)a;
+        const struct hctl_sort_ent * ri = (const struct hctl_sort_ent *)b;
+        int res;
+
+        res = cmp_hctl(&le->key, &ri->key);
+        /* equal keys only expected from names that did not parse */
+        return res ? res : strcmp(le->dep->d_name, ri->dep->d_name);
+}
+
+/* Sorts the 'num' entries in 'namelist' into hctl order. Each name is
+ * converted once, by key_fn(), into a key; names that key_fn() cannot
+ * convert are placed last, in name order. Returns false if out of
+ * memory (and leaves 'namelist' unsorted). */
+static bool
+sort_hctl_namelist(struct dirent ** namelist, int num, dirent_key_fn key_fn)
+{
+        int k;
+        struct hctl_sort_ent * arr;
+
+        if (num < 2)
+                return true;
+        arr = (struct hctl_sort_ent *)malloc(num * sizeof(*arr));
+        if (NULL == arr)
+                return false;
+        for (k = 0; k < num; ++k) {
+                arr[k].dep = namelist[k];
+                if (! key_fn(namelist[k]->d_name, &arr[k].key)) {
+                        pr2serr("%s: parse failed: %.20s\n", __func__,
+                                namelist[k]->d_name);
+                        arr[k].key.h = INT_MAX;
+                        arr[k].key.c = INT_MAX;
+                        arr[k].key.t = INT_MAX;
+                        arr[k].key.l = UINT64_LAST;
+                }
+        }
+        qsort(arr, num, sizeof(*arr), hctl_sort_ent_cmp);
+        for (k = 0; k < num; ++k)
+                namelist[k] = arr[k].dep;
+        free(arr);
+        return true;
+}
+
+/* Like scandir(3) but opens 'dir_name' relative to a kept directory
+ * descriptor when it is within sysfs, and passes 'ctx' to select_fn() so
+ * that it can record what it finds without using file scope variables.
+ * Rather than a comparison function, key_fn() (if given) is used by
+ * sort_hctl_namelist() to sort the entries into hctl order. */
+static int
+sysfs_scandir_ctx(const char * dir_name, struct dirent *** namelist,
+                  dirent_select_ctx_fn select_fn, dirent_key_fn key_fn,
+                  void * ctx)
+{
+        int fd, k, len, num, max_num, err;
+        DIR * dirp;
+        struct dirent * dep;
+        struct dirent * ep;
+        struct dirent ** list;
+        struct dirent ** nlist;
+
+        fd = sysfs_openat(dir_name, ".", O_RDONLY | O_DIRECTORY);
+        if (fd < 0)
+                return -1;
+        if (NULL == (dirp = fdopendir(fd))) {
+                err = errno;
+                close(fd);
+                errno = err;
+                return -1;
+        }
+        list = NULL;
+        num = 0;
+        max_num = 0;
+        err = 0;
+        while ((dep = readdir(dirp))) {
+                if (select_fn && (0 == select_fn(dep, ctx)))
+                        continue;
+                if (num >= max_num) {
+                        max_num = max_num ? (2 * max_num) : 32;
+                        nlist = (struct dirent **)realloc(list,
+                                        max_num * sizeof(struct dirent *));
+                        if (NULL == nlist) {
+                                err = ENOMEM;
+                                break;
+                        }
+                        list = nlist;
+                }
+                len = offsetof(struct dirent, d_name) + strlen(dep->d_name) + 1;
+                if (NULL == (ep = (struct dirent *)malloc(len))) {
+                        err = ENOMEM;
+                        break;
+                }
+                memcpy(ep, dep, len);
+                list[num++] = ep;
+        }
+        closedir(dirp);
+        if (err) {
+                for (k = 0; k < num; ++k)
+                        free(list[k]);
+                free(list);
+                errno = err;
+                return -1;
+        }
+        if (key_fn)
+                sort_hctl_namelist(list, num, key_fn);
+        *namelist = list;
+        return num;
+}
+
+static int
+select_no_ctx(const struct dirent * s, void * ctx)
+{
+        return (*(dirent_select_fn *)ctx)(s);
+}
+
+/* Like scandir(3), see sysfs_scandir_ctx() */
+static int
+sysfs_scandir(const char * dir_name, struct dirent *** namelist,
+              dirent_select_fn select_fn, dirent_key_fn key_fn)
+{
+        return sysfs_scandir_ctx(dir_name, namelist,
+                                 (select_fn ? select_no_ctx : NULL),
+                                 key_fn, &select_fn);
+}
+
+static void
+sysfs_close_fds(void)
+{
+        int k;
+
+        for (k = 0; k < SYSFS_DEV_FDS; ++k) {
+                if (sysfs_dev_fds[k].name) {
+                        close(sysfs_dev_fds[k].fd);
+                        free(sysfs_dev_fds[k].name);
+                        sysfs_dev_fds[k].name = NULL;
+                }
+        }
+        for (k = 0; k < sysfs_class_fds_used; ++k) {
+                if (sysfs_class_fds[k].fd >= 0)
+                        close(sysfs_class_fds[k].fd);
+                free(sysfs_class_fds[k].name);
+        }
+        sysfs_class_fds_used = 0;
+        if (sysfs_root_fd >= 0) {
+                close(sysfs_root_fd);
+                sysfs_root_fd = -1;
+        }
+}
+
+static void
+scan_ctx_init(struct scan_ctx * sc)
+{
+        memset(sc, 0, sizeof(*sc));
+        sc->transport_id = TRANSPORT_UNKNOWN;
+}
+
+/* Return 1 for directory entry that is link or directory (other than
+ * a directory name starting with dot). Else return 0.  */
+static int
+first_dir_scan_select(const struct dirent * s, void * ctx)
+{
+        struct scan_ctx * sc = (struct scan_ctx *)ctx;
+        if (FT_OTHER != sc->aa_first.ft)
+                return 0;
+        if (! dir_or_link(s, NULL))
+                return 0;
+        my_strcopy(sc->aa_first.name, s->d_name, LMAX_NAME);
+        sc->aa_first.ft = FT_CHAR;  /* dummy */
+        sc->aa_first.d_type =  s->d_type;
+        return 1;
+}
+
+/* Selects symlinks and directories that don't start with "." */
+static int
+sub_dir_scan_select(const struct dirent * s)
+{
+        return (dir_or_link(s, NULL)) ? 1 : 0;
+}
+
+/* Selects symlinks and directories that don't start with "." as long as
+ * they contain the string "scsi_disk". */
+static int
+sd_dir_scan_select(const struct dirent * s)
+{
+        return (dir_or_link(s, "scsi_disk")) ? 1 : 0;
+}
+
+/* Return 1 for directory entry that is link or directory (other than a
+ * directory name starting with dot) that contains "block". Else return 0.
+ */
+static int
+block_dir_scan_select(const struct dirent * s)
+{
+        return (dir_or_link(s, "block")) ? 1 : 0;
+}
+
+/* Scans directory dir_name, selecting elements on the basis of fn (NULL
+ * select all), into an unsorted list. The first item is assumed to be
+ * directories (or symlinks to) and it is appended, after a '/' to dir_name.
+ * Then if sub_str is found in that dir_name, it selects items that are
+ * directories or symlinks, the first of which is appended, after a '/',
+ * to dir_name. If conditions are met true is return, elae false.
+ */
+static bool
+sub_scan(char * dir_name, const char * sub_str, dirent_select_fn fn)
+{
+        int num, k, len;
+        struct dirent ** namelist;
+
+        num = sysfs_scandir(dir_name, &namelist, fn, NULL);
+        if (num <= 0)
+                return false;
+        len = strlen(dir_name);
+        if (len >= LMAX_PATH)
+                return false;
+        snprintf(dir_name + len, LMAX_PATH - len, "/%s", namelist[0]->d_name);
+
+        for (k = 0; k < num; ++k)
+                free(namelist[k]);
+        free(namelist);
+
+        if (strstr(dir_name, sub_str) == 0) {
+                num = sysfs_scandir(dir_name, &namelist,
+                                    sub_dir_scan_select, NULL);
+                if (num <= 0)
+                        return false;
+                len = strlen(dir_name);
                 if (len >= LMAX_PATH)
                         return false;
                 snprintf(dir_name + len, LMAX_PATH - len, "/%s",
@@ -937,13 +1819,14 @@ sd_scan(char * dir_name)
 }
 
 static int
-enclosure_device_dir_scan_select(const struct dirent * s)
+enclosure_device_dir_scan_select(const struct dirent * s, void * ctx)
 {
+        struct scan_ctx * sc = (struct scan_ctx *)ctx;
         if (dir_or_link(s, "enclosure_device")) {
-                my_strcopy(enclosure_device.name, s->d_name,
+                my_strcopy(sc->enclosure_device.name, s->d_name,
                            LMAX_NAME);
-                enclosure_device.ft = FT_CHAR;  /* dummy */
-                enclosure_device.d_type =  s->d_type;
+                sc->enclosure_device.ft = FT_CHAR;  /* dummy */
+                sc->enclosure_device.d_type =  s->d_type;
                 return 1;
         }
         return 0;
@@ -953,18 +1836,19 @@ enclosure_device_dir_scan_select(const struct dirent * s)
  * directory name starting with dot) that contains "enclosure_device".
  * Else return false.  */
 static bool
-enclosure_device_scan(const char * dir_name, const struct lsscsi_opts * op)
+enclosure_device_scan(const char * dir_name, struct scan_ctx * sc,
+                      const struct lsscsi_opts * op)
 {
         int num, k;
         struct dirent ** namelist;
 
-        num = scandir(dir_name, &namelist, enclosure_device_dir_scan_select,
-                      NULL);
+        num = sysfs_scandir_ctx(dir_name, &namelist,
+                                enclosure_device_dir_scan_select, NULL, sc);
         if (num < 0) {
                 if (op->verbose > 0) {
-                        snprintf(errpath, LMAX_PATH, "%s: scandir: %s",
+                        snprintf(sc->errpath, LMAX_PATH, "%s: scandir: %s",
                                  __func__, dir_name);
-                        perror(errpath);
+                        perror(sc->errpath);
                 }
                 return false;
         }
@@ -977,18 +1861,20 @@ enclosure_device_scan(const char * dir_name, const struct lsscsi_opts * op)
 /* scan for directory entry that is either a symlink or a directory. Returns
  * number found or -1 for error. */
 static int
-scan_for_first(const char * dir_name, const struct lsscsi_opts * op)
+scan_for_first(const char * dir_name, struct scan_ctx * sc,
+               const struct lsscsi_opts * op)
 {
         int num, k;
         struct dirent ** namelist;
 
-        aa_first.ft = FT_OTHER;
-        num = scandir(dir_name, &namelist, first_dir_scan_select, NULL);
+        sc->aa_first.ft = FT_OTHER;
+        num = sysfs_scandir_ctx(dir_name, &namelist, first_dir_scan_select,
+                                NULL, sc);
         if (num < 0) {
                 if (op->verbose > 0) {
-                        snprintf(errpath, LMAX_PATH, "%s: scandir: %s",
+                        snprintf(sc->errpath, LMAX_PATH, "%s: scandir: %s",
                                  __func__, dir_name);
-                        perror(errpath);
+                        perror(sc->errpath);
                 }
                 return -1;
         }
@@ -999,43 +1885,44 @@ scan_for_first(const char * dir_name, const struct lsscsi_opts * op)
 }
 
 static int
-non_sg_dir_scan_select(const struct dirent * s)
+non_sg_dir_scan_select(const struct dirent * s, void * ctx)
 {
+        struct scan_ctx * sc = (struct scan_ctx *)ctx;
         int len;
 
-        if (FT_OTHER != non_sg.ft)
+        if (FT_OTHER != sc->non_sg.ft)
                 return 0;
         if (! dir_or_link(s, NULL))
                 return 0;
         if (0 == strncmp("scsi_changer", s->d_name, 12)) {
-                my_strcopy(non_sg.name, s->d_name, LMAX_NAME);
-                non_sg.ft = FT_CHAR;
-                non_sg.d_type =  s->d_type;
+                my_strcopy(sc->non_sg.name, s->d_name, LMAX_NAME);
+                sc->non_sg.ft = FT_CHAR;
+                sc->non_sg.d_type =  s->d_type;
                 return 1;
         } else if (0 == strncmp("block", s->d_name, 5)) {
-                my_strcopy(non_sg.name, s->d_name, LMAX_NAME);
-                non_sg.ft = FT_BLOCK;
-                non_sg.d_type =  s->d_type;
+                my_strcopy(sc->non_sg.name, s->d_name, LMAX_NAME);
+                sc->non_sg.ft = FT_BLOCK;
+                sc->non_sg.d_type =  s->d_type;
                 return 1;
         } else if (0 == strcmp("tape", s->d_name)) {
-                my_strcopy(non_sg.name, s->d_name, LMAX_NAME);
-                non_sg.ft = FT_CHAR;
-                non_sg.d_type =  s->d_type;
+                my_strcopy(sc->non_sg.name, s->d_name, LMAX_NAME);
+                sc->non_sg.ft = FT_CHAR;
+                sc->non_sg.d_type =  s->d_type;
                 return 1;
         } else if (0 == strncmp("scsi_tape:st", s->d_name, 12)) {
                 len = strlen(s->d_name);
                 if (isdigit(s->d_name[len - 1])) {
                         /* want 'st<num>' symlink only */
-                        my_strcopy(non_sg.name, s->d_name, LMAX_NAME);
-                        non_sg.ft = FT_CHAR;
-                        non_sg.d_type =  s->d_type;
+                        my_strcopy(sc->non_sg.name, s->d_name, LMAX_NAME);
+                        sc->non_sg.ft = FT_CHAR;
+                        sc->non_sg.d_type =  s->d_type;
                         return 1;
                 } else
                         return 0;
         } else if (0 == strncmp("onstream_tape:os", s->d_name, 16)) {
-                my_strcopy(non_sg.name, s->d_name, LMAX_NAME);
-                non_sg.ft = FT_CHAR;
-                non_sg.d_type =  s->d_type;
+                my_strcopy(sc->non_sg.name, s->d_name, LMAX_NAME);
+                sc->non_sg.ft = FT_CHAR;
+                sc->non_sg.d_type =  s->d_type;
                 return 1;
         } else
                 return 0;
@@ -1043,18 +1930,20 @@ non_sg_dir_scan_select(const struct dirent * s)
 
 /* Returns number found or -1 for error */
 static int
-non_sg_scan(const char * dir_name, const struct lsscsi_opts * op)
+non_sg_scan(const char * dir_name, struct scan_ctx * sc,
+            const struct lsscsi_opts * op)
 {
         int num, k;
         struct dirent ** namelist;
 
-        non_sg.ft = FT_OTHER;
-        num = scandir(dir_name, &namelist, non_sg_dir_scan_select, NULL);
+        sc->non_sg.ft = FT_OTHER;
+        num = sysfs_scandir_ctx(dir_name, &namelist, non_sg_dir_scan_select,
+                                NULL, sc);
         if (num < 0) {
                 if (op->verbose > 0) {
-                        snprintf(errpath, LMAX_PATH, "%s: scandir: %s",
+                        snprintf(sc->errpath, LMAX_PATH, "%s: scandir: %s",
                                  __func__, dir_name);
-                        perror(errpath);
+                        perror(sc->errpath);
                 }
                 return -1;
         }
@@ -1066,14 +1955,15 @@ non_sg_scan(const char * dir_name, const struct lsscsi_opts * op)
 
 
 static int
-sg_dir_scan_select(const struct dirent * s)
+sg_dir_scan_select(const struct dirent * s, void * ctx)
 {
-        if (FT_OTHER != aa_sg.ft)
+        struct scan_ctx * sc = (struct scan_ctx *)ctx;
+        if (FT_OTHER != sc->aa_sg.ft)
                 return 0;
         if (dir_or_link(s, "scsi_generic")) {
-                my_strcopy(aa_sg.name, s->d_name, LMAX_NAME);
-                aa_sg.ft = FT_CHAR;
-                aa_sg.d_type =  s->d_type;
+                my_strcopy(sc->aa_sg.name, s->d_name, LMAX_NAME);
+                sc->aa_sg.ft = FT_CHAR;
+                sc->aa_sg.d_type =  s->d_type;
                 return 1;
         } else
                 return 0;
@@ -1082,13 +1972,14 @@ sg_dir_scan_select(const struct dirent * s)
 /* Returns number of directories or links starting with "scsi_generic"
  * found or -1 for error. */
 static int
-sg_scan(const char * dir_name)
+sg_scan(const char * dir_name, struct scan_ctx * sc)
 {
         int num, k;
         struct dirent ** namelist;
 
-        aa_sg.ft = FT_OTHER;
-        num = scandir(dir_name, &namelist, sg_dir_scan_select, NULL);
+        sc->aa_sg.ft = FT_OTHER;
+        num = sysfs_scandir_ctx(dir_name, &namelist, sg_dir_scan_select, NULL,
+                                sc);
         if (num < 0)
                 return -1;
         for (k = 0; k < num; ++k)
@@ -1111,7 +2002,8 @@ sas_port_scan(const char * dir_name, struct dirent ***port_list)
         struct dirent ** namelist;
 
         namelist = NULL;
-        num = scandir(dir_name, &namelist, sas_port_dir_scan_select, NULL);
+        num = sysfs_scandir(dir_name, &namelist, sas_port_dir_scan_select,
+                            NULL);
         if (num < 0) {
                 *port_list = NULL;
                 return -1;
@@ -1122,25 +2014,28 @@ sas_port_scan(const char * dir_name, struct dirent ***port_list)
 
 
 static int
-sas_low_phy_dir_scan_select(const struct dirent * s)
+sas_low_phy_dir_scan_select(const struct dirent * s, void * ctx)
 {
+        struct scan_ctx * sc = (struct scan_ctx *)ctx;
         int n, m;
         char * cp;
 
         if (dir_or_link(s, "phy")) {
-                if (0 == strlen(sas_low_phy))
-                        my_strcopy(sas_low_phy, s->d_name, LMAX_NAME);
+                if (0 == strlen(sc->sas_low_phy))
+                        my_strcopy(sc->sas_low_phy, s->d_name,
+                                   LMAX_NAME);
                 else {
                         cp = (char *)strrchr(s->d_name, ':');
                         if (NULL == cp)
                                 return 0;
                         n = atoi(cp + 1);
-                        cp = strrchr(sas_low_phy, ':');
+                        cp = strrchr(sc->sas_low_phy, ':');
                         if (NULL == cp)
                                 return 0;
                         m = atoi(cp + 1);
                         if (n < m)
-                                my_strcopy(sas_low_phy, s->d_name, LMAX_NAME);
+                                my_strcopy(sc->sas_low_phy, s->d_name,
+                                           LMAX_NAME);
                 }
                 return 1;
         } else
@@ -1148,13 +2043,15 @@ sas_low_phy_dir_scan_select(const struct dirent * s)
 }
 
 static int
-sas_low_phy_scan(const char * dir_name, struct dirent ***phy_list)
+sas_low_phy_scan(const char * dir_name, struct scan_ctx * sc,
+                 struct dirent ***phy_list)
 {
         int num, k;
         struct dirent ** namelist=NULL;
 
-        memset(sas_low_phy, 0, sizeof(sas_low_phy));
-        num = scandir(dir_name, &namelist, sas_low_phy_dir_scan_select, NULL);
+        memset(sc->sas_low_phy, 0, sizeof(sc->sas_low_phy));
+        num = sysfs_scandir_ctx(dir_name, &namelist,
+                                sas_low_phy_dir_scan_select, NULL, sc);
         if (num < 0)
                 return -1;
         if (! phy_list) {
@@ -1167,157 +2064,515 @@ sas_low_phy_scan(const char * dir_name, struct dirent ***phy_list)
         return num;
 }
 
-static int
-iscsi_target_dir_scan_select(const struct dirent * s)
+/* If 'dir_name'/'base_name' is a directory place its canonical path (i.e.
+ * with all symlinks resolved) in 'b' and return true, else return false.
+ * An empty 'base_name' refers to 'dir_name' itself and 'b' may overlap either
+ * name. The directory is opened (O_PATH) and the kernel is asked for its
+ * path via /proc/self/fd so the working directory is never changed. */
+static bool
+if_directory_resolve(const char * dir_name, const char * base_name, char * b,
+                     int b_len)
 {
-        int off;
-        char buff[LMAX_PATH];
-        struct stat a_stat;
+        int fd, n;
+        bool kept;
+        char pth[32];
+        char full[LMAX_PATH];
+        char res[LMAX_PATH];
 
-        if (dir_or_link(s, "session")) {
-                iscsi_tsession_num = atoi(s->d_name + 7);
-                my_strcopy(buff, iscsi_dir_name, LMAX_PATH);
-                off = strlen(buff);
-                snprintf(buff + off, sizeof(buff) - off,
-                         "/%s/target%d:%d:%d", s->d_name, iscsi_target_hct->h,
-                         iscsi_target_hct->c, iscsi_target_hct->t);
-                if ((stat(buff, &a_stat) >= 0) && S_ISDIR(a_stat.st_mode))
-                        return 1;
-                else
-                        return 0;
-        } else
-                return 0;
+        if (b_len < 2)
+                return false;
+        kept = (('\0' == base_name[0]) && sysfs_rel(dir_name));
+        if (kept)
+                fd = sysfs_dir_fd(dir_name);
+        else
+                fd = sysfs_openat(dir_name, ('\0' == base_name[0]) ? "." :
+                                  base_name, O_PATH | O_DIRECTORY);
+        if (fd < 0)
+                return false;
+        snprintf(pth, sizeof(pth), "/proc/self/fd/%d", fd);
+        n = readlink(pth, res, sizeof(res) - 1);
+        if (! kept)
+                close(fd);
+        if ((n > 0) && ('/' == res[0])) {
+                res[n] = '\0';
+        } else {        /* /proc not mounted? */
+                n = snprintf(full, sizeof(full), "%s/%s", dir_name,
+                             base_name);
+                if ((n >= (int)sizeof(full)) || (NULL == realpath(full, res)))
+                        return false;
+        }
+        if ((int)strlen(res) >= b_len)
+                return false;
+        my_strcopy(b, res, b_len);
+        return true;
 }
 
-static int
-iscsi_target_scan(const char * dir_name, const struct addr_hctl * hctl)
-{
-        int num, k;
-        struct dirent ** namelist;
+#if HAVE_IO_URING
+
+/* Batched attribute reads using io_uring. For each device directory the
+ * attributes it is expected to need are submitted as one batch: each is an
+ * open (into a registered "direct" descriptor slot), linked to a read and
+ * a close, so one io_uring_enter() starts them all. get_value() looks in
+ * the batches first and only falls back to open/read/close when an
+ * attribute was not batched or its read was incomplete. Two batches are
+ * kept so the next device can be in flight while the current one is being
+ * output. If io_uring cannot be set up nothing is batched. */
+#define URING_MAX_ATTRS 24
+#define URING_BATCHES 2
+#define URING_ENTRIES 256       /* >= URING_BATCHES * URING_MAX_ATTRS * 3 */
+#define URING_ATTR_LEN 256
+
+enum uring_op {URING_OPEN, URING_READ, URING_CLOSE};
+
+struct uring_attr {
+        const char * name;
+        int open_res;           /* 0 or -errno */
+        int read_res;           /* bytes read or -errno */
+        char val[URING_ATTR_LEN];
+};
 
-        iscsi_dir_name = dir_name;
-        iscsi_target_hct = hctl;
-        iscsi_tsession_num = -1;
-        num = scandir(dir_name, &namelist, iscsi_target_dir_scan_select,
-                      NULL);
-        if (num < 0)
-                return -1;
-        for (k = 0; k < num; ++k)
-                free(namelist[k]);
-        free(namelist);
-        return num;
-}
+struct uring_batch {
+        int num;                /* number of attributes */
+        int outstanding;        /* completions still expected */
+        int dfd;                /* directory the attributes are in */
+        char dir_name[LMAX_DEVPATH];
+        struct uring_attr attrs[URING_MAX_ATTRS];
+};
 
+static struct uring_ctx {
+        bool tried;
+        bool ok;
+        pid_t pid;              /* ring belongs to this process */
+        int fd;
+        int next;               /* batch to fill next */
+        unsigned int * sq_tail;
+        unsigned int * sq_mask;
+        unsigned int * sq_array;
+        unsigned int * cq_head;
+        unsigned int * cq_tail;
+        unsigned int * cq_mask;
+        struct io_uring_sqe * sqes;
+        struct io_uring_cqe * cqes;
+        void * ring_p;
+        size_t ring_sz;
+        size_t sqes_sz;
+        struct uring_batch batch[URING_BATCHES];
+} uring;
 
-/* If 'dir_name'/'base_name' is a directory chdir to it. If that is successful
-   return true, else false */
-static bool
-if_directory_chdir(const char * dir_name, const char * base_name)
+static void
+uring_fini(void)
 {
-        char b[LMAX_PATH];
-        struct stat a_stat;
+        int k;
 
-        snprintf(b, sizeof(b), "%s/%s", dir_name, base_name);
-        if (stat(b, &a_stat) < 0)
-                return false;
-        if (S_ISDIR(a_stat.st_mode)) {
-                if (chdir(b) < 0)
-                        return false;
-                return true;
+        if (uring.ok) {
+                munmap(uring.sqes, uring.sqes_sz);
+                munmap(uring.ring_p, uring.ring_sz);
+                close(uring.fd);
         }
-        return false;
+        for (k = 0; k < URING_BATCHES; ++k) {
+                if (uring.batch[k].dfd >= 0)
+                        close(uring.batch[k].dfd);
+        }
+        memset(&uring, 0, sizeof(uring));
 }
 
-/* If 'dir_name'/generic is a directory chdir to it. If that is successful
-   return true. Otherwise look a directory of the form
-   'dir_name'/scsi_generic:sg<n> and if found chdir to it and return true.
-   Otherwise return false. */
+/* Sets up the ring on first use in this process (a --jobs worker does not
+ * share its parent's ring). Returns true if batching is available. */
 static bool
-if_directory_ch2generic(const char * dir_name)
+uring_init(void)
 {
-        const char * old_name = "generic";
-        char b[LMAX_PATH];
-        struct stat a_stat;
-
-        snprintf(b, sizeof(b), "%s/%s", dir_name, old_name);
-        if ((stat(b, &a_stat) >= 0) && S_ISDIR(a_stat.st_mode)) {
-                if (chdir(b) < 0)
-                        return false;
-                return true;
+        int k, fd;
+        size_t sq_sz, cq_sz;
+        uint8_t * p;
+        struct io_uring_params prm;
+        int slots[URING_BATCHES * URING_MAX_ATTRS];
+
+        if (uring.tried && (uring.pid == getpid()))
+                return uring.ok;
+        if (uring.tried) {      /* forked: drop the parent's ring */
+                if (uring.ok) {
+                        munmap(uring.sqes, uring.sqes_sz);
+                        munmap(uring.ring_p, uring.ring_sz);
+                        close(uring.fd);
+                }
+                memset(&uring, 0, sizeof(uring));
         }
-        /* No "generic", so now look for "scsi_generic:sg<n>" */
-        if (1 != sg_scan(dir_name))
-                return false;
-        snprintf(b, sizeof(b), "%s/%s", dir_name, aa_sg.name);
-        if (stat(b, &a_stat) < 0)
+        uring.tried = true;
+        uring.pid = getpid();
+        for (k = 0; k < URING_BATCHES; ++k)
+                uring.batch[k].dfd = -1;
+        memset(&prm, 0, sizeof(prm));
+        fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &prm);
+        if (fd < 0)
                 return false;
-        if (S_ISDIR(a_stat.st_mode)) {
-                if (chdir(b) < 0)
-                        return false;
-                return true;
+        if (! (prm.features & IORING_FEAT_SINGLE_MMAP))
+                goto err_out;
+        sq_sz = prm.sq_off.array + prm.sq_entries * sizeof(unsigned int);
+        cq_sz = prm.cq_off.cqes + prm.cq_entries * sizeof(struct io_uring_cqe);
+        uring.ring_sz = (sq_sz > cq_sz) ? sq_sz : cq_sz;
+        uring.ring_p = mmap(NULL, uring.ring_sz, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (MAP_FAILED == uring.ring_p)
+                goto err_out;
+        uring.sqes_sz = prm.sq_entries * sizeof(struct io_uring_sqe);
+        uring.sqes = (struct io_uring_sqe *)mmap(NULL, uring.sqes_sz,
+                                PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_POPULATE, fd,
+                                IORING_OFF_SQES);
+        if (MAP_FAILED == uring.sqes) {
+                munmap(uring.ring_p, uring.ring_sz);
+                goto err_out;
         }
+        p = (uint8_t *)uring.ring_p;
+        uring.sq_tail = (unsigned int *)(p + prm.sq_off.tail);
+        uring.sq_mask = (unsigned int *)(p + prm.sq_off.ring_mask);
+        uring.sq_array = (unsigned int *)(p + prm.sq_off.array);
+        uring.cq_head = (unsigned int *)(p + prm.cq_off.head);
+        uring.cq_tail = (unsigned int *)(p + prm.cq_off.tail);
+        uring.cq_mask = (unsigned int *)(p + prm.cq_off.ring_mask);
+        uring.cqes = (struct io_uring_cqe *)(p + prm.cq_off.cqes);
+        /* empty (sparse) table of direct descriptors for the opens */
+        for (k = 0; k < (int)(sizeof(slots) / sizeof(slots[0])); ++k)
+                slots[k] = -1;
+        if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_FILES, slots,
+                    sizeof(slots) / sizeof(slots[0])) < 0) {
+                munmap(uring.sqes, uring.sqes_sz);
+                munmap(uring.ring_p, uring.ring_sz);
+                goto err_out;
+        }
+        uring.fd = fd;
+        uring.ok = true;
+        return true;
+
+err_out:
+        close(fd);
         return false;
 }
 
-/* If 'dir_name'/'base_name' is found places corresponding value in 'value'
- * and returns true . Else returns false.
- */
-static bool
-get_value(const char * dir_name, const char * base_name, char * value,
-          int max_value_len)
+/* Handles completions that are ready. If 'wait' is true waits for at least
+ * one when there are none. */
+static void
+uring_reap(bool wait)
 {
-        int len;
-        FILE * f;
-        char b[LMAX_PATH];
-
-        snprintf(b, sizeof(b), "%s/%s", dir_name, base_name);
-        if (NULL == (f = fopen(b, "r"))) {
-                return false;
+        unsigned int head, tail, k;
+        struct io_uring_cqe * cqe;
+        struct uring_batch * bp;
+        struct uring_attr * ap;
+
+        head = *uring.cq_head;
+        tail = __atomic_load_n(uring.cq_tail, __ATOMIC_ACQUIRE);
+        if ((head == tail) && wait) {
+                if (syscall(__NR_io_uring_enter, uring.fd, 0, 1,
+                            IORING_ENTER_GETEVENTS, NULL, 0) < 0) {
+                        if (EINTR != errno)
+                                uring.ok = false;   /* give up batching */
+                        return;
+                }
+                tail = __atomic_load_n(uring.cq_tail, __ATOMIC_ACQUIRE);
         }
-        if (NULL == fgets(value, max_value_len, f)) {
-                /* assume empty */
-                value[0] = '\0';
-                fclose(f);
-                return true;
+        for ( ; head != tail; ++head) {
+                cqe = &uring.cqes[head & *uring.cq_mask];
+                bp = &uring.batch[(cqe->user_data >> 16) % URING_BATCHES];
+                k = (cqe->user_data >> 2) & 0x3fff;
+                if (k >= URING_MAX_ATTRS)
+                        continue;
+                ap = &bp->attrs[k];
+                switch (cqe->user_data & 0x3) {
+                case URING_OPEN:
+                        ap->open_res = (cqe->res < 0) ? cqe->res : 0;
+                        /* direct descriptors not supported (before lk 5.15) */
+                        if (-EINVAL == cqe->res)
+                                uring.ok = false;
+                        break;
+                case URING_READ:
+                        ap->read_res = cqe->res;
+                        break;
+                default:
+                        break;
+                }
+                --bp->outstanding;
         }
-        len = strlen(value);
-        if ((len > 0) && (value[len - 1] == '\n'))
-                value[len - 1] = '\0';
-        fclose(f);
-        return true;
+        __atomic_store_n(uring.cq_head, head, __ATOMIC_RELEASE);
 }
 
-/* Allocate dev_node_list and collect info on every char and block devices
- * in /dev but not its subdirectories. This list excludes symlinks, even if
- * they are to devices. */
+/* Waits for all the reads in batch 'bp' to complete and then closes its
+ * directory. */
 static void
-collect_dev_nodes(void)
+uring_drain(struct uring_batch * bp)
 {
-        size_t dnl_sz = sizeof(struct dev_node_list);
-        struct dirent *dep;
-        DIR *dirp;
-        struct dev_node_list *cur_list, *prev_list;
-        struct dev_node_entry *cur_ent;
-        char device_path[LMAX_DEVPATH];
-        struct stat stats;
+        while (uring.ok && (bp->outstanding > 0))
+                uring_reap(true);
+        if (bp->outstanding > 0)        /* ring failed, forget the batch */
+                bp->num = 0;
+        if (bp->dfd >= 0) {
+                close(bp->dfd);
+                bp->dfd = -1;
+        }
+}
 
-        if (dev_node_listhead)
-                return; /* already collected nodes */
+/* Submits reads of the 'num' attributes named in 'names' found in directory
+ * 'dir_name'. They complete in the background; get_value() collects them. */
+static void
+uring_prefetch(const char * dir_name, const char ** names, int num)
+{
+        int k, j, slot, b;
+        unsigned int tail, mask;
+        struct uring_batch * bp;
+        struct uring_attr * ap;
+        struct io_uring_sqe * sqe;
 
-        dev_node_listhead = (struct dev_node_list *)calloc(1, dnl_sz);
-        if (! dev_node_listhead)
+        if ((! uring_init()) || (num < 1))
                 return;
-
-        cur_list = dev_node_listhead;
-        cur_list->next = NULL;
-        cur_list->count = 0;
-
-        dirp = opendir(dev_dir);
-        if (dirp == NULL)
+        if (num > URING_MAX_ATTRS)
+                num = URING_MAX_ATTRS;
+        b = uring.next;
+        uring.next = (uring.next + 1) % URING_BATCHES;
+        bp = &uring.batch[b];
+        uring_drain(bp);
+        bp->num = 0;
+        if (! uring.ok)
                 return;
-
-        while (1) {
-                dep = readdir(dirp);
+        my_strcopy(bp->dir_name, dir_name, sizeof(bp->dir_name));
+        bp->dfd = sysfs_openat(dir_name, ".", O_RDONLY | O_DIRECTORY);
+        if (bp->dfd < 0)
+                return;
+        tail = *uring.sq_tail;
+        mask = *uring.sq_mask;
+        for (k = 0; k < num; ++k) {
+                ap = &bp->attrs[k];
+                ap->name = names[k];
+                ap->open_res = -ECANCELED;
+                ap->read_res = -ECANCELED;
+                slot = (b * URING_MAX_ATTRS) + k;
+                for (j = URING_OPEN; j <= URING_CLOSE; ++j) {
+                        sqe = &uring.sqes[tail & mask];
+                        memset(sqe, 0, sizeof(*sqe));
+                        sqe->user_data = ((uint64_t)b << 16) | (k << 2) | j;
+                        if (URING_OPEN == j) {
+                                sqe->opcode = IORING_OP_OPENAT;
+                                sqe->fd = bp->dfd;
+                                sqe->addr = (uint64_t)(uintptr_t)ap->name;
+                                sqe->open_flags = O_RDONLY;
+                                sqe->file_index = slot + 1;
+                                sqe->flags = IOSQE_IO_LINK;
+                        } else if (URING_READ == j) {
+                                sqe->opcode = IORING_OP_READ;
+                                sqe->fd = slot;
+                                sqe->addr = (uint64_t)(uintptr_t)ap->val;
+                                sqe->len = sizeof(ap->val) - 1;
+                                sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+                        } else {
+                                sqe->opcode = IORING_OP_CLOSE;
+                                sqe->file_index = slot + 1;
+                        }
+                        uring.sq_array[tail & mask] = tail & mask;
+                        ++tail;
+                }
+        }
+        __atomic_store_n(uring.sq_tail, tail, __ATOMIC_RELEASE);
+        bp->num = num;
+        bp->outstanding = num * 3;
+        if (syscall(__NR_io_uring_enter, uring.fd, num * 3, 0, 0, NULL,
+                    0) < 0) {
+                /* nothing was submitted, use the normal path */
+                bp->num = 0;
+                bp->outstanding = 0;
+                uring.ok = false;
+        }
+}
+
+/* If 'dir_name'/'base_name' was batched and completely read, place its
+ * value (first line only, as get_value()) in 'value' and return 1. If it
+ * was batched and does not exist return 0. Otherwise return -1 and the
+ * caller should read it itself. */
+static int
+uring_get_value(const char * dir_name, const char * base_name, char * value,
+                int max_value_len)
+{
+        int b, k, len;
+        char * cp;
+        struct uring_batch * bp;
+        struct uring_attr * ap;
+
+        if (! (uring.tried && (uring.pid == getpid())))
+                return -1;
+        for (b = 0; b < URING_BATCHES; ++b) {
+                bp = &uring.batch[b];
+                if ((bp->num < 1) || strcmp(bp->dir_name, dir_name))
+                        continue;
+                for (k = 0; k < bp->num; ++k) {
+                        if (0 == strcmp(bp->attrs[k].name, base_name))
+                                break;
+                }
+                if (k >= bp->num)
+                        continue;
+                uring_drain(bp);
+                if (k >= bp->num)
+                        return -1;
+                ap = &bp->attrs[k];
+                if (-ENOENT == ap->open_res)
+                        return 0;
+                if ((ap->open_res < 0) || (ap->read_res < 0) ||
+                    (ap->read_res >= (int)sizeof(ap->val) - 1))
+                        return -1;      /* maybe truncated: read it again */
+                len = ap->read_res;
+                if (len > (max_value_len - 1))
+                        len = max_value_len - 1;
+                memcpy(value, ap->val, len);
+                value[len] = '\0';
+                if ((cp = strchr(value, '\n')))
+                        *cp = '\0';
+                return 1;
+        }
+        return -1;
+}
+
+#endif  /* HAVE_IO_URING */
+
+/* If 'dir_name'/'base_name' is found places corresponding value in 'value'
+ * and returns true . Else returns false.
+ */
+static bool
+get_value(const char * dir_name, const char * base_name, char * value,
+          int max_value_len)
+{
+        int fd, len;
+        char * cp;
+
+#if HAVE_IO_URING
+        if ((len = uring_get_value(dir_name, base_name, value,
+                                   max_value_len)) >= 0)
+                return !! len;
+#endif
+        if ((fd = sysfs_openat(dir_name, base_name, O_RDONLY)) < 0)
+                return false;
+        len = read(fd, value, max_value_len - 1);
+        close(fd);
+        if (len < 0)
+                len = 0;        /* assume empty */
+        value[len] = '\0';
+        /* only want the first line, without its trailing newline */
+        if ((cp = strchr(value, '\n')))
+                *cp = '\0';
+        return true;
+}
+
+/* Mixes the bits of a 64 bit value (finaliser from MurmurHash3) */
+static uint32_t
+u64_hash(uint64_t v)
+{
+        v ^= v >> 33;
+        v *= 0xff51afd7ed558ccdULL;
+        v ^= v >> 33;
+        v *= 0xc4ceb9fe1a85ec53ULL;
+        v ^= v >> 33;
+        return (uint32_t)v;
+}
+
+/* FNV-1a hash of a string */
+static uint32_t
+str_hash(const char * cp)
+{
+        uint32_t h = 2166136261U;
+
+        for ( ; *cp; ++cp) {
+                h ^= (uint8_t)*cp;
+                h *= 16777619U;
+        }
+        return h;
+}
+
+static unsigned int
+dev_node_hash_fn(unsigned int maj, unsigned int min, enum dev_type type)
+{
+        uint32_t h;
+
+        h = ((maj << 20) ^ min) * 2 + (BLK_DEV == type ? 0 : 1);
+        h ^= h >> 16;
+        h *= 0x85ebca6bU;
+        h ^= h >> 13;
+        h *= 0xc2b2ae35U;
+        h ^= h >> 16;
+        return h & dev_node_hash_mask;
+}
+
+/* Builds dev_node_hash from dev_node_list. When several nodes share a
+ * (maj, min, type) the newest is kept; of equally new nodes the first
+ * one found in /dev wins. */
+static void
+index_dev_nodes(void)
+{
+        unsigned int k, n, sz;
+        struct dev_node_list *cur_list;
+        struct dev_node_entry *cur_ent;
+        struct dev_node_entry **epp;
+
+        for (n = 0, cur_list = dev_node_listhead; cur_list;
+             cur_list = cur_list->next)
+                n += cur_list->count;
+        for (sz = 16; sz < (2 * n); sz <<= 1)
+                ;
+        dev_node_hash = (struct dev_node_entry **)calloc(sz,
+                                        sizeof(struct dev_node_entry *));
+        if (NULL == dev_node_hash)
+                return;
+        dev_node_hash_mask = sz - 1;
+        for (cur_list = dev_node_listhead; cur_list;
+             cur_list = cur_list->next) {
+                for (k = 0; k < cur_list->count; ++k) {
+                        cur_ent = &cur_list->nodes[k];
+                        epp = &dev_node_hash[dev_node_hash_fn(cur_ent->maj,
+                                                              cur_ent->min,
+                                                              cur_ent->type)];
+                        for ( ; *epp; epp = &(*epp)->hnext) {
+                                if (((*epp)->maj == cur_ent->maj) &&
+                                    ((*epp)->min == cur_ent->min) &&
+                                    ((*epp)->type == cur_ent->type))
+                                        break;
+                        }
+                        if (NULL == *epp) {
+                                cur_ent->hnext = NULL;
+                                *epp = cur_ent;
+                        } else if (difftime(cur_ent->mtime,
+                                            (*epp)->mtime) > 0) {
+                                cur_ent->hnext = (*epp)->hnext;
+                                *epp = cur_ent;
+                        }
+                }
+        }
+}
+
+/* Allocate dev_node_list and collect info on every char and block devices
+ * in /dev but not its subdirectories. This list excludes symlinks, even if
+ * they are to devices. */
+static void
+collect_dev_nodes(void)
+{
+        size_t dnl_sz = sizeof(struct dev_node_list);
+        struct dirent *dep;
+        DIR *dirp;
+        struct dev_node_list *cur_list, *prev_list;
+        struct dev_node_entry *cur_ent;
+        char device_path[LMAX_DEVPATH];
+        struct stat stats;
+
+        if (dev_node_listhead)
+                return; /* already collected nodes */
+
+        dev_node_listhead = (struct dev_node_list *)calloc(1, dnl_sz);
+        if (! dev_node_listhead)
+                return;
+
+        cur_list = dev_node_listhead;
+        cur_list->next = NULL;
+        cur_list->count = 0;
+
+        dirp = opendir(dev_dir);
+        if (dirp == NULL)
+                return;
+
+        while (1) {
+                dep = readdir(dirp);
                 if (dep == NULL)
                         break;
 
@@ -1356,6 +2611,7 @@ collect_dev_nodes(void)
                 cur_list->count++;
         }
         closedir(dirp);
+        index_dev_nodes();
 }
 
 /* Free dev_node_list. */
@@ -1374,64 +2630,141 @@ free_dev_node_list(void)
 
                 dev_node_listhead = NULL;
         }
+        free(dev_node_hash);
+        dev_node_hash = NULL;
+        dev_node_hash_mask = 0;
+}
+
+/* Reads the MAJOR, MINOR and DEVNAME values from the uevent file of the
+ * class device at 'wd'. Returns true if all three are found. */
+static bool
+get_uevent_dev(const char * wd, unsigned int * majp, unsigned int * minp,
+               char * devname, int devname_len)
+{
+        int fd, n;
+        int found = 0;
+        char * cp;
+        char * ep;
+        char b[1024];
+
+        if ((fd = sysfs_openat(wd, "uevent", O_RDONLY)) < 0)
+                return false;
+        n = read(fd, b, sizeof(b) - 1);
+        close(fd);
+        if (n <= 0)
+                return false;
+        b[n] = '\0';
+        for (cp = b; *cp; cp = ep) {
+                if ((ep = strchr(cp, '\n')))
+                        *ep++ = '\0';
+                else
+                        ep = cp + strlen(cp);
+                if (0 == strncmp(cp, "MAJOR=", 6)) {
+                        *majp = strtoul(cp + 6, NULL, 10);
+                        found |= 1;
+                } else if (0 == strncmp(cp, "MINOR=", 6)) {
+                        *minp = strtoul(cp + 6, NULL, 10);
+                        found |= 2;
+                } else if (0 == strncmp(cp, "DEVNAME=", 8)) {
+                        my_strcopy(devname, cp + 8, devname_len);
+                        found |= 4;
+                }
+        }
+        return (7 == found);
 }
 
 /* Given a path to a class device, find the most recent device node with
  * matching major/minor and type. Outputs to node which is assumed to be at
  * least LMAX_NAME bytes long. Returns true if match found, false
- * otherwise. */
+ * otherwise. The node named by the kernel (DEVNAME in the uevent file) is
+ * tried first and confirmed with a single lstat(); only if that fails is
+ * every node in /dev collected and looked up. */
 static bool
 get_dev_node(const char * wd, char * node, enum dev_type type)
 {
-        bool match_found = false;
-        unsigned int k = 0;
         unsigned int maj, min;
-        time_t newest_mtime = 0;
         struct dev_node_entry *cur_ent;
-        struct dev_node_list *cur_list;
+        struct stat a_stat;
         char value[LMAX_NAME];
+        char path[LMAX_DEVPATH];
 
         /* assume 'node' is at least 2 bytes long */
         memcpy(node, "-", 2);
+        if (get_uevent_dev(wd, &maj, &min, value, sizeof(value))) {
+                /* like collect_dev_nodes(): no sub-directories or symlinks */
+                if (NULL == strchr(value, '/')) {
+                        snprintf(path, sizeof(path), "%s/%s", dev_dir, value);
+                        if ((lstat(path, &a_stat) >= 0) &&
+                            ((BLK_DEV == type) ? S_ISBLK(a_stat.st_mode) :
+                                                 S_ISCHR(a_stat.st_mode)) &&
+                            (major(a_stat.st_rdev) == maj) &&
+                            (minor(a_stat.st_rdev) == min)) {
+                                my_strcopy(node, path, LMAX_NAME);
+                                return true;
+                        }
+                }
+        } else {
+                /* Get the major/minor for this device. */
+                if (!get_value(wd, "dev", value, LMAX_NAME))
+                        return false;
+                if (2 != sscanf(value, "%u:%u", &maj, &min))
+                        return false;
+        }
+
         if (dev_node_listhead == NULL) {
                 collect_dev_nodes();
                 if (dev_node_listhead == NULL)
-                        goto exit;
+                        return false;
         }
+        if (NULL == dev_node_hash)
+                return false;
 
-        /* Get the major/minor for this device. */
-        if (!get_value(wd, "dev", value, LMAX_NAME))
-                goto exit;
-        sscanf(value, "%u:%u", &maj, &min);
-
-        /* Search the node list for the newest match on this major/minor. */
-        cur_list = dev_node_listhead;
-
-        while (1) {
-                if (k >= cur_list->count) {
-                        cur_list = cur_list->next;
-                        if (! cur_list)
-                                break;
-                        k = 0;
+        /* The index holds the newest node for this major/minor. */
+        for (cur_ent = dev_node_hash[dev_node_hash_fn(maj, min, type)];
+             cur_ent; cur_ent = cur_ent->hnext) {
+                if ((maj == cur_ent->maj) && (min == cur_ent->min) &&
+                    (type == cur_ent->type)) {
+                        my_strcopy(node, cur_ent->name, LMAX_NAME);
+                        return true;
                 }
+        }
+        return false;
+}
 
-                cur_ent = &cur_list->nodes[k];
-                k++;
+/* Builds disk_wwn_hash, with at least twice 'num' buckets, from
+ * disk_wwn_node_list. The first entry found for a disk is kept. */
+static void
+index_disk_wwn_nodes(int num)
+{
+        unsigned int k, sz;
+        struct disk_wwn_node_list *cur_list;
+        struct disk_wwn_node_entry *cur_ent;
+        struct disk_wwn_node_entry **epp;
 
-                if ((maj == cur_ent->maj) &&
-                    (min == cur_ent->min) &&
-                    (type == cur_ent->type)) {
-                        if ((! match_found) ||
-                            (difftime(cur_ent->mtime,newest_mtime) > 0)) {
-                                newest_mtime = cur_ent->mtime;
-                                my_strcopy(node, cur_ent->name, LMAX_NAME);
+        for (sz = 16; sz < (2 * (unsigned int)num); sz <<= 1)
+                ;
+        disk_wwn_hash = (struct disk_wwn_node_entry **)calloc(sz,
+                                        sizeof(struct disk_wwn_node_entry *));
+        if (NULL == disk_wwn_hash)
+                return;
+        disk_wwn_hash_mask = sz - 1;
+        for (cur_list = disk_wwn_node_listhead; cur_list;
+             cur_list = cur_list->next) {
+                for (k = 0; k < cur_list->count; ++k) {
+                        cur_ent = &cur_list->nodes[k];
+                        epp = &disk_wwn_hash[str_hash(cur_ent->disk_bname) &
+                                             disk_wwn_hash_mask];
+                        for ( ; *epp; epp = &(*epp)->hnext) {
+                                if (0 == strcmp((*epp)->disk_bname,
+                                                cur_ent->disk_bname))
+                                        break;
+                        }
+                        if (NULL == *epp) {
+                                cur_ent->hnext = NULL;
+                                *epp = cur_ent;
                         }
-                        match_found = true;
                 }
         }
-
-exit:
-        return match_found;
 }
 
 /* Allocate disk_wwn_node_list and collect info on every node in
@@ -1501,7 +2834,7 @@ collect_disk_wwn_nodes(void)
                 }
 
                 cur_ent = &cur_list->nodes[cur_list->count];
-                my_strcopy(cur_ent->wwn, "0x", 2);
+                memcpy(cur_ent->wwn, "0x", 2);
                 my_strcopy(cur_ent->wwn + 2, dep->d_name + 5,
                            sizeof(cur_ent->wwn) - 2);
                 my_strcopy(cur_ent->disk_bname, basename(symlink_path),
@@ -1510,6 +2843,7 @@ collect_disk_wwn_nodes(void)
                 ++num;
         }
         closedir(dirp);
+        index_disk_wwn_nodes(num);
         return num;
 }
 
@@ -1529,174 +2863,663 @@ free_disk_wwn_node_list(void)
 
                 disk_wwn_node_listhead = NULL;
         }
+        free(disk_wwn_hash);
+        disk_wwn_hash = NULL;
+        disk_wwn_hash_mask = 0;
 }
 
-/* Given a path to a class device, find the most recent device node with
-   matching major/minor. Returns true if match found, false otherwise. */
+/* Given a path to a class device, find the WWN of the disk with the same
+   kernel name. Returns true if match found, false otherwise. */
 static bool
 get_disk_wwn(const char *wd, char * wwn_str, int max_wwn_str_len)
 {
-        unsigned int k = 0;
-        char * bn;
-        struct disk_wwn_node_list *cur_list;
+        const char * bn;
         struct disk_wwn_node_entry *cur_ent;
-        char name[LMAX_PATH];
 
-        my_strcopy(name, wd, sizeof(name));
-        name[sizeof(name) - 1] = '\0';
-        bn = basename(name);
+        bn = strrchr(wd, '/');
+        bn = bn ? (bn + 1) : wd;
         if (disk_wwn_node_listhead == NULL) {
                 collect_disk_wwn_nodes();
                 if (disk_wwn_node_listhead == NULL)
                         return false;
         }
-        cur_list = disk_wwn_node_listhead;
-        while (1) {
-                if (k >= cur_list->count) {
-                        cur_list = cur_list->next;
-                        if (! cur_list)
-                                break;
-                        k = 0;
-                }
-                cur_ent = &cur_list->nodes[k];
-                k++;
+        if (NULL == disk_wwn_hash)
+                return false;
+        for (cur_ent = disk_wwn_hash[str_hash(bn) & disk_wwn_hash_mask];
+             cur_ent; cur_ent = cur_ent->hnext) {
                 if (0 == strcmp(cur_ent->disk_bname, bn)) {
                         my_strcopy(wwn_str, cur_ent->wwn, max_wwn_str_len);
-                        wwn_str[max_wwn_str_len - 1] = '\0';
                         return true;
                 }
         }
         return false;
 }
 
-/*
- * Look up a device node in a directory with symlinks to device nodes.
- * @dir: Directory to examine, e.g. "/dev/disk/by-id".
- * @pfx: Prefix of the symlink, e.g. "scsi-".
- * @dev: Device node to look up, e.g. "/dev/sda".
- * Returns a pointer to the name of the symlink without the prefix if a match
- * has been found.
- * Side effect: changes the working directory to @dir.
- * Note: The caller must free the pointer returned by this function.
- */
-static char *
-lookup_dev(const char *dir, const char *pfx, const char *dev)
+/* A SAS end device (e.g. "end_device-0:1:2") as found above SCSI devices
+ * (LUs) in sysfs. Those LUs share it, so its sas_address is read once. */
+struct sas_end_dev {
+        char * name;
+        int addr_state;         /* 0: not read yet, 1: read, -1: none */
+        char sas_address[LMAX_NAME];
+        struct sas_end_dev * hnext;
+};
+
+/* Map from SCSI device (LU) name (e.g. "2:0:1:0") to its sg device, its
+ * block device, whether it is a SCSI disk and its SAS end device. It is
+ * built, when many devices are to be listed, by reading
+ * /sys/class/scsi_generic , /sys/class/block , /sys/class/scsi_disk and
+ * /sys/class/scsi_device once each rather than looking in each device's
+ * directory for them. */
+struct lu_map_entry {
+        char * lu_name;
+        char sg_name[LMAX_NAME];        /* "" if none */
+        char blk_name[LMAX_NAME];       /* "" if none */
+        bool sd;                        /* found in /sys/class/scsi_disk */
+        struct sas_end_dev * end_dev;   /* NULL if not below one */
+        struct lu_map_entry * hnext;
+};
+
+#define LU_MAP_SG 0x1           /* sg_name fields are valid */
+#define LU_MAP_BLK 0x2          /* blk_name and sd fields are valid */
+#define LU_MAP_SAS 0x4          /* end_dev fields are valid */
+
+static int lu_map_valid = 0;    /* OR-ed LU_MAP_* */
+static struct lu_map_entry ** lu_map_hash = NULL;
+static unsigned int lu_map_hash_mask = 0;
+static struct sas_end_dev ** sas_end_dev_hash = NULL;  /* same size */
+
+/* Returns the entry for 'lu_name', which is added if 'create' is true. May
+ * return NULL. */
+static struct lu_map_entry *
+lu_map_find(const char * lu_name, bool create)
 {
-        unsigned st_rdev;
-        DIR *dirp;
-        struct dirent *entry;
-        char *result = NULL;
-        struct stat stats;
+        struct lu_map_entry * ep;
+        struct lu_map_entry ** epp;
 
-        if (stat(dev, &stats) < 0)
-                goto out;
-        st_rdev = stats.st_rdev;
-        if (chdir(dir) < 0)
-                goto out;
-        dirp = opendir(dir);
-        if (!dirp)
-                goto out;
-        while ((entry = readdir(dirp)) != NULL) {
-                if (stat(entry->d_name, &stats) >= 0 &&
-                    stats.st_rdev == st_rdev &&
-                    strncmp(entry->d_name, pfx, strlen(pfx)) == 0) {
-                        result = strdup(entry->d_name + strlen(pfx));
-                        break;
-                }
+        if (NULL == lu_map_hash)
+                return NULL;
+        epp = &lu_map_hash[str_hash(lu_name) & lu_map_hash_mask];
+        for ( ; *epp; epp = &(*epp)->hnext) {
+                if (0 == strcmp((*epp)->lu_name, lu_name))
+                        return *epp;
         }
-        closedir(dirp);
-out:
-        return result;
+        if (! create)
+                return NULL;
+        ep = (struct lu_map_entry *)calloc(1, sizeof(*ep));
+        if (NULL == ep)
+                return NULL;
+        if (NULL == (ep->lu_name = strdup(lu_name))) {
+                free(ep);
+                return NULL;
+        }
+        *epp = ep;
+        return ep;
 }
 
-/*
- * Obtain the SCSI ID of a disk.
- * @dev_node: Device node of the disk, e.g. "/dev/sda".
- * Return value: pointer to the SCSI ID if lookup succeeded or NULL if lookup
- * failed.
- * Note: The caller must free the returned buffer with free().
- */
-static char *
-get_disk_scsi_id(const char *dev_node)
+/* Reads the links in the class directory 'cls' (e.g. "/class/block/").
+ * Each one of interest is a link to <device path>/<LU name>/<sub>/<name>,
+ * where 'sub' is e.g. "block". Links with more after <name> (e.g. disk
+ * partitions) are ignored. Calls add() with the entry for each LU found,
+ * <name> and the link's text up to the end of <LU name>. Returns false if
+ * the directory can not be read. */
+static bool
+lu_map_scan_class(const char * cls, const char * sub,
+                  void (* add)(struct lu_map_entry *, const char *,
+                               char *))
 {
-        char *scsi_id = NULL;
-        DIR *dir;
-        struct dirent *entry;
-        char holder[LMAX_PATH + 6];
-        char sys_block[LMAX_PATH];
+        int fd, len, sub_len;
+        DIR * dirp;
+        struct dirent * dep;
+        struct lu_map_entry * ep;
+        char buff[LMAX_DEVPATH];
+        char lnk[LMAX_PATH];
+        char * cp;
 
-        scsi_id = lookup_dev(dev_disk_byid_dir, "scsi-", dev_node);
-        if (scsi_id)
-                goto out;
-        scsi_id = lookup_dev(dev_disk_byid_dir, "dm-uuid-mpath-", dev_node);
-        if (scsi_id)
-                goto out;
-        scsi_id = lookup_dev(dev_disk_byid_dir, "usb-", dev_node);
-        if (scsi_id)
-                goto out;
-        snprintf(sys_block, sizeof(sys_block), "%s/class/block/%s/holders",
-                 sysfsroot, dev_node + 5);
-        dir = opendir(sys_block);
-        if (!dir)
-                goto out;
-        while ((entry = readdir(dir)) != NULL) {
-                snprintf(holder, sizeof(holder), "/dev/%s", entry->d_name);
-                scsi_id = get_disk_scsi_id(holder);
-                if (scsi_id)
-                        break;
+        snprintf(buff, sizeof(buff), "%s%s", sysfsroot, cls);
+        if ((fd = sysfs_openat(buff, ".", O_RDONLY | O_DIRECTORY)) < 0)
+                return false;
+        if (NULL == (dirp = fdopendir(fd))) {
+                close(fd);
+                return false;
         }
-        closedir(dir);
-out:
-        return scsi_id;
+        snprintf(buff, sizeof(buff), "/%s/", sub);
+        sub_len = strlen(buff);
+        while ((dep = readdir(dirp))) {
+                if ('.' == dep->d_name[0])
+                        continue;
+                len = readlinkat(dirfd(dirp), dep->d_name, lnk,
+                                 sizeof(lnk) - 1);
+                if (len <= 0)
+                        continue;
+                lnk[len] = '\0';
+                cp = strstr(lnk, buff);
+                if ((NULL == cp) || strcmp(cp + sub_len, dep->d_name))
+                        continue;
+                *cp = '\0';     /* LU name is the component before that */
+                cp = strrchr(lnk, '/');
+                if ((ep = lu_map_find(cp ? (cp + 1) : lnk, true)))
+                        add(ep, dep->d_name, lnk);
+        }
+        closedir(dirp);
+        return true;
 }
 
-/* Fetch USB device name string (form "<b>-<p1>[.<p2>]+:<c>.<i>") given
- * either a SCSI host name or devname (i.e. "h:c:t:l") string. If detected
- * return 'b' (pointer to start of USB device name string which is null
- * terminated), else return NULL.
- */
-static char *
-get_usb_devname(const char * hname, const char * devname, char * b, int b_len)
+static void
+lu_map_add_sg(struct lu_map_entry * ep, const char * name, char * lu_path)
 {
-        int len;
-        char * c2p;
-        char * cp;
-        const char * np;
-        char bf2[LMAX_PATH];
-        char buff[LMAX_DEVPATH];
+        (void)lu_path;
+        if ('\0' == ep->sg_name[0])     /* keep the first found */
+                my_strcopy(ep->sg_name, name, sizeof(ep->sg_name));
+}
 
-        if (hname) {
-                snprintf(buff, sizeof(buff), "%s%s", sysfsroot, scsi_host);
-                np = hname;
-        } else if (devname) {
-                snprintf(buff, sizeof(buff), "%s%s", sysfsroot,
-                         class_scsi_dev);
-                np = devname;
-        } else
-                return NULL;
-        if (if_directory_chdir(buff, np) && getcwd(bf2, sizeof(bf2)) &&
-            strstr(bf2, "usb")) {
-                if (b_len > 0)
-                        b[0] = '\0';
-                if ((cp = strstr(bf2, "/host"))) {
-                        len = (cp - bf2) - 1;
-                        if ((len > 0) &&
-                            ((c2p = (char *)memrchr(bf2, '/', len)))) {
-                                len = cp - ++c2p;
-                                snprintf(b, b_len, "%.*s", len, c2p);
-                        }
-                }
-                return b;
-        }
-        return NULL;
+static void
+lu_map_add_blk(struct lu_map_entry * ep, const char * name, char * lu_path)
+{
+        (void)lu_path;
+        if ('\0' == ep->blk_name[0])
+                my_strcopy(ep->blk_name, name, sizeof(ep->blk_name));
 }
 
-#define VPD_DEVICE_ID 0x83
-#define VPD_ASSOC_LU 0
-#define VPD_ASSOC_TPORT 1
-#define TPROTO_ISCSI 5
+static void
+lu_map_add_sd(struct lu_map_entry * ep, const char * name, char * lu_path)
+{
+        (void)name;
+        (void)lu_path;
+        ep->sd = true;
+}
 
-/* Iterates to next designation descriptor in the device identification
+/* The SAS end device of a LU is the directory two above it, as in
+ * .../end_device-0:1:2/target0:0:2/0:0:2:0 . Only LUs of hosts that have
+ * SAS transport (e.g. with a /sys/class/sas_host/host<n>) are asked for
+ * it, so every LU with such a parent is recorded here. */
+static void
+lu_map_add_sas(struct lu_map_entry * ep, const char * name, char * lu_path)
+{
+        int k;
+        char * cp;
+        struct sas_end_dev * sep;
+        struct sas_end_dev ** sepp;
+
+        (void)name;
+
+        for (k = 0; k < 2; ++k) {       /* up to the end device */
+                if (NULL == (cp = strrchr(lu_path, '/')))
+                        return;
+                *cp = '\0';
+        }
+        cp = strrchr(lu_path, '/');
+        cp = cp ? (cp + 1) : lu_path;
+        sepp = &sas_end_dev_hash[str_hash(cp) & lu_map_hash_mask];
+        for ( ; *sepp; sepp = &(*sepp)->hnext) {
+                if (0 == strcmp((*sepp)->name, cp)) {
+                        ep->end_dev = *sepp;
+                        return;
+                }
+        }
+        sep = (struct sas_end_dev *)calloc(1, sizeof(*sep));
+        if (NULL == sep)
+                return;
+        if (NULL == (sep->name = strdup(cp))) {
+                free(sep);
+                return;
+        }
+        *sepp = sep;
+        ep->end_dev = sep;
+}
+
+/* Returns true if the class directory 'cls' has at least one entry. */
+static bool
+class_has_entries(const char * cls)
+{
+        int fd;
+        bool found = false;
+        DIR * dirp;
+        struct dirent * dep;
+        char buff[LMAX_DEVPATH];
+
+        snprintf(buff, sizeof(buff), "%s%s", sysfsroot, cls);
+        if ((fd = sysfs_openat(buff, ".", O_RDONLY | O_DIRECTORY)) < 0)
+                return false;
+        if (NULL == (dirp = fdopendir(fd))) {
+                close(fd);
+                return false;
+        }
+        while ((! found) && (dep = readdir(dirp)))
+                found = ('.' != dep->d_name[0]);
+        closedir(dirp);
+        return found;
+}
+
+/* Builds lu_map_hash, sized for about 'num' LUs, from the class
+ * directories needed for the LU_MAP_* fields given in 'which'. Those that
+ * can be read are added to lu_map_valid; for the others the device
+ * directories are scanned as before. */
+static void
+collect_lu_map(int num, int which)
+{
+        unsigned int sz;
+
+        which &= ~lu_map_valid;
+        if (0 == which)
+                return;
+        if (NULL == lu_map_hash) {
+                for (sz = 16; sz < (2 * (unsigned int)num); sz <<= 1)
+                        ;
+                lu_map_hash = (struct lu_map_entry **)calloc(sz,
+                                        sizeof(struct lu_map_entry *));
+                if (NULL == lu_map_hash)
+                        return;
+                lu_map_hash_mask = sz - 1;
+        }
+        if ((LU_MAP_SAS & which) && (NULL == sas_end_dev_hash)) {
+                sas_end_dev_hash = (struct sas_end_dev **)calloc(
+                        lu_map_hash_mask + 1, sizeof(struct sas_end_dev *));
+                if (NULL == sas_end_dev_hash)
+                        which &= ~LU_MAP_SAS;
+        }
+        if ((LU_MAP_SG & which) &&
+            lu_map_scan_class(scsi_generic, "scsi_generic", lu_map_add_sg))
+                lu_map_valid |= LU_MAP_SG;
+        if ((LU_MAP_BLK & which) &&
+            lu_map_scan_class(class_block, "block", lu_map_add_blk) &&
+            lu_map_scan_class(scsi_disk, "scsi_disk", lu_map_add_sd))
+                lu_map_valid |= LU_MAP_BLK;
+        /* no end devices: no SAS transport LUs to look up */
+        if ((LU_MAP_SAS & which) && class_has_entries(sas_end_device) &&
+            lu_map_scan_class(class_scsi_dev, "scsi_device", lu_map_add_sas))
+                lu_map_valid |= LU_MAP_SAS;
+}
+
+static void
+free_lu_map(void)
+{
+        unsigned int j;
+        struct lu_map_entry * ep;
+        struct lu_map_entry * next_ep;
+        struct sas_end_dev * sep;
+        struct sas_end_dev * next_sep;
+
+        for (j = 0; lu_map_hash && (j <= lu_map_hash_mask); ++j) {
+                for (ep = lu_map_hash[j]; ep; ep = next_ep) {
+                        next_ep = ep->hnext;
+                        free(ep->lu_name);
+                        free(ep);
+                }
+        }
+        for (j = 0; sas_end_dev_hash && (j <= lu_map_hash_mask); ++j) {
+                for (sep = sas_end_dev_hash[j]; sep; sep = next_sep) {
+                        next_sep = sep->hnext;
+                        free(sep->name);
+                        free(sep);
+                }
+        }
+        free(sas_end_dev_hash);
+        sas_end_dev_hash = NULL;
+        free(lu_map_hash);
+        lu_map_hash = NULL;
+        lu_map_hash_mask = 0;
+        lu_map_valid = 0;
+}
+
+/* Returns the lu_map_hash entry for SCSI device directory 'dir_name' if
+ * the 'which' (LU_MAP_*) fields are valid and it has any of those
+ * devices, else NULL. */
+static const struct lu_map_entry *
+lu_map_lookup(const char * dir_name, int which)
+{
+        const char * bn;
+
+        if (which != (which & lu_map_valid))
+                return NULL;
+        bn = strrchr(dir_name, '/');
+        return lu_map_find(bn ? (bn + 1) : dir_name, false);
+}
+
+/* When the LU map holds sg devices, looks up the sg device of the SCSI
+ * device directory 'dir_name' in it and places the device's
+ * /sys/class/scsi_generic path in 'b'. Otherwise if 'dir_name'/generic is
+ * a directory place its canonical path in 'b'; failing that look for a
+ * directory of the form 'dir_name'/scsi_generic:sg<n> and if found place
+ * its canonical path in 'b'. Returns true if one of those was found. */
+static bool
+if_directory_resolve_generic(const char * dir_name, struct scan_ctx * sc,
+                             char * b, int b_len)
+{
+        const struct lu_map_entry * ep;
+
+        if ((ep = lu_map_lookup(dir_name, LU_MAP_SG))) {
+                if ('\0' == ep->sg_name[0])
+                        return false;
+                snprintf(b, b_len, "%s%s%s", sysfsroot, scsi_generic,
+                         ep->sg_name);
+                return true;
+        } else if (LU_MAP_SG & lu_map_valid)
+                return false;   /* not in /sys/class/scsi_generic */
+        if (if_directory_resolve(dir_name, "generic", b, b_len))
+                return true;
+        /* No "generic", so now look for "scsi_generic:sg<n>" */
+        if (1 != sg_scan(dir_name, sc))
+                return false;
+        return if_directory_resolve(dir_name, sc->aa_sg.name, b, b_len);
+}
+
+/* Returns the sysfs directory of the block device (e.g. sda) of the SCSI
+ * device directory 'dir_name', or NULL if it has none. Uses the LU map
+ * when it holds block devices, else scans 'dir_name'. The result is kept
+ * in 'sc' for the other columns of the same device. */
+static const char *
+sdev_block_dir(const char * dir_name, struct scan_ctx * sc)
+{
+        const struct lu_map_entry * ep;
+
+        if (0 == sc->blk_state) {
+                sc->blk_state = -1;
+                if ((ep = lu_map_lookup(dir_name, LU_MAP_BLK))) {
+                        if (ep->blk_name[0]) {
+                                snprintf(sc->blk_dir, sizeof(sc->blk_dir),
+                                         "%s%s%s", sysfsroot, class_block,
+                                         ep->blk_name);
+                                sc->blk_state = 1;
+                        }
+                } else if (0 == (LU_MAP_BLK & lu_map_valid)) {
+                        my_strcopy(sc->blk_dir, dir_name,
+                                   sizeof(sc->blk_dir));
+                        if (block_scan(sc->blk_dir))
+                                sc->blk_state = 1;
+                }
+        }
+        return (sc->blk_state > 0) ? sc->blk_dir : NULL;
+}
+
+/* Returns the sysfs scsi_disk directory of the SCSI device directory
+ * 'dir_name', or NULL if it has none. Like sdev_block_dir() otherwise. */
+static const char *
+sdev_sd_dir(const char * dir_name, struct scan_ctx * sc)
+{
+        const char * bn;
+        const struct lu_map_entry * ep;
+
+        if (0 == sc->sd_state) {
+                sc->sd_state = -1;
+                if ((ep = lu_map_lookup(dir_name, LU_MAP_BLK))) {
+                        if (ep->sd) {
+                                bn = strrchr(dir_name, '/');
+                                snprintf(sc->sd_dir, sizeof(sc->sd_dir),
+                                         "%s%s%s", sysfsroot, scsi_disk,
+                                         bn ? (bn + 1) : dir_name);
+                                sc->sd_state = 1;
+                        }
+                } else if (0 == (LU_MAP_BLK & lu_map_valid)) {
+                        my_strcopy(sc->sd_dir, dir_name, sizeof(sc->sd_dir));
+                        if (sd_scan(sc->sd_dir))
+                                sc->sd_state = 1;
+                }
+        }
+        return (sc->sd_state > 0) ? sc->sd_dir : NULL;
+}
+
+/* Index of /dev/disk/by-id keyed on the st_rdev of each link's target,
+ * built once per run. For each device the first name found (without its
+ * prefix) is kept for each of the prefixes in byid_pfx[], which are in
+ * order of preference. */
+static const char * byid_pfx[] = {"scsi-", "dm-uuid-mpath-", "usb-"};
+#define BYID_NUM_PFX ((int)(sizeof(byid_pfx) / sizeof(byid_pfx[0])))
+
+struct byid_entry {
+        dev_t rdev;
+        char * name[BYID_NUM_PFX];
+        struct byid_entry * hnext;
+};
+
+/* Memo of get_disk_scsi_id() results keyed on device node name. */
+struct scsi_id_memo {
+        char * dev_node;
+        char * scsi_id;         /* NULL if none found */
+        bool busy;              /* still being resolved (holder loop) */
+        struct scsi_id_memo * hnext;
+};
+
+#define SCSI_ID_MEMO_BUCKETS 256
+
+static bool byid_collected = false;
+static struct byid_entry ** byid_hash = NULL;
+static unsigned int byid_hash_mask = 0;
+static struct scsi_id_memo * scsi_id_memo_hash[SCSI_ID_MEMO_BUCKETS];
+
+static unsigned int
+byid_hash_fn(dev_t rdev)
+{
+        return u64_hash((uint64_t)rdev) & byid_hash_mask;
+}
+
+/* Reads /dev/disk/by-id once, stat()ing (through the link) each entry that
+ * starts with one of byid_pfx[], and builds byid_hash. */
+static void
+collect_byid_nodes(void)
+{
+        int k, num, pfx_len;
+        unsigned int sz;
+        DIR * dirp;
+        struct dirent * dep;
+        struct byid_entry * ep;
+        struct byid_entry ** epp;
+        struct stat a_stat;
+
+        byid_collected = true;
+        dirp = opendir(dev_disk_byid_dir);
+        if (NULL == dirp)
+                return;
+        for (num = 0; readdir(dirp); ++num)
+                ;
+        rewinddir(dirp);
+        for (sz = 16; sz < (2 * (unsigned int)num); sz <<= 1)
+                ;
+        byid_hash = (struct byid_entry **)calloc(sz,
+                                                 sizeof(struct byid_entry *));
+        if (NULL == byid_hash) {
+                closedir(dirp);
+                return;
+        }
+        byid_hash_mask = sz - 1;
+        while ((dep = readdir(dirp))) {
+                for (k = 0; k < BYID_NUM_PFX; ++k) {
+                        pfx_len = strlen(byid_pfx[k]);
+                        if (0 == strncmp(dep->d_name, byid_pfx[k], pfx_len))
+                                break;
+                }
+                if (k >= BYID_NUM_PFX)
+                        continue;
+                if (fstatat(dirfd(dirp), dep->d_name, &a_stat, 0) < 0)
+                        continue;
+                epp = &byid_hash[byid_hash_fn(a_stat.st_rdev)];
+                for ( ; *epp; epp = &(*epp)->hnext) {
+                        if ((*epp)->rdev == a_stat.st_rdev)
+                                break;
+                }
+                if (NULL == (ep = *epp)) {
+                        ep = (struct byid_entry *)calloc(1, sizeof(*ep));
+                        if (NULL == ep)
+                                break;
+                        ep->rdev = a_stat.st_rdev;
+                        *epp = ep;
+                }
+                if (NULL == ep->name[k])
+                        ep->name[k] = strdup(dep->d_name + pfx_len);
+        }
+        closedir(dirp);
+}
+
+static void
+free_byid_nodes(void)
+{
+        int k;
+        unsigned int j;
+        struct byid_entry * ep;
+        struct byid_entry * next_ep;
+        struct scsi_id_memo * mp;
+        struct scsi_id_memo * next_mp;
+
+        for (j = 0; byid_hash && (j <= byid_hash_mask); ++j) {
+                for (ep = byid_hash[j]; ep; ep = next_ep) {
+                        next_ep = ep->hnext;
+                        for (k = 0; k < BYID_NUM_PFX; ++k)
+                                free(ep->name[k]);
+                        free(ep);
+                }
+        }
+        free(byid_hash);
+        byid_hash = NULL;
+        byid_hash_mask = 0;
+        byid_collected = false;
+        for (j = 0; j < SCSI_ID_MEMO_BUCKETS; ++j) {
+                for (mp = scsi_id_memo_hash[j]; mp; mp = next_mp) {
+                        next_mp = mp->hnext;
+                        free(mp->dev_node);
+                        free(mp->scsi_id);
+                        free(mp);
+                }
+                scsi_id_memo_hash[j] = NULL;
+        }
+}
+
+/* Returns the preferred /dev/disk/by-id name (without prefix) of device
+ * node 'dev_node' or NULL if there is none. Not to be freed by caller. */
+static const char *
+lookup_byid(const char * dev_node)
+{
+        int k;
+        struct byid_entry * ep;
+        struct stat a_stat;
+
+        if (! byid_collected)
+                collect_byid_nodes();
+        if ((NULL == byid_hash) || (stat(dev_node, &a_stat) < 0))
+                return NULL;
+        for (ep = byid_hash[byid_hash_fn(a_stat.st_rdev)]; ep;
+             ep = ep->hnext) {
+                if (ep->rdev != a_stat.st_rdev)
+                        continue;
+                for (k = 0; k < BYID_NUM_PFX; ++k) {
+                        if (ep->name[k])
+                                return ep->name[k];
+                }
+        }
+        return NULL;
+}
+
+/*
+ * Obtain the SCSI ID of a disk.
+ * @dev_node: Device node of the disk, e.g. "/dev/sda".
+ * Return value: pointer to the SCSI ID if lookup succeeded or NULL if lookup
+ * failed. If the disk itself has no suitable /dev/disk/by-id entry then
+ * its holders (e.g. a multipath dm device) are tried. Results are memoised
+ * so a holder shared by many paths is only resolved once.
+ * Note: The caller must free the returned buffer with free().
+ */
+static char *
+get_disk_scsi_id(const char *dev_node)
+{
+        int k, num;
+        const char * cp;
+        char *scsi_id = NULL;
+        struct dirent ** namelist;
+        struct scsi_id_memo * mp;
+        struct scsi_id_memo ** mpp;
+        char holder[LMAX_PATH + 6];
+        char sys_block[LMAX_PATH];
+
+        mpp = &scsi_id_memo_hash[str_hash(dev_node) %
+                                 SCSI_ID_MEMO_BUCKETS];
+        for (mp = *mpp; mp; mp = mp->hnext) {
+                if (0 == strcmp(mp->dev_node, dev_node))
+                        return (mp->busy || (NULL == mp->scsi_id)) ? NULL :
+                               strdup(mp->scsi_id);
+        }
+        mp = (struct scsi_id_memo *)calloc(1, sizeof(*mp));
+        if (mp && (NULL == (mp->dev_node = strdup(dev_node)))) {
+                free(mp);
+                mp = NULL;
+        }
+        if (mp) {
+                mp->busy = true;
+                mp->hnext = *mpp;
+                *mpp = mp;
+        }
+
+        if ((cp = lookup_byid(dev_node))) {
+                scsi_id = strdup(cp);
+                goto out;
+        }
+        snprintf(sys_block, sizeof(sys_block), "%s/class/block/%s/holders",
+                 sysfsroot, dev_node + 5);
+        num = sysfs_scandir(sys_block, &namelist, sub_dir_scan_select, NULL);
+        if (num < 0)
+                goto out;
+        for (k = 0; k < num; ++k) {
+                if (NULL == scsi_id) {
+                        snprintf(holder, sizeof(holder), "/dev/%s",
+                                 namelist[k]->d_name);
+                        scsi_id = get_disk_scsi_id(holder);
+                }
+                free(namelist[k]);
+        }
+        free(namelist);
+out:
+        if (mp) {
+                mp->busy = false;
+                if (scsi_id)
+                        mp->scsi_id = strdup(scsi_id);
+        }
+        return scsi_id;
+}
+
+/* Fetch USB device name string (form "<b>-<p1>[.<p2>]+:<c>.<i>") given
+ * either a SCSI host name or devname (i.e. "h:c:t:l") string. If detected
+ * return 'b' (pointer to start of USB device name string which is null
+ * terminated), else return NULL.
+ */
+static char *
+get_usb_devname(const char * hname, const char * devname, char * b, int b_len)
+{
+        int len;
+        char * c2p;
+        char * cp;
+        const char * np;
+        char bf2[LMAX_PATH];
+        char buff[LMAX_DEVPATH];
+
+        if (hname) {
+                snprintf(buff, sizeof(buff), "%s%s", sysfsroot, scsi_host);
+                np = hname;
+        } else if (devname) {
+                snprintf(buff, sizeof(buff), "%s%s", sysfsroot,
+                         class_scsi_dev);
+                np = devname;
+        } else
+                return NULL;
+        if (if_directory_resolve(buff, np, bf2, sizeof(bf2)) &&
+            strstr(bf2, "usb")) {
+                if (b_len > 0)
+                        b[0] = '\0';
+                if ((cp = strstr(bf2, "/host"))) {
+                        len = (cp - bf2) - 1;
+                        if ((len > 0) &&
+                            ((c2p = (char *)memrchr(bf2, '/', len)))) {
+                                len = cp - ++c2p;
+                                snprintf(b, b_len, "%.*s", len, c2p);
+                        }
+                }
+                return b;
+        }
+        return NULL;
+}
+
+#define VPD_DEVICE_ID 0x83
+#define VPD_ASSOC_LU 0
+#define VPD_ASSOC_TPORT 1
+#define TPROTO_ISCSI 5
+
+/* Iterates to next designation descriptor in the device identification
  * VPD page. The 'initial_desig_desc' should point to start of first
  * descriptor with 'page_len' being the number of valid bytes in that
  * and following descriptors. To start, 'off' should point to a negative
@@ -1748,16 +3571,14 @@ get_lu_name(const char * devname, char * b, int b_len, bool want_prefix)
         char buff[LMAX_DEVPATH];
         uint8_t u[512];
         uint8_t u_sns[512];
-        struct stat a_stat;
 
         if ((NULL == b) || (b_len < 1))
                 return b;
         b[0] = '\0';
-        snprintf(buff, sizeof(buff), "%s%s%s/device/vpd_pg83",
-                 sysfsroot, class_scsi_dev, devname);
-        if (! ((stat(buff, &a_stat) >= 0) && S_ISREG(a_stat.st_mode)))
-                return b;
-        if ((fd = open(buff, O_RDONLY)) < 0)
+        snprintf(buff, sizeof(buff), "%s%s%s", sysfsroot, class_scsi_dev,
+                 devname);
+        /* read() fails if vpd_pg83 is not a regular file */
+        if ((fd = sysfs_openat(buff, "device/vpd_pg83", O_RDONLY)) < 0)
                 return b;
         res = read(fd, u, sizeof(u));
         if (res <= 8) {
@@ -1911,37 +3732,206 @@ parse_colon_list(const char * colon_list, struct addr_hctl * outp)
         return true;
 }
 
-/* Print enclosure device link from the rport- or end_device- */
+/* An enclosure component (e.g. "Slot 07") holding a SCSI device (LU), as
+ * found below /sys/class/enclosure . The kernel links the device's
+ * directory back to it as "enclosure_device:<component>". */
+struct encl_slot {
+        char * lu_name;
+        char encl_name[LMAX_NAME];      /* enclosure, e.g. its ses LU name */
+        char encl_id[LMAX_NAME];        /* enclosure logical id, maybe "" */
+        char component[LMAX_NAME];
+        char slot[32];                  /* "slot" attribute, maybe "" */
+        char status[32];
+        char fault[8];
+        char locate[8];
+        struct encl_slot * hnext;
+};
+
+#define ENCL_SLOT_HASH_SZ 256   /* power of 2 */
+
+static bool encl_slots_collected = false;
+static bool encl_slots_valid = false;   /* /sys/class/enclosure was read */
+static struct encl_slot * encl_slot_hash[ENCL_SLOT_HASH_SZ];
+
+/* Reads each enclosure in /sys/class/enclosure once, with every component
+ * that has a device, into encl_slot_hash keyed on that device's name. */
 static void
-print_enclosure_device(const char *devname, const char *path,
-                       const struct lsscsi_opts * op)
+collect_encl_slots(void)
 {
-        char b[LMAX_PATH];
-        struct addr_hctl hctl;
+        int num, num2, k, j, n;
+        const char * cp;
+        struct encl_slot * esp;
+        struct dirent ** namelist;
+        struct dirent ** namelist2;
+        char id[LMAX_NAME];
+        char buff[LMAX_DEVPATH];
+        char comp[LMAX_PATH];
+        char lnk[LMAX_PATH];
 
-        if (parse_colon_list(devname, &hctl)) {
-                snprintf(b, sizeof(b),
-                         "%s/device/target%d:%d:%d/%d:%d:%d:%" PRIu64,
-                         path, hctl.h, hctl.c, hctl.t,
-                         hctl.h, hctl.c, hctl.t, hctl.l);
-                if (enclosure_device_scan(b, op) > 0)
-                        printf("  %s\n",enclosure_device.name);
+        encl_slots_collected = true;
+        snprintf(buff, sizeof(buff), "%s%s", sysfsroot, class_enclosure);
+        num = sysfs_scandir(buff, &namelist, NULL, NULL);
+        if (num < 0)
+                return;
+        encl_slots_valid = true;
+        for (k = 0; k < num; ++k) {
+                if ('.' == namelist[k]->d_name[0])
+                        goto next_encl;
+                snprintf(buff, sizeof(buff), "%s%s%s", sysfsroot,
+                         class_enclosure, namelist[k]->d_name);
+                if (! get_value(buff, "id", id, sizeof(id)))
+                        id[0] = '\0';
+                num2 = sysfs_scandir(buff, &namelist2, NULL, NULL);
+                for (j = 0; j < num2; ++j) {
+                        /* components are the sub-directories with a
+                         * device link */
+                        if ((DT_LNK == namelist2[j]->d_type) ||
+                            ('.' == namelist2[j]->d_name[0]))
+                                goto next_comp;
+                        snprintf(comp, sizeof(comp), "%s/%s/device", buff,
+                                 namelist2[j]->d_name);
+                        n = sysfs_readlink(comp, lnk, sizeof(lnk) - 1);
+                        if (n <= 0)
+                                goto next_comp;
+                        lnk[n] = '\0';
+                        esp = (struct encl_slot *)calloc(1, sizeof(*esp));
+                        if (NULL == esp)
+                                goto next_comp;
+                        cp = strrchr(lnk, '/');
+                        if (NULL == (esp->lu_name =
+                                     strdup(cp ? (cp + 1) : lnk))) {
+                                free(esp);
+                                goto next_comp;
+                        }
+                        my_strcopy(esp->encl_name, namelist[k]->d_name,
+                                   sizeof(esp->encl_name));
+                        my_strcopy(esp->encl_id, id, sizeof(esp->encl_id));
+                        my_strcopy(esp->component, namelist2[j]->d_name,
+                                   sizeof(esp->component));
+                        comp[strlen(comp) - 7] = '\0';  /* drop "/device" */
+                        get_value(comp, "slot", esp->slot, sizeof(esp->slot));
+                        get_value(comp, "status", esp->status,
+                                  sizeof(esp->status));
+                        get_value(comp, "fault", esp->fault,
+                                  sizeof(esp->fault));
+                        get_value(comp, "locate", esp->locate,
+                                  sizeof(esp->locate));
+                        n = str_hash(esp->lu_name) & (ENCL_SLOT_HASH_SZ - 1);
+                        esp->hnext = encl_slot_hash[n];
+                        encl_slot_hash[n] = esp;
+next_comp:
+                        free(namelist2[j]);
+                }
+                if (num2 >= 0)
+                        free(namelist2);
+next_encl:
+                free(namelist[k]);
         }
+        free(namelist);
+}
+
+/* Returns the enclosure component holding the SCSI device 'devname' (e.g.
+ * "2:0:1:0"), or NULL. Sets *valid to false if /sys/class/enclosure could
+ * not be read (so the caller may look in the device's directory). */
+static const struct encl_slot *
+get_encl_slot(const char * devname, bool * valid)
+{
+        const struct encl_slot * esp;
+
+        if (! encl_slots_collected)
+                collect_encl_slots();
+        if (valid)
+                *valid = encl_slots_valid;
+        esp = encl_slot_hash[str_hash(devname) & (ENCL_SLOT_HASH_SZ - 1)];
+        for ( ; esp; esp = esp->hnext) {
+                if (0 == strcmp(esp->lu_name, devname))
+                        return esp;
+        }
+        return NULL;
 }
 
-/*
- * Obtain the GUID of the InfiniBand port associated with SCSI host number h
- * by stripping prefix fe80:0000:0000:0000: from GID 0. An example:
- * 0002:c903:00a0:5de2.
- */
 static void
-get_local_srp_gid(const int h, char *b, int b_len)
+free_encl_slots(void)
 {
-        int port;
-        char buff[LMAX_DEVPATH];
-        char value[LMAX_NAME];
+        int k;
+        struct encl_slot * esp;
+        struct encl_slot * next_esp;
+
+        for (k = 0; k < ENCL_SLOT_HASH_SZ; ++k) {
+                for (esp = encl_slot_hash[k]; esp; esp = next_esp) {
+                        next_esp = esp->hnext;
+                        free(esp->lu_name);
+                        free(esp);
+                }
+                encl_slot_hash[k] = NULL;
+        }
+        encl_slots_collected = false;
+        encl_slots_valid = false;
+}
 
-        snprintf(buff, sizeof(buff), "%s%shost%d", sysfsroot, scsi_host, h);
+/* Output the enclosure component holding 'devname', if any, for --long
+ * (one line) or --list (one attribute=value per line). */
+static void
+longer_encl_slot(const char * devname, const struct lsscsi_opts * op)
+{
+        const struct encl_slot * esp = get_encl_slot(devname, NULL);
+
+        if (NULL == esp)
+                return;
+        if (op->long_opt >= 3) {
+                out_printf("  enclosure=%s\n", esp->encl_name);
+                out_printf("  enclosure_id=%s\n", esp->encl_id);
+                out_printf("  component=%s\n", esp->component);
+                out_printf("  slot=%s\n", esp->slot);
+                out_printf("  status=%s\n", esp->status);
+                out_printf("  fault=%s\n", esp->fault);
+                out_printf("  locate=%s\n", esp->locate);
+        } else
+                out_printf("  enclosure=%s  component=%s  status=%s  fault=%s  "
+                           "locate=%s\n", esp->encl_name, esp->component,
+                           esp->status, esp->fault, esp->locate);
+}
+
+/* Print enclosure device link from the rport- or end_device- */
+static void
+print_enclosure_device(const char *devname, const char *path,
+                       struct scan_ctx * sc, const struct lsscsi_opts * op)
+{
+        bool valid;
+        char b[LMAX_PATH];
+        struct addr_hctl hctl;
+        const struct encl_slot * esp;
+
+        esp = get_encl_slot(devname, &valid);
+        if (esp) {
+                out_printf("  enclosure_device:%s\n", esp->component);
+                return;
+        }
+        if (valid)      /* not in any enclosure */
+                return;
+        if (parse_colon_list(devname, &hctl)) {
+                snprintf(b, sizeof(b),
+                         "%s/device/target%d:%d:%d/%d:%d:%d:%" PRIu64,
+                         path, hctl.h, hctl.c, hctl.t,
+                         hctl.h, hctl.c, hctl.t, hctl.l);
+                if (enclosure_device_scan(b, sc, op) > 0)
+                        out_printf("  %s\n",sc->enclosure_device.name);
+        }
+}
+
+/*
+ * Obtain the GUID of the InfiniBand port associated with SCSI host number h
+ * by stripping prefix fe80:0000:0000:0000: from GID 0. An example:
+ * 0002:c903:00a0:5de2.
+ */
+static void
+get_local_srp_gid(const int h, char *b, int b_len)
+{
+        int port;
+        char buff[LMAX_DEVPATH];
+        char value[LMAX_NAME];
+
+        snprintf(buff, sizeof(buff), "%s%shost%d", sysfsroot, scsi_host, h);
         if (!get_value(buff, "local_ib_port", value, sizeof(value)))
                 return;
         if (sscanf(value, "%d", &port) != 1)
@@ -1996,38 +3986,473 @@ get_srp_dgid(const int h, char *b, int b_len)
         return false;
 }
 
+/* What is known about the transport of SCSI host number 'h'. It depends
+ * only on the host so it is looked up once, by host_tport_get(), and then
+ * shared by transport_init() (for --hosts) and transport_tport() (for
+ * each device of that host). */
+#define HOST_TP_SAS 0x1         /* /sys/class/sas_host/host<h> */
+#define HOST_TP_SPI 0x2         /* /sys/class/spi_host/host<h> */
+#define HOST_TP_FC 0x4          /* /sys/class/fc_host/host<h> */
+#define HOST_TP_FCOE 0x8        /* ... and its symbolic_name has " over " */
+#define HOST_TP_SRP 0x10        /* /sys/class/srp_host/host<h> */
+#define HOST_TP_ISCSI 0x20      /* /sys/class/iscsi_host/host<h>/device */
+#define HOST_TP_USB 0x40        /* has a USB ancestor, name in usb_name */
+
+struct host_tport {
+        int h;
+        int flags;              /* OR-ed HOST_TP_* */
+        int ata_id;             /* TRANSPORT_SATA or TRANSPORT_ATA from the
+                                 * host's proc_name, else TRANSPORT_UNKNOWN */
+        char srp_gid[LMAX_NAME];        /* if HOST_TP_SRP, maybe "" */
+        char usb_name[LMAX_NAME];       /* if HOST_TP_USB */
+        struct host_tport * hnext;
+};
+
+#define HOST_TPORT_HASH_SZ 64   /* power of 2 */
+
+static struct host_tport * host_tport_hash[HOST_TPORT_HASH_SZ];
+
+static bool
+sysfs_is_dir(const char * path)
+{
+        struct stat a_stat;
+
+        return (sysfs_stat(path, &a_stat) >= 0) && S_ISDIR(a_stat.st_mode);
+}
+
+static void
+host_tport_fill(int h, struct host_tport * htp)
+{
+        char buff[LMAX_DEVPATH];
+        char wd[LMAX_PATH];
+
+        memset(htp, 0, sizeof(*htp));
+        htp->h = h;
+        htp->ata_id = TRANSPORT_UNKNOWN;
+        snprintf(buff, sizeof(buff), "%s%shost%d", sysfsroot, sas_host, h);
+        if (sysfs_is_dir(buff))
+                htp->flags |= HOST_TP_SAS;
+        snprintf(buff, sizeof(buff), "%s%shost%d", sysfsroot, spi_host, h);
+        if (sysfs_is_dir(buff))
+                htp->flags |= HOST_TP_SPI;
+        snprintf(buff, sizeof(buff), "%s%shost%d", sysfsroot, fc_host, h);
+        if (sysfs_is_dir(buff)) {
+                htp->flags |= HOST_TP_FC;
+                if (get_value(buff, "symbolic_name", wd, sizeof(wd)) &&
+                    strstr(wd, " over "))
+                        htp->flags |= HOST_TP_FCOE;
+        }
+        snprintf(buff, sizeof(buff), "%s%shost%d", sysfsroot, srp_host, h);
+        if (sysfs_is_dir(buff)) {
+                htp->flags |= HOST_TP_SRP;
+                get_local_srp_gid(h, htp->srp_gid, sizeof(htp->srp_gid));
+        }
+        snprintf(buff, sizeof(buff), "%s%shost%d/device", sysfsroot,
+                 iscsi_host, h);
+        if (sysfs_is_dir(buff))
+                htp->flags |= HOST_TP_ISCSI;
+        snprintf(buff, sizeof(buff), "host%d", h);
+        if (get_usb_devname(buff, NULL, htp->usb_name,
+                            sizeof(htp->usb_name) - 1))
+                htp->flags |= HOST_TP_USB;
+        /* ATA or SATA host, crude check: driver name */
+        snprintf(buff, sizeof(buff), "%s%shost%d", sysfsroot, scsi_host, h);
+        if (get_value(buff, "proc_name", wd, sizeof(wd))) {
+                if (0 == strcmp("ahci", wd))
+                        htp->ata_id = TRANSPORT_SATA;
+                else if (strstr(wd, "ata"))
+                        htp->ata_id = (0 == memcmp("sata", wd, 4)) ?
+                                      TRANSPORT_SATA : TRANSPORT_ATA;
+        }
+}
+
+/* Returns the transport record of SCSI host number 'h', looking it up on
+ * first use. If it can not be kept, 'tmp' is filled in and returned. */
+static const struct host_tport *
+host_tport_get(int h, struct host_tport * tmp)
+{
+        struct host_tport * htp;
+        struct host_tport ** hpp;
+
+        hpp = &host_tport_hash[(unsigned int)h & (HOST_TPORT_HASH_SZ - 1)];
+        for ( ; *hpp; hpp = &(*hpp)->hnext) {
+                if ((*hpp)->h == h)
+                        return *hpp;
+        }
+        htp = (struct host_tport *)malloc(sizeof(*htp));
+        if (NULL == htp)
+                htp = tmp;
+        host_tport_fill(h, htp);
+        if (htp != tmp)
+                *hpp = htp;
+        return htp;
+}
+
+static void
+free_host_tports(void)
+{
+        int k;
+        struct host_tport * htp;
+        struct host_tport * next_htp;
+
+        for (k = 0; k < HOST_TPORT_HASH_SZ; ++k) {
+                for (htp = host_tport_hash[k]; htp; htp = next_htp) {
+                        next_htp = htp->hnext;
+                        free(htp);
+                }
+                host_tport_hash[k] = NULL;
+        }
+}
+
+static unsigned int
+hct_hash(int h, int c, int t)
+{
+        return ((unsigned int)h * 31 + (unsigned int)c) * 31 + (unsigned int)t;
+}
+
+/* FC remote port attributes output by transport_tport_longer(), in order */
+static const char * fc_rport_attrs[] = {
+        "node_name", "port_name", "port_id", "port_state", "roles",
+        "scsi_target_id", "supported_classes", "fast_io_fail_tmo",
+        "dev_loss_tmo",
+};
+
+#define FC_RPORT_NUM_ATTRS \
+        (int)(sizeof(fc_rport_attrs) / sizeof(fc_rport_attrs[0]))
+
+/* A FC remote port (e.g. "rport-1:0-2"). All LUs behind it share this, so
+ * its attributes are read once. */
+struct fc_rport {
+        char * name;
+        char dir[LMAX_PATH];    /* its fc_remote_ports directory */
+        bool attrs_read;
+        char * attr_val[FC_RPORT_NUM_ATTRS];    /* NULL if not available */
+        struct fc_rport * hnext;
+};
+
+/* A FC target (H:C:T), as found in /sys/class/fc_transport , and the
+ * remote port it is reached through. Shared by all LUs of that target. */
+struct fc_target {
+        int h;
+        int c;
+        int t;
+        int tp_state;           /* 0: not read yet, 1: read, -1: missing */
+        char port_name[LMAX_NAME];
+        char port_id[LMAX_NAME];
+        int rport_state;        /* 0: not looked up yet, 1: found, -1: not */
+        struct fc_rport * rport;
+        struct fc_target * hnext;
+};
+
+#define FC_HASH_SZ 256          /* power of 2 */
+
+static struct fc_target * fc_target_hash[FC_HASH_SZ];
+static struct fc_rport * fc_rport_hash[FC_HASH_SZ];
+
+/* Returns the FC target record for 'hctl' (LUN ignored), adding it if
+ * needed. Returns NULL if out of memory. */
+static struct fc_target *
+fc_target_get(const struct addr_hctl * hctl)
+{
+        unsigned int k;
+        struct fc_target * ftp;
+        struct fc_target ** fpp;
+
+        k = hct_hash(hctl->h, hctl->c, hctl->t);
+        fpp = &fc_target_hash[k & (FC_HASH_SZ - 1)];
+        for ( ; *fpp; fpp = &(*fpp)->hnext) {
+                ftp = *fpp;
+                if ((ftp->h == hctl->h) && (ftp->c == hctl->c) &&
+                    (ftp->t == hctl->t))
+                        return ftp;
+        }
+        ftp = (struct fc_target *)calloc(1, sizeof(*ftp));
+        if (NULL == ftp)
+                return NULL;
+        ftp->h = hctl->h;
+        ftp->c = hctl->c;
+        ftp->t = hctl->t;
+        *fpp = ftp;
+        return ftp;
+}
+
+/* Returns the FC remote port record named 'name' with its directory found
+ * from 'parent' (the rport's device directory), adding it if needed.
+ * Returns NULL if out of memory. */
+static struct fc_rport *
+fc_rport_get(const char * name, const char * parent)
+{
+        struct fc_rport * frp;
+        struct fc_rport ** fpp;
+        char buff[LMAX_DEVPATH];
+
+        fpp = &fc_rport_hash[str_hash(name) & (FC_HASH_SZ - 1)];
+        for ( ; *fpp; fpp = &(*fpp)->hnext) {
+                if (0 == strcmp((*fpp)->name, name))
+                        return *fpp;
+        }
+        frp = (struct fc_rport *)calloc(1, sizeof(*frp));
+        if (NULL == frp)
+                return NULL;
+        if (NULL == (frp->name = strdup(name))) {
+                free(frp);
+                return NULL;
+        }
+        snprintf(buff, sizeof(buff), "%s%s", "fc_remote_ports/", name);
+        if (! if_directory_resolve(parent, buff, frp->dir, sizeof(frp->dir)))
+                /* newer transport */
+                /* /sys  /class/fc_remote_ports/  rport-x:y-z  / */
+                snprintf(frp->dir, sizeof(frp->dir), "%s%s%s/", sysfsroot,
+                         fc_remote_ports, name);
+        *fpp = frp;
+        return frp;
+}
+
+/* Returns the remote port of FC target 'ftp', found from the device
+ * directory of 'devname' (one of its LUs) on first use. Returns NULL if
+ * there is none. */
+static struct fc_rport *
+fc_target_rport(struct fc_target * ftp, const char * devname)
+{
+        char * cp;
+        char buff[LMAX_DEVPATH];
+        char wd[LMAX_PATH];
+
+        if (0 == ftp->rport_state) {
+                ftp->rport_state = -1;
+                snprintf(buff, sizeof(buff), "%s%s%s", sysfsroot,
+                         class_scsi_dev, devname);
+                if (! if_directory_resolve(buff, "device", wd, sizeof(wd)))
+                        return NULL;
+                cp = strrchr(wd, '/');
+                if (NULL == cp)
+                        return NULL;
+                *cp = '\0';
+                cp = strrchr(wd, '/');
+                if (NULL == cp)
+                        return NULL;
+                *cp = '\0';
+                ftp->rport = fc_rport_get(basename(wd), wd);
+                if (ftp->rport)
+                        ftp->rport_state = 1;
+        }
+        return ftp->rport;
+}
+
+static void
+free_fc_targets(void)
+{
+        int k, j;
+        struct fc_target * ftp;
+        struct fc_target * next_ftp;
+        struct fc_rport * frp;
+        struct fc_rport * next_frp;
+
+        for (k = 0; k < FC_HASH_SZ; ++k) {
+                for (ftp = fc_target_hash[k]; ftp; ftp = next_ftp) {
+                        next_ftp = ftp->hnext;
+                        free(ftp);
+                }
+                fc_target_hash[k] = NULL;
+                for (frp = fc_rport_hash[k]; frp; frp = next_frp) {
+                        next_frp = frp->hnext;
+                        for (j = 0; j < FC_RPORT_NUM_ATTRS; ++j)
+                                free(frp->attr_val[j]);
+                        free(frp->name);
+                        free(frp);
+                }
+                fc_rport_hash[k] = NULL;
+        }
+}
+
+/* iSCSI session attributes output by transport_tport_longer(), in order.
+ * transport_tport() uses the first two. */
+static const char * iscsi_sess_attrs[] = {
+        "targetname", "tpgt", "data_pdu_in_order", "data_seq_in_order",
+        "erl", "first_burst_len", "initial_r2t", "max_burst_len",
+        "max_outstanding_r2t", "recovery_tmo",
+};
+
+#define ISCSI_SESS_NUM_ATTRS \
+        (int)(sizeof(iscsi_sess_attrs) / sizeof(iscsi_sess_attrs[0]))
+
+/* An iSCSI session (e.g. "session3") and the target (H:C:T) found in its
+ * directory. All LUs of that target share it, so its attributes are read
+ * once. */
+struct iscsi_sess {
+        int num;
+        struct addr_hctl target;        /* 'l' not used */
+        bool attrs_read;
+        char * attr_val[ISCSI_SESS_NUM_ATTRS];  /* NULL if not available */
+        struct iscsi_sess * hnext;
+};
+
+/* Marks an iSCSI host whose sessions have been put in iscsi_sess_hash */
+struct iscsi_host_done {
+        int h;
+        struct iscsi_host_done * next;
+};
+
+#define ISCSI_HASH_SZ 256       /* power of 2 */
+
+static struct iscsi_sess * iscsi_sess_hash[ISCSI_HASH_SZ];     /* on H:C:T */
+static struct iscsi_host_done * iscsi_hosts_done = NULL;
+
+static int
+iscsi_sess_dir_scan_select(const struct dirent * s)
+{
+        return dir_or_link(s, "session") ? 1 : 0;
+}
+
+static int
+iscsi_tgt_dir_scan_select(const struct dirent * s)
+{
+        return dir_or_link(s, "target") ? 1 : 0;
+}
+
+/* Adds each session below iSCSI host 'h' to iscsi_sess_hash, keyed on the
+ * target in the session's directory. Each host is only scanned once. */
+static void
+iscsi_host_sessions(int h)
+{
+        int num, num2, k, j;
+        unsigned int hv;
+        struct iscsi_host_done * ihp;
+        struct iscsi_sess * isp;
+        struct addr_hctl hctl;
+        struct dirent ** namelist;
+        struct dirent ** namelist2;
+        char buff[LMAX_DEVPATH];
+        char buff2[LMAX_DEVPATH];
+
+        for (ihp = iscsi_hosts_done; ihp; ihp = ihp->next) {
+                if (ihp->h == h)
+                        return;
+        }
+        if ((ihp = (struct iscsi_host_done *)malloc(sizeof(*ihp)))) {
+                ihp->h = h;
+                ihp->next = iscsi_hosts_done;
+                iscsi_hosts_done = ihp;
+        }
+        snprintf(buff, sizeof(buff), "%s%shost%d/device", sysfsroot,
+                 iscsi_host, h);
+        num = sysfs_scandir(buff, &namelist, iscsi_sess_dir_scan_select,
+                            NULL);
+        for (k = 0; k < num; ++k) {
+                snprintf(buff2, sizeof(buff2), "%s/%s", buff,
+                         namelist[k]->d_name);
+                num2 = sysfs_scandir(buff2, &namelist2,
+                                     iscsi_tgt_dir_scan_select, NULL);
+                for (j = 0; j < num2; ++j) {
+                        if ((3 == sscanf(namelist2[j]->d_name,
+                                         "target%d:%d:%d", &hctl.h, &hctl.c,
+                                         &hctl.t)) &&
+                            (isp = (struct iscsi_sess *)
+                                        calloc(1, sizeof(*isp)))) {
+                                isp->num = atoi(namelist[k]->d_name + 7);
+                                isp->target = hctl;
+                                hv = hct_hash(hctl.h, hctl.c, hctl.t);
+                                hv &= (ISCSI_HASH_SZ - 1);
+                                isp->hnext = iscsi_sess_hash[hv];
+                                iscsi_sess_hash[hv] = isp;
+                        }
+                        free(namelist2[j]);
+                }
+                if (num2 >= 0)
+                        free(namelist2);
+                free(namelist[k]);
+        }
+        if (num >= 0)
+                free(namelist);
+}
+
+/* Returns the iSCSI session of the target (H:C:T) of 'hctl', with its
+ * attributes read, or NULL if none is found. */
+static struct iscsi_sess *
+iscsi_sess_get(const struct addr_hctl * hctl)
+{
+        int k;
+        struct iscsi_sess * isp;
+        char buff[LMAX_DEVPATH];
+        char value[LMAX_NAME];
+
+        iscsi_host_sessions(hctl->h);
+        isp = iscsi_sess_hash[hct_hash(hctl->h, hctl->c, hctl->t) &
+                              (ISCSI_HASH_SZ - 1)];
+        for ( ; isp; isp = isp->hnext) {
+                if ((isp->target.h == hctl->h) &&
+                    (isp->target.c == hctl->c) && (isp->target.t == hctl->t))
+                        break;
+        }
+        if (isp && (! isp->attrs_read)) {
+                snprintf(buff, sizeof(buff), "%s%ssession%d", sysfsroot,
+                         iscsi_session, isp->num);
+                for (k = 0; k < ISCSI_SESS_NUM_ATTRS; ++k) {
+                        if (get_value(buff, iscsi_sess_attrs[k], value,
+                                      sizeof(value)))
+                                isp->attr_val[k] = strdup(value);
+                }
+                isp->attrs_read = true;
+        }
+        return isp;
+}
+
+static void
+free_iscsi_sessions(void)
+{
+        int k, j;
+        struct iscsi_sess * isp;
+        struct iscsi_sess * next_isp;
+        struct iscsi_host_done * ihp;
+
+        for (k = 0; k < ISCSI_HASH_SZ; ++k) {
+                for (isp = iscsi_sess_hash[k]; isp; isp = next_isp) {
+                        next_isp = isp->hnext;
+                        for (j = 0; j < ISCSI_SESS_NUM_ATTRS; ++j)
+                                free(isp->attr_val[j]);
+                        free(isp);
+                }
+                iscsi_sess_hash[k] = NULL;
+        }
+        while ((ihp = iscsi_hosts_done)) {
+                iscsi_hosts_done = ihp->next;
+                free(ihp);
+        }
+}
+
 /* Check host associated with 'devname' for known transport types. If so set
  * transport_id, place a string in 'b' and return true. Otherwise return
  * false. */
 static bool
-transport_init(const char * devname, /* const struct lsscsi_opts * op, */
-               int b_len, char * b)
+transport_init(const char * devname, struct scan_ctx * sc,
+               /* const struct lsscsi_opts * op, */ int b_len, char * b)
 {
-        int off;
-        char * cp;
+        int off, h;
         char buff[LMAX_DEVPATH];
-        char wd[LMAX_PATH];
         struct stat a_stat;
+        struct host_tport tmp;
+        const struct host_tport * htp;
+
+        if (1 != sscanf(devname, "host%d", &h))
+                return false;
+        htp = host_tport_get(h, &tmp);
 
         /* SPI host */
-        snprintf(buff, sizeof(buff), "%s%s%s", sysfsroot, spi_host, devname);
-        if ((stat(buff, &a_stat) >= 0) && S_ISDIR(a_stat.st_mode)) {
-                transport_id = TRANSPORT_SPI;
+        if (HOST_TP_SPI & htp->flags) {
+                sc->transport_id = TRANSPORT_SPI;
                 snprintf(b, b_len, "spi:");
                 return true;
         }
 
         /* FC host */
-        snprintf(buff, sizeof(buff), "%s%s%s", sysfsroot, fc_host, devname);
-        if ((stat(buff, &a_stat) >= 0) && S_ISDIR(a_stat.st_mode)) {
-                if (get_value(buff, "symbolic_name", wd, sizeof(wd))) {
-                        if (strstr(wd, " over ")) {
-                                transport_id = TRANSPORT_FCOE;
-                                snprintf(b, b_len, "fcoe:");
-                        }
-                }
-                if (transport_id != TRANSPORT_FCOE) {
-                        transport_id = TRANSPORT_FC;
+        if (HOST_TP_FC & htp->flags) {
+                snprintf(buff, sizeof(buff), "%s%s%s", sysfsroot, fc_host,
+                         devname);
+                if (HOST_TP_FCOE & htp->flags) {
+                        sc->transport_id = TRANSPORT_FCOE;
+                        snprintf(b, b_len, "fcoe:");
+                } else {
+                        sc->transport_id = TRANSPORT_FC;
                         snprintf(b, b_len, "fc:");
                 }
                 off = strlen(b);
@@ -2044,28 +4469,24 @@ transport_init(const char * devname, /* const struct lsscsi_opts * op, */
         }
 
         /* SRP host */
-        snprintf(buff, sizeof(buff), "%s%s%s", sysfsroot, srp_host, devname);
-        if (stat(buff, &a_stat) >= 0 && S_ISDIR(a_stat.st_mode)) {
-                int h;
-
-                transport_id = TRANSPORT_SRP;
-                snprintf(b, b_len, "srp:");
-                if (sscanf(devname, "host%d", &h) == 1)
-                        get_local_srp_gid(h, b + strlen(b), b_len - strlen(b));
+        if (HOST_TP_SRP & htp->flags) {
+                sc->transport_id = TRANSPORT_SRP;
+                snprintf(b, b_len, "srp:%s", htp->srp_gid);
                 return true;
         }
 
         /* SAS host */
         /* SAS transport layer representation */
-        snprintf(buff, sizeof(buff), "%s%s%s", sysfsroot, sas_host, devname);
-        if ((stat(buff, &a_stat) >= 0) && S_ISDIR(a_stat.st_mode)) {
-                transport_id = TRANSPORT_SAS;
+        if (HOST_TP_SAS & htp->flags) {
+                sc->transport_id = TRANSPORT_SAS;
+                snprintf(buff, sizeof(buff), "%s%s%s", sysfsroot, sas_host,
+                         devname);
                 off = strlen(buff);
                 snprintf(buff + off, sizeof(buff) - off, "/device");
-                if (sas_low_phy_scan(buff, NULL) < 1)
+                if (sas_low_phy_scan(buff, sc, NULL) < 1)
                         return false;
                 snprintf(buff, sizeof(buff), "%s%s%s", sysfsroot, sas_phy,
-                         sas_low_phy);
+                         sc->sas_low_phy);
                 snprintf(b, b_len, "sas:");
                 off = strlen(b);
                 if (get_value(buff, "sas_address", b + off, b_len - off))
@@ -2077,8 +4498,8 @@ transport_init(const char * devname, /* const struct lsscsi_opts * op, */
         /* SAS class representation */
         snprintf(buff, sizeof(buff), "%s%s%s%s", sysfsroot, scsi_host,
                  devname, "/device/sas/ha");
-        if ((stat(buff, &a_stat) >= 0) && S_ISDIR(a_stat.st_mode)) {
-                transport_id = TRANSPORT_SAS_CLASS;
+        if ((sysfs_stat(buff, &a_stat) >= 0) && S_ISDIR(a_stat.st_mode)) {
+                sc->transport_id = TRANSPORT_SAS_CLASS;
                 snprintf(b, b_len, "sas:");
                 off = strlen(b);
                 if (get_value(buff, "device_name", b + off, b_len - off))
@@ -2094,13 +4515,13 @@ transport_init(const char * devname, /* const struct lsscsi_opts * op, */
                 /* resolve SCSI host device */
                 snprintf(buff, sizeof(buff), "%s%s%s%s", sysfsroot, scsi_host,
                          devname, "/device");
-                if (readlink(buff, buff2, sizeof(buff2)) <= 0)
+                if (sysfs_readlink(buff, buff2, sizeof(buff2)) <= 0)
                         break;
 
                 /* check if the SCSI host has a FireWire host as ancestor */
                 if (!(t = strstr(buff2, "/fw-host")))
                         break;
-                transport_id = TRANSPORT_SBP;
+                sc->transport_id = TRANSPORT_SBP;
 
                 /* terminate buff2 after FireWire host */
                 if (!(t = strchr(t+1, '/')))
@@ -2123,9 +4544,8 @@ transport_init(const char * devname, /* const struct lsscsi_opts * op, */
         } while (0);
 
         /* iSCSI host */
-        snprintf(buff, sizeof(buff), "%s%s%s", sysfsroot, iscsi_host, devname);
-        if ((stat(buff, &a_stat) >= 0) && S_ISDIR(a_stat.st_mode)) {
-                transport_id = TRANSPORT_ISCSI;
+        if (HOST_TP_ISCSI & htp->flags) {
+                sc->transport_id = TRANSPORT_ISCSI;
                 snprintf(b, b_len, "iscsi:");
 // >>>       Can anything useful be placed after "iscsi:" in single line
 //           host output?
@@ -2134,30 +4554,18 @@ transport_init(const char * devname, /* const struct lsscsi_opts * op, */
         }
 
         /* USB host? */
-        cp = get_usb_devname(devname, NULL, wd, sizeof(wd) - 1);
-        if (cp) {
-                transport_id = TRANSPORT_USB;
-                snprintf(b, b_len, "usb:%s", cp);
+        if (HOST_TP_USB & htp->flags) {
+                sc->transport_id = TRANSPORT_USB;
+                snprintf(b, b_len, "usb:%s", htp->usb_name);
                 return true;
         }
 
         /* ATA or SATA host, crude check: driver name */
-        snprintf(buff, sizeof(buff), "%s%s%s", sysfsroot, scsi_host, devname);
-        if (get_value(buff, "proc_name", wd, sizeof(wd))) {
-                if (0 == strcmp("ahci", wd)) {
-                        transport_id = TRANSPORT_SATA;
-                        snprintf(b, b_len, "sata:");
-                        return true;
-                } else if (strstr(wd, "ata")) {
-                        if (0 == memcmp("sata", wd, 4)) {
-                                transport_id = TRANSPORT_SATA;
-                                snprintf(b, b_len, "sata:");
-                                return true;
-                        }
-                        transport_id = TRANSPORT_ATA;
-                        snprintf(b, b_len, "ata:");
-                        return true;
-                }
+        if (TRANSPORT_UNKNOWN != htp->ata_id) {
+                sc->transport_id = htp->ata_id;
+                snprintf(b, b_len, (TRANSPORT_SATA == htp->ata_id) ?
+                         "sata:" : "ata:");
+                return true;
         }
         return false;
 }
@@ -2166,7 +4574,8 @@ transport_init(const char * devname, /* const struct lsscsi_opts * op, */
  * 'path_name' output additional information.
  */
 static void
-transport_init_longer(const char * path_name, const struct lsscsi_opts * op)
+transport_init_longer(const char * path_name, struct scan_ctx * sc,
+                      const struct lsscsi_opts * op)
 {
         int k, j, len;
         int phynum;
@@ -2184,79 +4593,80 @@ transport_init_longer(const char * path_name, const struct lsscsi_opts * op)
         my_strcopy(bname, cp, sizeof(bname));
         bname[sizeof(bname) - 1] = '\0';
         cp = bname;
-        switch (transport_id) {
+        switch (sc->transport_id) {
         case TRANSPORT_SPI:
-                printf("  transport=spi\n");
+                out_printf("  transport=spi\n");
                 snprintf(buff, sizeof(buff), "%s%s%s", sysfsroot, spi_host,
                          cp);
                 if (get_value(buff, "signalling", value, sizeof(value)))
-                        printf("  signalling=%s\n", value);
+                        out_printf("  signalling=%s\n", value);
                 break;
         case TRANSPORT_FC:
         case TRANSPORT_FCOE:
-                printf("  transport=%s\n",
-                       transport_id == TRANSPORT_FC ? "fc:" : "fcoe:");
+                out_printf("  transport=%s\n",
+                           sc->transport_id == TRANSPORT_FC ? "fc:" : "fcoe:");
                 snprintf(buff, sizeof(buff), "%s%s%s", path_name,
                          "/device/fc_host/", cp);
-                if (stat(buff, &a_stat) < 0) {
+                if (sysfs_stat(buff, &a_stat) < 0) {
                         if (op->verbose > 2)
-                                printf("no fc_host directory\n");
+                                out_printf("no fc_host directory\n");
                         break;
                 }
                 if (get_value(buff, "active_fc4s", value, sizeof(value)))
-                        printf("  active_fc4s=%s\n", value);
+                        out_printf("  active_fc4s=%s\n", value);
                 if (get_value(buff, "supported_fc4s", value, sizeof(value)))
-                        printf("  supported_fc4s=%s\n", value);
+                        out_printf("  supported_fc4s=%s\n", value);
                 if (get_value(buff, "fabric_name", value, sizeof(value)))
-                        printf("  fabric_name=%s\n", value);
+                        out_printf("  fabric_name=%s\n", value);
                 if (get_value(buff, "maxframe_size", value, sizeof(value)))
-                        printf("  maxframe_size=%s\n", value);
+                        out_printf("  maxframe_size=%s\n", value);
                 if (get_value(buff, "max_npiv_vports", value, sizeof(value)))
-                        printf("  max_npiv_vports=%s\n", value);
+                        out_printf("  max_npiv_vports=%s\n", value);
                 if (get_value(buff, "npiv_vports_inuse", value, sizeof(value)))
-                        printf("  npiv_vports_inuse=%s\n", value);
+                        out_printf("  npiv_vports_inuse=%s\n", value);
                 if (get_value(buff, "node_name", value, sizeof(value)))
-                        printf("  node_name=%s\n", value);
+                        out_printf("  node_name=%s\n", value);
                 if (get_value(buff, "port_name", value, sizeof(value)))
-                        printf("  port_name=%s\n", value);
+                        out_printf("  port_name=%s\n", value);
                 if (get_value(buff, "port_id", value, sizeof(value)))
-                        printf("  port_id=%s\n", value);
+                        out_printf("  port_id=%s\n", value);
                 if (get_value(buff, "port_state", value, sizeof(value)))
-                        printf("  port_state=%s\n", value);
+                        out_printf("  port_state=%s\n", value);
                 if (get_value(buff, "port_type", value, sizeof(value)))
-                        printf("  port_type=%s\n", value);
+                        out_printf("  port_type=%s\n", value);
                 if (get_value(buff, "speed", value, sizeof(value)))
-                        printf("  speed=%s\n", value);
+                        out_printf("  speed=%s\n", value);
                 if (get_value(buff, "supported_speeds", value, sizeof(value)))
-                        printf("  supported_speeds=%s\n", value);
+                        out_printf("  supported_speeds=%s\n", value);
                 if (get_value(buff, "supported_classes", value, sizeof(value)))
-                        printf("  supported_classes=%s\n", value);
+                        out_printf("  supported_classes=%s\n", value);
                 if (get_value(buff, "tgtid_bind_type", value, sizeof(value)))
-                        printf("  tgtid_bind_type=%s\n", value);
+                        out_printf("  tgtid_bind_type=%s\n", value);
                 if (op->verbose > 2)
-                        printf("fetched from directory: %s\n", buff);
+                        out_printf("fetched from directory: %s\n", buff);
                 break;
         case TRANSPORT_SRP:
-                printf("  transport=srp\n");
+                out_printf("  transport=srp\n");
                 {
                         int h;
 
                         if (sscanf(path_name, "host%d", &h) != 1)
                                 break;
                         if (get_srp_orig_dgid(h, value, sizeof(value)))
-                                printf("  orig_dgid=%s\n", value);
+                                out_printf("  orig_dgid=%s\n", value);
                         if (get_srp_dgid(h, value, sizeof(value)))
-                                printf("  dgid=%s\n", value);
+                                out_printf("  dgid=%s\n", value);
                 }
                 break;
         case TRANSPORT_SAS:
-                printf("  transport=sas\n");
+                out_printf("  transport=sas\n");
                 snprintf(buff, sizeof(buff), "%s%s", path_name, "/device");
                 if ((portnum = sas_port_scan(buff, &portlist)) < 1) {
                         /* no configured ports */
-                        printf("  no configured ports\n");
-                        if ((phynum = sas_low_phy_scan(buff, &phylist)) < 1) {
-                                printf("  no configured phys\n");
+                        out_printf("  no configured ports\n");
+                        phynum = sas_low_phy_scan(buff, sc, &phylist);
+                        if (phynum < 1) {
+                                out_printf("  no configured phys\n");
                                 return;
                         }
                         for (k = 0; k < phynum; ++k) {
@@ -2264,43 +4674,45 @@ transport_init_longer(const char * path_name, const struct lsscsi_opts * op)
                                 snprintf(buff, sizeof(buff), "%s%s%s",
                                          sysfsroot, sas_phy,
                                          phylist[k]->d_name);
-                                printf("  %s\n",phylist[k]->d_name);
+                                out_printf("  %s\n",phylist[k]->d_name);
                                 if (get_value(buff, "sas_address", value,
                                               sizeof(value)))
-                                        printf("    sas_address=%s\n", value);
+                                        out_printf("    sas_address=%s\n",
+                                                   value);
                                 if (get_value(buff, "phy_identifier", value,
                                               sizeof(value)))
-                                        printf("    phy_identifier=%s\n",
-                                               value);
+                                        out_printf("    phy_identifier=%s\n",
+                                                   value);
                                 if (get_value(buff, "minimum_linkrate", value,
                                               sizeof(value)))
-                                        printf("    minimum_linkrate=%s\n",
-                                               value);
+                                        out_printf("    minimum_linkrate=%s\n",
+                                                   value);
                                 if (get_value(buff, "minimum_linkrate_hw",
                                               value, sizeof(value)))
-                                        printf("    minimum_linkrate_hw=%s\n",
-                                               value);
+                                        out_printf("    minimum_linkrate_hw="
+                                                   "%s\n", value);
                                 if (get_value(buff, "maximum_linkrate", value,
                                               sizeof(value)))
-                                        printf("    maximum_linkrate=%s\n",
-                                               value);
+                                        out_printf("    maximum_linkrate=%s\n",
+                                                   value);
                                 if (get_value(buff, "maximum_linkrate_hw",
                                               value, sizeof(value)))
-                                        printf("    maximum_linkrate_hw=%s\n",
-                                               value);
+                                        out_printf("    maximum_linkrate_hw="
+                                                   "%s\n", value);
                                 if (get_value(buff, "negotiated_linkrate",
                                               value, sizeof(value)))
-                                        printf("    negotiated_linkrate=%s\n",
-                                               value);
+                                        out_printf("    negotiated_linkrate="
+                                                   "%s\n", value);
                         }
                         return;
                 }
                 for (k = 0; k < portnum; ++k) {     /* for each host port */
                         snprintf(buff, sizeof(buff), "%s%s%s", path_name,
                                  "/device/", portlist[k]->d_name);
-                        if ((phynum = sas_low_phy_scan(buff, &phylist)) < 1) {
-                                printf("  %s: phy list not available\n",
-                                       portlist[k]->d_name);
+                        phynum = sas_low_phy_scan(buff, sc, &phylist);
+                        if (phynum < 1) {
+                                out_printf("  %s: phy list not available\n",
+                                           portlist[k]->d_name);
                                 free(portlist[k]);
                                 continue;
                         }
@@ -2309,69 +4721,74 @@ transport_init_longer(const char * path_name, const struct lsscsi_opts * op)
                                  sas_port, portlist[k]->d_name);
                         if (get_value(buff, "num_phys", value,
                                       sizeof(value))) {
-                                printf("  %s: num_phys=%s,",
-                                       portlist[k]->d_name, value);
+                                out_printf("  %s: num_phys=%s,",
+                                           portlist[k]->d_name, value);
                                 for (j = 0; j < phynum; ++j) {
-                                        printf(" %s", phylist[j]->d_name);
+                                        out_printf(" %s", phylist[j]->d_name);
                                         free(phylist[j]);
                                 }
-                                printf("\n");
+                                out_printf("\n");
                                 if (op->verbose > 2)
-                                        printf("  fetched from directory: "
-                                               "%s\n", buff);
+                                        out_printf("  fetched from directory: "
+                                                   "%s\n", buff);
                                 free(phylist);
                         }
                         snprintf(buff, sizeof(buff), "%s%s%s", sysfsroot,
-                                 sas_phy, sas_low_phy);
+                                 sas_phy, sc->sas_low_phy);
                         if (get_value(buff, "device_type", value,
                                       sizeof(value)))
-                                printf("    device_type=%s\n", value);
+                                out_printf("    device_type=%s\n", value);
                         if (get_value(buff, "initiator_port_protocols", value,
                                       sizeof(value)))
-                                printf("    initiator_port_protocols=%s\n",
-                                       value);
+                                out_printf("    initiator_port_protocols=%s\n",
+                                           value);
                         if (get_value(buff, "invalid_dword_count", value,
                                       sizeof(value)))
-                                printf("    invalid_dword_count=%s\n", value);
+                                out_printf("    invalid_dword_count=%s\n",
+                                           value);
                         if (get_value(buff, "loss_of_dword_sync_count", value,
                                       sizeof(value)))
-                                printf("    loss_of_dword_sync_count=%s\n",
-                                       value);
+                                out_printf("    loss_of_dword_sync_count=%s\n",
+                                           value);
                         if (get_value(buff, "minimum_linkrate", value,
                                       sizeof(value)))
-                                printf("    minimum_linkrate=%s\n", value);
+                                out_printf("    minimum_linkrate=%s\n", value);
                         if (get_value(buff, "minimum_linkrate_hw", value,
                                       sizeof(value)))
-                                printf("    minimum_linkrate_hw=%s\n", value);
+                                out_printf("    minimum_linkrate_hw=%s\n",
+                                           value);
                         if (get_value(buff, "maximum_linkrate", value,
                                       sizeof(value)))
-                                printf("    maximum_linkrate=%s\n", value);
+                                out_printf("    maximum_linkrate=%s\n", value);
                         if (get_value(buff, "maximum_linkrate_hw", value,
                                       sizeof(value)))
-                                printf("    maximum_linkrate_hw=%s\n", value);
+                                out_printf("    maximum_linkrate_hw=%s\n",
+                                           value);
                         if (get_value(buff, "negotiated_linkrate", value,
                                       sizeof(value)))
-                                printf("    negotiated_linkrate=%s\n", value);
+                                out_printf("    negotiated_linkrate=%s\n",
+                                           value);
                         if (get_value(buff, "phy_identifier", value,
                                       sizeof(value)))
-                                printf("    phy_identifier=%s\n", value);
+                                out_printf("    phy_identifier=%s\n", value);
                         if (get_value(buff, "phy_reset_problem_count", value,
                                       sizeof(value)))
-                                printf("    phy_reset_problem_count=%s\n",
-                                       value);
+                                out_printf("    phy_reset_problem_count=%s\n",
+                                           value);
                         if (get_value(buff, "running_disparity_error_count",
                                       value, sizeof(value)))
-                                printf("    running_disparity_error_count="
-                                       "%s\n", value);
+                                out_printf("    running_disparity_error_count="
+                                           "%s\n", value);
                         if (get_value(buff, "sas_address", value,
                                       sizeof(value)))
-                                printf("    sas_address=%s\n", value);
+                                out_printf("    sas_address=%s\n", value);
                         if (get_value(buff, "target_port_protocols", value,
                                       sizeof(value)))
-                                printf("    target_port_protocols=%s\n",
-                                       value);
+                                out_printf("    target_port_protocols=%s\n",
+                                           value);
                         if (op->verbose > 2)
-                                printf("  fetched from directory: %s\n", buff);
+                                out_printf("  fetched from directory: %s\n",
+                                           buff);
 
                         free(portlist[k]);
 
@@ -2380,65 +4797,65 @@ transport_init_longer(const char * path_name, const struct lsscsi_opts * op)
 
                 break;
         case TRANSPORT_SAS_CLASS:
-                printf("  transport=sas\n");
-                printf("  sub_transport=sas_class\n");
+                out_printf("  transport=sas\n");
+                out_printf("  sub_transport=sas_class\n");
                 snprintf(buff, sizeof(buff), "%s%s", path_name,
                          "/device/sas/ha");
                 if (get_value(buff, "device_name", value, sizeof(value)))
-                        printf("  device_name=%s\n", value);
+                        out_printf("  device_name=%s\n", value);
                 if (get_value(buff, "ha_name", value, sizeof(value)))
-                        printf("  ha_name=%s\n", value);
+                        out_printf("  ha_name=%s\n", value);
                 if (get_value(buff, "version_descriptor", value,
                               sizeof(value)))
-                        printf("  version_descriptor=%s\n", value);
-                printf("  phy0:\n");
+                        out_printf("  version_descriptor=%s\n", value);
+                out_printf("  phy0:\n");
                 len = strlen(buff);
                 snprintf(buff + len, sizeof(buff) - len, "%s", "/phys/0");
                 if (get_value(buff, "class", value, sizeof(value)))
-                        printf("    class=%s\n", value);
+                        out_printf("    class=%s\n", value);
                 if (get_value(buff, "enabled", value, sizeof(value)))
-                        printf("    enabled=%s\n", value);
+                        out_printf("    enabled=%s\n", value);
                 if (get_value(buff, "id", value, sizeof(value)))
-                        printf("    id=%s\n", value);
+                        out_printf("    id=%s\n", value);
                 if (get_value(buff, "iproto", value, sizeof(value)))
-                        printf("    iproto=%s\n", value);
+                        out_printf("    iproto=%s\n", value);
                 if (get_value(buff, "linkrate", value, sizeof(value)))
-                        printf("    linkrate=%s\n", value);
+                        out_printf("    linkrate=%s\n", value);
                 if (get_value(buff, "oob_mode", value, sizeof(value)))
-                        printf("    oob_mode=%s\n", value);
+                        out_printf("    oob_mode=%s\n", value);
                 if (get_value(buff, "role", value, sizeof(value)))
-                        printf("    role=%s\n", value);
+                        out_printf("    role=%s\n", value);
                 if (get_value(buff, "sas_addr", value, sizeof(value)))
-                        printf("    sas_addr=%s\n", value);
+                        out_printf("    sas_addr=%s\n", value);
                 if (get_value(buff, "tproto", value, sizeof(value)))
-                        printf("    tproto=%s\n", value);
+                        out_printf("    tproto=%s\n", value);
                 if (get_value(buff, "type", value, sizeof(value)))
-                        printf("    type=%s\n", value);
+                        out_printf("    type=%s\n", value);
                 if (op->verbose > 2)
-                        printf("fetched from directory: %s\n", buff);
+                        out_printf("fetched from directory: %s\n", buff);
                 break;
         case TRANSPORT_ISCSI:
-                printf("  transport=iSCSI\n");
+                out_printf("  transport=iSCSI\n");
 // >>>       This is the multi-line host output for iSCSI. Anymore to
 //           add here? [From
 //           /sys/class/scsi_host/hostN/device/iscsi_host:hostN directory]
                 break;
         case TRANSPORT_SBP:
-                printf("  transport=sbp\n");
+                out_printf("  transport=sbp\n");
                 break;
         case TRANSPORT_USB:
-                printf("  transport=usb\n");
-                printf("  device_name=%s\n", get_usb_devname(cp, NULL,
-                       value, sizeof(value)));
+                out_printf("  transport=usb\n");
+                out_printf("  device_name=%s\n", get_usb_devname(cp, NULL,
+                           value, sizeof(value)));
                 break;
         case TRANSPORT_ATA:
-                printf("  transport=ata\n");
+                out_printf("  transport=ata\n");
                 break;
         case TRANSPORT_SATA:
-                printf("  transport=sata\n");
+                out_printf("  transport=sata\n");
                 break;
         case TRANSPORT_PCIE:
-                printf("  transport=pcie\n");
+                out_printf("  transport=pcie\n");
                 break;
         default:
                 if (op->verbose > 1)
@@ -2447,37 +4864,67 @@ transport_init_longer(const char * path_name, const struct lsscsi_opts * op)
         }
 }
 
+/* Places "sas:" and the SAS address of end device 'sep' in 'b', reading
+ * the address on first use, and keeps its name for
+ * transport_tport_longer(). Returns true. */
+static bool
+transport_sas_end_dev(struct sas_end_dev * sep, struct scan_ctx * sc,
+                      const struct lsscsi_opts * op, int b_len, char * b)
+{
+        char buff[LMAX_DEVPATH];
+
+        my_strcopy(sc->sas_hold_end_device, sep->name,
+                   sizeof(sc->sas_hold_end_device));
+        snprintf(buff, sizeof(buff), "%s%s%s", sysfsroot, sas_device,
+                 sep->name);
+        if (0 == sep->addr_state)
+                sep->addr_state = get_value(buff, "sas_address",
+                                            sep->sas_address,
+                                            sizeof(sep->sas_address)) ?
+                                  1 : -1;
+        if (sep->addr_state > 0)
+                snprintf(b, b_len, "sas:%s", sep->sas_address);
+        else {  /* non-SAS device in SAS domain */
+                snprintf(b, b_len, "sas:0x0000000000000000");
+                if (op->verbose > 1)
+                        pr2serr("%s: no sas_address, wd=%s\n", __func__,
+                                buff);
+        }
+        return true;
+}
+
 /* Attempt to determine the transport type of the SCSI device (LU) associated
  * with 'devname'. If found set transport_id, place string in 'b' and return
  * true. Otherwise return false. */
 static bool
-transport_tport(const char * devname, const struct lsscsi_opts * op,
-                int b_len, char * b)
+transport_tport(const char * devname, struct scan_ctx * sc,
+                const struct lsscsi_opts * op, int b_len, char * b)
 {
-        bool ata_dev;
         int off, n;
         char * cp;
         char buff[LMAX_DEVPATH];
         char wd[LMAX_PATH];
-        char nm[LMAX_NAME];
-        char tpgt[LMAX_NAME];
         struct addr_hctl hctl;
-        struct stat a_stat;
+        struct host_tport tmp;
+        const struct host_tport * htp;
+        const struct lu_map_entry * ep;
+        struct fc_target * ftp;
 
         if (! parse_colon_list(devname, &hctl))
                 return false;
+        htp = host_tport_get(hctl.h, &tmp);
 
         /* check for SAS host */
-        snprintf(buff, sizeof(buff), "%s%shost%d", sysfsroot, sas_host,
-                 hctl.h);
-        if ((stat(buff, &a_stat) >= 0) && S_ISDIR(a_stat.st_mode)) {
+        if (HOST_TP_SAS & htp->flags) {
                 /* SAS transport layer representation */
-                transport_id = TRANSPORT_SAS;
+                sc->transport_id = TRANSPORT_SAS;
+                if ((ep = lu_map_lookup(devname, LU_MAP_SAS)) &&
+                    ep->end_dev)
+                        return transport_sas_end_dev(ep->end_dev, sc, op,
+                                                     b_len, b);
                 snprintf(buff, sizeof(buff), "%s%s%s", sysfsroot,
                          class_scsi_dev, devname);
-                if (if_directory_chdir(buff, "device")) {
-                        if (NULL == getcwd(wd, sizeof(wd)))
-                                return false;
+                if (if_directory_resolve(buff, "device", wd, sizeof(wd))) {
                         cp = strrchr(wd, '/');
                         if (NULL == cp)
                                 return false;
@@ -2487,8 +4934,8 @@ transport_tport(const char * devname, const struct lsscsi_opts * op,
                                 return false;
                         *cp = '\0';
                         cp = basename(wd);
-                        my_strcopy(sas_hold_end_device, cp,
-                                   sizeof(sas_hold_end_device));
+                        my_strcopy(sc->sas_hold_end_device, cp,
+                                   sizeof(sc->sas_hold_end_device));
                         snprintf(buff, sizeof(buff), "%s%s%s", sysfsroot,
                                  sas_device, cp);
 
@@ -2511,125 +4958,98 @@ transport_tport(const char * devname, const struct lsscsi_opts * op,
         }
 
         /* not SAS, so check for SPI host */
-        snprintf(buff, sizeof(buff), "%s%shost%d", sysfsroot, spi_host,
-                 hctl.h);
-        if ((stat(buff, &a_stat) >= 0) && S_ISDIR(a_stat.st_mode)) {
-                transport_id = TRANSPORT_SPI;
+        if (HOST_TP_SPI & htp->flags) {
+                sc->transport_id = TRANSPORT_SPI;
                 snprintf(b, b_len, "spi:%d", hctl.t);
                 return true;
         }
 
         /* no, so check for FC host */
-        snprintf(buff, sizeof(buff), "%s%shost%d", sysfsroot, fc_host,
-                 hctl.h);
-        if ((stat(buff, &a_stat) >= 0) && S_ISDIR(a_stat.st_mode)) {
-                if (get_value(buff, "symbolic_name", wd, sizeof(wd))) {
-                        if (strstr(wd, " over ")) {
-                                transport_id = TRANSPORT_FCOE;
-                                snprintf(b, b_len, "fcoe:");
-                        }
-                }
-                if (transport_id != TRANSPORT_FCOE) {
-                        transport_id = TRANSPORT_FC;
+        if (HOST_TP_FC & htp->flags) {
+                if (HOST_TP_FCOE & htp->flags) {
+                        sc->transport_id = TRANSPORT_FCOE;
+                        snprintf(b, b_len, "fcoe:");
+                } else {
+                        sc->transport_id = TRANSPORT_FC;
                         snprintf(b, b_len, "fc:");
                 }
-                snprintf(buff, sizeof(buff), "%s%starget%d:%d:%d", sysfsroot,
-                         fc_transport, hctl.h, hctl.c, hctl.t);
-                off = strlen(b);
-                if (get_value(buff, "port_name", b + off, b_len - off)) {
-                        off = strlen(b);
-                        my_strcopy(b + off, ",", b_len - off);
-                        off = strlen(b);
-                } else
+                if (NULL == (ftp = fc_target_get(&hctl)))
                         return false;
-                if (get_value(buff, "port_id", b + off, b_len - off))
-                        return true;
-                else
+                if (0 == ftp->tp_state) {
+                        snprintf(buff, sizeof(buff), "%s%starget%d:%d:%d",
+                                 sysfsroot, fc_transport, hctl.h, hctl.c,
+                                 hctl.t);
+                        ftp->tp_state =
+                                (get_value(buff, "port_name", ftp->port_name,
+                                           sizeof(ftp->port_name)) &&
+                                 get_value(buff, "port_id", ftp->port_id,
+                                           sizeof(ftp->port_id))) ? 1 : -1;
+                }
+                if (ftp->tp_state < 0)
                         return false;
+                off = strlen(b);
+                snprintf(b + off, b_len - off, "%s,%s", ftp->port_name,
+                         ftp->port_id);
+                return true;
         }
 
         /* no, so check for SRP host */
-        snprintf(buff, sizeof(buff), "%s%shost%d", sysfsroot, srp_host,
-                 hctl.h);
-        if (stat(buff, &a_stat) >= 0 && S_ISDIR(a_stat.st_mode)) {
-                transport_id = TRANSPORT_SRP;
-                snprintf(b, b_len, "srp:");
-                get_local_srp_gid(hctl.h, b + strlen(b), b_len - strlen(b));
+        if (HOST_TP_SRP & htp->flags) {
+                sc->transport_id = TRANSPORT_SRP;
+                snprintf(b, b_len, "srp:%s", htp->srp_gid);
                 return true;
         }
 
         /* SAS class representation or SBP? */
         snprintf(buff, sizeof(buff), "%s%s/%s", sysfsroot, bus_scsi_devs,
                  devname);
-        if (if_directory_chdir(buff, "sas_device")) {
-                transport_id = TRANSPORT_SAS_CLASS;
+        if (if_directory_resolve(buff, "sas_device", wd, sizeof(wd))) {
+                sc->transport_id = TRANSPORT_SAS_CLASS;
                 snprintf(b, b_len, "sas:");
                 off = strlen(b);
-                if (get_value(".", "sas_addr", b + off, b_len - off))
+                if (get_value(wd, "sas_addr", b + off, b_len - off))
                         return true;
                 else
                         pr2serr("%s: no sas_addr, wd=%s\n", __func__, buff);
         } else if (get_value(buff, "ieee1394_id", wd, sizeof(wd))) {
                 /* IEEE1394 SBP device */
-                transport_id = TRANSPORT_SBP;
+                sc->transport_id = TRANSPORT_SBP;
                 snprintf(b, b_len, "sbp:%s", wd);
                 return true;
         }
 
         /* iSCSI device? */
-        snprintf(buff, sizeof(buff), "%s%shost%d/device", sysfsroot,
-                 iscsi_host, hctl.h);
-        if ((stat(buff, &a_stat) >= 0) && S_ISDIR(a_stat.st_mode)) {
-                if (1 != iscsi_target_scan(buff, &hctl))
-                        return false;
-                transport_id = TRANSPORT_ISCSI;
-                snprintf(buff, sizeof(buff), "%s%ssession%d", sysfsroot,
-                         iscsi_session, iscsi_tsession_num);
-                if (! get_value(buff, "targetname", nm, sizeof(nm)))
+        if (HOST_TP_ISCSI & htp->flags) {
+                if (NULL == (sc->iscsi_sess = iscsi_sess_get(&hctl)))
                         return false;
-                if (! get_value(buff, "tpgt", tpgt, sizeof(tpgt)))
+                sc->transport_id = TRANSPORT_ISCSI;
+                /* targetname and tpgt */
+                if (! (sc->iscsi_sess->attr_val[0] &&
+                       sc->iscsi_sess->attr_val[1]))
                         return false;
-                n = atoi(tpgt);
+                n = atoi(sc->iscsi_sess->attr_val[1]);
                 // output target port name as per sam4r08, annex A, table A.3
-                snprintf(b, b_len, "%s,t,0x%x", nm, n);
+                snprintf(b, b_len, "%s,t,0x%x", sc->iscsi_sess->attr_val[0],
+                         n);
 // >>>       That reference says maximum length of targetname is 223 bytes
 //           (UTF-8) excluding trailing null.
                 return true;
         }
 
         /* USB device? */
-        cp = get_usb_devname(NULL, devname, wd, sizeof(wd) - 1);
-        if (cp) {
-                transport_id = TRANSPORT_USB;
-                snprintf(b, b_len, "usb:%s", cp);
+        if (HOST_TP_USB & htp->flags) {
+                sc->transport_id = TRANSPORT_USB;
+                snprintf(b, b_len, "usb:%s", htp->usb_name);
                 return true;
         }
 
         /* ATA or SATA device, crude check: driver name */
-        snprintf(buff, sizeof(buff), "%s%shost%d", sysfsroot, scsi_host,
-                 hctl.h);
-        if (get_value(buff, "proc_name", wd, sizeof(wd))) {
-                ata_dev = false;
-                if (0 == strcmp("ahci", wd)) {
-                        transport_id = TRANSPORT_SATA;
-                        snprintf(b, b_len, "sata:");
-                        ata_dev = true;
-                } else if (strstr(wd, "ata")) {
-                        if (0 == memcmp("sata", wd, 4)) {
-                                transport_id = TRANSPORT_SATA;
-                                snprintf(b, b_len, "sata:");
-                        } else {
-                                transport_id = TRANSPORT_ATA;
-                                snprintf(b, b_len, "ata:");
-                        }
-                        ata_dev = true;
-                }
-                if (ata_dev) {
-                        off = strlen(b);
-                        snprintf(b + off, b_len - off, "%s",
-                                 get_lu_name(devname, wd, sizeof(wd), false));
-                        return true;
-                }
+        if (TRANSPORT_UNKNOWN != htp->ata_id) {
+                sc->transport_id = htp->ata_id;
+                snprintf(b, b_len, "%s:%s",
+                         (TRANSPORT_SATA == htp->ata_id) ? "sata" : "ata",
+                         get_lu_name(devname, wd, sizeof(wd), false));
+                return true;
         }
         return false;
 }
@@ -2637,8 +5057,10 @@ transport_tport(const char * devname, const struct lsscsi_opts * op,
 /* Given the transport_id of the SCSI device (LU) associated with 'devname'
  * output additional information. */
 static void
-transport_tport_longer(const char * devname, const struct lsscsi_opts * op)
+transport_tport_longer(const char * devname, struct scan_ctx * sc,
+                       const struct lsscsi_opts * op)
 {
+        int k;
         char * cp;
         char path_name[LMAX_DEVPATH];
         char buff[LMAX_DEVPATH];
@@ -2646,256 +5068,214 @@ transport_tport_longer(const char * devname, const struct lsscsi_opts * op)
         char wd[LMAX_PATH];
         char value[LMAX_NAME];
         struct addr_hctl hctl;
+        struct fc_target * ftp;
+        struct fc_rport * frp;
 
 #if 0
         snprintf(buff, sizeof(buff), "%s/scsi_device:%s", path_name, devname);
-        if (! if_directory_chdir(buff, "device"))
-                return;
-        if (NULL == getcwd(wd, sizeof(wd)))
+        if (! if_directory_resolve(buff, "device", wd, sizeof(wd)))
                 return;
 #else
         snprintf(path_name, sizeof(path_name), "%s%s%s", sysfsroot,
                  class_scsi_dev, devname);
         my_strcopy(buff, path_name, sizeof(buff));
 #endif
-        switch (transport_id) {
+        switch (sc->transport_id) {
         case TRANSPORT_SPI:
-                printf("  transport=spi\n");
+                out_printf("  transport=spi\n");
                 if (! parse_colon_list(devname, &hctl))
                         break;
                 snprintf(buff, sizeof(buff), "%s%starget%d:%d:%d", sysfsroot,
                          spi_transport, hctl.h, hctl.c, hctl.t);
-                printf("  target_id=%d\n", hctl.t);
+                out_printf("  target_id=%d\n", hctl.t);
                 if (get_value(buff, "dt", value, sizeof(value)))
-                        printf("  dt=%s\n", value);
+                        out_printf("  dt=%s\n", value);
                 if (get_value(buff, "max_offset", value, sizeof(value)))
-                        printf("  max_offset=%s\n", value);
+                        out_printf("  max_offset=%s\n", value);
                 if (get_value(buff, "max_width", value, sizeof(value)))
-                        printf("  max_width=%s\n", value);
+                        out_printf("  max_width=%s\n", value);
                 if (get_value(buff, "min_period", value, sizeof(value)))
-                        printf("  min_period=%s\n", value);
+                        out_printf("  min_period=%s\n", value);
                 if (get_value(buff, "offset", value, sizeof(value)))
-                        printf("  offset=%s\n", value);
+                        out_printf("  offset=%s\n", value);
                 if (get_value(buff, "period", value, sizeof(value)))
-                        printf("  period=%s\n", value);
+                        out_printf("  period=%s\n", value);
                 if (get_value(buff, "width", value, sizeof(value)))
-                        printf("  width=%s\n", value);
+                        out_printf("  width=%s\n", value);
                 break;
         case TRANSPORT_FC:
         case TRANSPORT_FCOE:
-                printf("  transport=%s\n",
-                       transport_id == TRANSPORT_FC ? "fc:" : "fcoe:");
-                if (! if_directory_chdir(path_name, "device"))
-                        return;
-                if (NULL == getcwd(wd, sizeof(wd)))
-                        return;
-                cp = strrchr(wd, '/');
-                if (NULL == cp)
-                        return;
-                *cp = '\0';
-                cp = strrchr(wd, '/');
-                if (NULL == cp)
+                out_printf("  transport=%s\n",
+                           sc->transport_id == TRANSPORT_FC ? "fc:" : "fcoe:");
+                if (! (parse_colon_list(devname, &hctl) &&
+                       (ftp = fc_target_get(&hctl)) &&
+                       (frp = fc_target_rport(ftp, devname))))
                         return;
-                *cp = '\0';
-                cp = basename(wd);
-                snprintf(buff, sizeof(buff), "%s%s", "fc_remote_ports/", cp);
-                if (if_directory_chdir(wd, buff)) {
-                        if (NULL == getcwd(buff, sizeof(buff)))
-                                return;
-                } else {  /* newer transport */
-                        /* /sys  /class/fc_remote_ports/  rport-x:y-z  / */
-                        snprintf(buff, sizeof(buff), "%s%s%s/", sysfsroot,
-                                 fc_remote_ports, cp);
-                }
                 snprintf(b2, sizeof(b2), "%s%s", path_name, "/device/");
                 if (get_value(b2, "vendor", value, sizeof(value)))
-                        printf("  vendor=%s\n", value);
+                        out_printf("  vendor=%s\n", value);
                 if (get_value(b2, "model", value, sizeof(value)))
-                        printf("  model=%s\n", value);
-                printf("  %s\n",cp);    /* rport */
-                if (get_value(buff, "node_name", value, sizeof(value)))
-                        printf("  node_name=%s\n", value);
-                if (get_value(buff, "port_name", value, sizeof(value)))
-                        printf("  port_name=%s\n", value);
-                if (get_value(buff, "port_id", value, sizeof(value)))
-                        printf("  port_id=%s\n", value);
-                if (get_value(buff, "port_state", value, sizeof(value)))
-                        printf("  port_state=%s\n", value);
-                if (get_value(buff, "roles", value, sizeof(value)))
-                        printf("  roles=%s\n", value);
-// xxxxxxxxxxxx  following call to print_enclosure_device fails since b2 is
-// inappropriate, comment out since might be useless (check with FCP folks)
-                // print_enclosure_device(devname, b2, op);
-                if (get_value(buff, "scsi_target_id", value, sizeof(value)))
-                        printf("  scsi_target_id=%s\n", value);
-                if (get_value(buff, "supported_classes", value,
-                              sizeof(value)))
-                        printf("  supported_classes=%s\n", value);
-                if (get_value(buff, "fast_io_fail_tmo", value, sizeof(value)))
-                        printf("  fast_io_fail_tmo=%s\n", value);
-                if (get_value(buff, "dev_loss_tmo", value, sizeof(value)))
-                        printf("  dev_loss_tmo=%s\n", value);
+                        out_printf("  model=%s\n", value);
+                out_printf("  %s\n", frp->name);
+                /* the rport's attributes are the same for all its LUs */
+                for (k = 0; (! frp->attrs_read) &&
+                            (k < FC_RPORT_NUM_ATTRS); ++k) {
+                        if (get_value(frp->dir, fc_rport_attrs[k], value,
+                                      sizeof(value)))
+                                frp->attr_val[k] = strdup(value);
+                }
+                frp->attrs_read = true;
+// xxxxxxxxxxxx  a call to print_enclosure_device, after roles, fails since
+// b2 is inappropriate, left out since might be useless (check with FCP folks)
+                for (k = 0; k < FC_RPORT_NUM_ATTRS; ++k) {
+                        if (frp->attr_val[k])
+                                out_printf("  %s=%s\n", fc_rport_attrs[k],
+                                           frp->attr_val[k]);
+                }
                 if (op->verbose > 2) {
-                        printf("  fetched from directory: %s\n", buff);
-                        printf("  fetched from directory: %s\n", b2);
+                        out_printf("  fetched from directory: %s\n", frp->dir);
+                        out_printf("  fetched from directory: %s\n", b2);
                 }
                 break;
         case TRANSPORT_SRP:
-                printf("  transport=srp\n");
+                out_printf("  transport=srp\n");
                 if (! parse_colon_list(devname, &hctl))
                         break;
                 if (get_srp_orig_dgid(hctl.h, value, sizeof(value)))
-                        printf("  orig_dgid=%s\n", value);
+                        out_printf("  orig_dgid=%s\n", value);
                 if (get_srp_dgid(hctl.h, value, sizeof(value)))
-                        printf("  dgid=%s\n", value);
+                        out_printf("  dgid=%s\n", value);
                 break;
         case TRANSPORT_SAS:
-                printf("  transport=sas\n");
+                out_printf("  transport=sas\n");
                 snprintf(buff, sizeof(buff), "%s%s%s", sysfsroot, sas_device,
-                         sas_hold_end_device);
+                         sc->sas_hold_end_device);
 
                 snprintf(b2, sizeof(b2), "%s%s", path_name, "/device/");
                 if (get_value(b2, "vendor", value, sizeof(value)))
-                        printf("  vendor=%s\n", value);
+                        out_printf("  vendor=%s\n", value);
                 if (get_value(b2, "model", value, sizeof(value)))
-                        printf("  model=%s\n", value);
+                        out_printf("  model=%s\n", value);
 
                 snprintf(b2, sizeof(b2), "%s%s%s", sysfsroot, sas_end_device,
-                         sas_hold_end_device);
+                         sc->sas_hold_end_device);
                 if (get_value(buff, "bay_identifier", value, sizeof(value)))
-                        printf("  bay_identifier=%s\n", value);
-                print_enclosure_device(devname, b2, op);
+                        out_printf("  bay_identifier=%s\n", value);
+                print_enclosure_device(devname, b2, sc, op);
                 if (get_value(buff, "enclosure_identifier", value,
                               sizeof(value)))
-                        printf("  enclosure_identifier=%s\n", value);
+                        out_printf("  enclosure_identifier=%s\n", value);
                 if (get_value(buff, "initiator_port_protocols", value,
                               sizeof(value)))
-                        printf("  initiator_port_protocols=%s\n", value);
+                        out_printf("  initiator_port_protocols=%s\n", value);
                 if (get_value(b2, "initiator_response_timeout", value,
                               sizeof(value)))
-                        printf("  initiator_response_timeout=%s\n", value);
+                        out_printf("  initiator_response_timeout=%s\n", value);
                 if (get_value(b2, "I_T_nexus_loss_timeout", value,
                               sizeof(value)))
-                        printf("  I_T_nexus_loss_timeout=%s\n", value);
+                        out_printf("  I_T_nexus_loss_timeout=%s\n", value);
                 if (get_value(buff, "phy_identifier", value, sizeof(value)))
-                        printf("  phy_identifier=%s\n", value);
+                        out_printf("  phy_identifier=%s\n", value);
                 if (get_value(b2, "ready_led_meaning", value, sizeof(value)))
-                        printf("  ready_led_meaning=%s\n", value);
+                        out_printf("  ready_led_meaning=%s\n", value);
                 if (get_value(buff, "sas_address", value, sizeof(value)))
-                        printf("  sas_address=%s\n", value);
+                        out_printf("  sas_address=%s\n", value);
                 if (get_value(buff, "target_port_protocols", value,
                               sizeof(value)))
-                        printf("  target_port_protocols=%s\n", value);
+                        out_printf("  target_port_protocols=%s\n", value);
                 if (get_value(b2, "tlr_enabled", value, sizeof(value)))
-                        printf("  tlr_enabled=%s\n", value);
+                        out_printf("  tlr_enabled=%s\n", value);
                 if (get_value(b2, "tlr_supported", value, sizeof(value)))
-                        printf("  tlr_supported=%s\n", value);
+                        out_printf("  tlr_supported=%s\n", value);
                 if (op->verbose > 2) {
-                        printf("fetched from directory: %s\n", buff);
-                        printf("fetched from directory: %s\n", b2);
+                        out_printf("fetched from directory: %s\n", buff);
+                        out_printf("fetched from directory: %s\n", b2);
                 }
                 break;
         case TRANSPORT_SAS_CLASS:
-                printf("  transport=sas\n");
-                printf("  sub_transport=sas_class\n");
+                out_printf("  transport=sas\n");
+                out_printf("  sub_transport=sas_class\n");
                 snprintf(buff, sizeof(buff), "%s%s", path_name,
                          "/device/sas_device");
                 if (get_value(buff, "device_name", value, sizeof(value)))
-                        printf("  device_name=%s\n", value);
+                        out_printf("  device_name=%s\n", value);
                 if (get_value(buff, "dev_type", value, sizeof(value)))
-                        printf("  dev_type=%s\n", value);
+                        out_printf("  dev_type=%s\n", value);
                 if (get_value(buff, "iproto", value, sizeof(value)))
-                        printf("  iproto=%s\n", value);
+                        out_printf("  iproto=%s\n", value);
                 if (get_value(buff, "iresp_timeout", value, sizeof(value)))
-                        printf("  iresp_timeout=%s\n", value);
+                        out_printf("  iresp_timeout=%s\n", value);
                 if (get_value(buff, "itnl_timeout", value, sizeof(value)))
-                        printf("  itnl_timeout=%s\n", value);
+                        out_printf("  itnl_timeout=%s\n", value);
                 if (get_value(buff, "linkrate", value, sizeof(value)))
-                        printf("  linkrate=%s\n", value);
+                        out_printf("  linkrate=%s\n", value);
                 if (get_value(buff, "max_linkrate", value, sizeof(value)))
-                        printf("  max_linkrate=%s\n", value);
+                        out_printf("  max_linkrate=%s\n", value);
                 if (get_value(buff, "max_pathways", value, sizeof(value)))
-                        printf("  max_pathways=%s\n", value);
+                        out_printf("  max_pathways=%s\n", value);
                 if (get_value(buff, "min_linkrate", value, sizeof(value)))
-                        printf("  min_linkrate=%s\n", value);
+                        out_printf("  min_linkrate=%s\n", value);
                 if (get_value(buff, "pathways", value, sizeof(value)))
-                        printf("  pathways=%s\n", value);
+                        out_printf("  pathways=%s\n", value);
                 if (get_value(buff, "ready_led_meaning", value,
                               sizeof(value)))
-                        printf("  ready_led_meaning=%s\n", value);
+                        out_printf("  ready_led_meaning=%s\n", value);
                 if (get_value(buff, "rl_wlun", value, sizeof(value)))
-                        printf("  rl_wlun=%s\n", value);
+                        out_printf("  rl_wlun=%s\n", value);
                 if (get_value(buff, "sas_addr", value, sizeof(value)))
-                        printf("  sas_addr=%s\n", value);
+                        out_printf("  sas_addr=%s\n", value);
                 if (get_value(buff, "tproto", value, sizeof(value)))
-                        printf("  tproto=%s\n", value);
+                        out_printf("  tproto=%s\n", value);
                 if (get_value(buff, "transport_layer_retries", value,
                               sizeof(value)))
-                        printf("  transport_layer_retries=%s\n", value);
+                        out_printf("  transport_layer_retries=%s\n", value);
                 if (op->verbose > 2)
-                        printf("fetched from directory: %s\n", buff);
+                        out_printf("fetched from directory: %s\n", buff);
                 break;
         case TRANSPORT_ISCSI:
-                printf("  transport=iSCSI\n");
+                out_printf("  transport=iSCSI\n");
+                if (NULL == sc->iscsi_sess)
+                        break;
                 snprintf(buff, sizeof(buff), "%s%ssession%d", sysfsroot,
-                         iscsi_session, iscsi_tsession_num);
-                if (get_value(buff, "targetname", value, sizeof(value)))
-                        printf("  targetname=%s\n", value);
-                if (get_value(buff, "tpgt", value, sizeof(value)))
-                        printf("  tpgt=%s\n", value);
-                if (get_value(buff, "data_pdu_in_order", value,
-                              sizeof(value)))
-                        printf("  data_pdu_in_order=%s\n", value);
-                if (get_value(buff, "data_seq_in_order", value,
-                              sizeof(value)))
-                        printf("  data_seq_in_order=%s\n", value);
-                if (get_value(buff, "erl", value, sizeof(value)))
-                        printf("  erl=%s\n", value);
-                if (get_value(buff, "first_burst_len", value, sizeof(value)))
-                        printf("  first_burst_len=%s\n", value);
-                if (get_value(buff, "initial_r2t", value, sizeof(value)))
-                        printf("  initial_r2t=%s\n", value);
-                if (get_value(buff, "max_burst_len", value, sizeof(value)))
-                        printf("  max_burst_len=%s\n", value);
-                if (get_value(buff, "max_outstanding_r2t", value,
-                              sizeof(value)))
-                        printf("  max_outstanding_r2t=%s\n", value);
-                if (get_value(buff, "recovery_tmo", value, sizeof(value)))
-                        printf("  recovery_tmo=%s\n", value);
+                         iscsi_session, sc->iscsi_sess->num);
+                for (k = 0; k < ISCSI_SESS_NUM_ATTRS; ++k) {
+                        if (sc->iscsi_sess->attr_val[k])
+                                out_printf("  %s=%s\n", iscsi_sess_attrs[k],
+                                           sc->iscsi_sess->attr_val[k]);
+                }
 // >>>       Would like to see what are readable attributes in this directory.
 //           Ignoring connections for the time being. Could add with an entry
 //           for connection=<n> with normal two space indent followed by
 //           attributes for that connection indented 4 spaces
                 if (op->verbose > 2)
-                        printf("fetched from directory: %s\n", buff);
+                        out_printf("fetched from directory: %s\n", buff);
                 break;
         case TRANSPORT_SBP:
-                printf("  transport=sbp\n");
-                if (! if_directory_chdir(path_name, "device"))
-                        return;
-                if (NULL == getcwd(wd, sizeof(wd)))
+                out_printf("  transport=sbp\n");
+                if (! if_directory_resolve(path_name, "device", wd,
+                                           sizeof(wd)))
                         return;
                 if (get_value(wd, "ieee1394_id", value, sizeof(value)))
-                        printf("  ieee1394_id=%s\n", value);
+                        out_printf("  ieee1394_id=%s\n", value);
                 if (op->verbose > 2)
-                        printf("fetched from directory: %s\n", buff);
+                        out_printf("fetched from directory: %s\n", buff);
                 break;
         case TRANSPORT_USB:
-                printf("  transport=usb\n");
-                printf("  device_name=%s\n", get_usb_devname(NULL, devname,
-                       value, sizeof(value)));
+                out_printf("  transport=usb\n");
+                out_printf("  device_name=%s\n", get_usb_devname(NULL, devname,
+                           value, sizeof(value)));
                 break;
         case TRANSPORT_ATA:
-                printf("  transport=ata\n");
+                out_printf("  transport=ata\n");
                 cp = get_lu_name(devname, b2, sizeof(b2), false);
                 if (strlen(cp) > 0)
-                        printf("  wwn=%s\n", cp);
+                        out_printf("  wwn=%s\n", cp);
                 break;
         case TRANSPORT_SATA:
-                printf("  transport=sata\n");
+                out_printf("  transport=sata\n");
                 cp = get_lu_name(devname, b2, sizeof(b2), false);
                 if (strlen(cp) > 0)
-                        printf("  wwn=%s\n", cp);
+                        out_printf("  wwn=%s\n", cp);
                 break;
         default:
                 if (op->verbose > 1)
@@ -2904,278 +5284,617 @@ transport_tport_longer(const char * devname, const struct lsscsi_opts * op)
         }
 }
 
+/* Outputs the --size column from 'size' (in 512 byte blocks) and 'lbs'
+ * (logical block size). Either is NULL if it could not be read. */
 static void
-longer_d_entry(const char * path_name, const char * devname,
-               const struct lsscsi_opts * op)
+size_render(const char * size, const char * lbs_s,
+            const struct lsscsi_opts * op)
 {
+        uint64_t blk512s;
         char value[LMAX_NAME];
+        const int vlen = sizeof(value);
 
-        if (op->transport_info) {
-                transport_tport_longer(devname, op);
-                return;
-        }
-        if (op->long_opt >= 3) {
-                if (get_value(path_name, "device_blocked", value,
-                              sizeof(value)))
-                        printf("  device_blocked=%s\n", value);
-                else if (op->verbose > 0)
-                        printf("  device_blocked=?\n");
-                if (get_value(path_name, "iocounterbits", value,
-                              sizeof(value)))
-                        printf("  iocounterbits=%s\n", value);
-                else if (op->verbose > 0)
-                        printf("  iocounterbits=?\n");
-                if (get_value(path_name, "iodone_cnt", value, sizeof(value)))
-                        printf("  iodone_cnt=%s\n", value);
-                else if (op->verbose > 0)
-                        printf("  iodone_cnt=?\n");
-                if (get_value(path_name, "ioerr_cnt", value, sizeof(value)))
-                        printf("  ioerr_cnt=%s\n", value);
-                else if (op->verbose > 0)
-                        printf("  ioerr_cnt=?\n");
-                if (get_value(path_name, "iorequest_cnt", value,
-                              sizeof(value)))
-                        printf("  iorequest_cnt=%s\n", value);
-                else if (op->verbose > 0)
-                        printf("  iorequest_cnt=?\n");
-                if (get_value(path_name, "queue_depth", value,
-                              sizeof(value)))
-                        printf("  queue_depth=%s\n", value);
-                else if (op->verbose > 0)
-                        printf("  queue_depth=?\n");
-                if (get_value(path_name, "queue_type", value,
-                              sizeof(value)))
-                        printf("  queue_type=%s\n", value);
-                else if (op->verbose > 0)
-                        printf("  queue_type=?\n");
-                if (get_value(path_name, "scsi_level", value,
-                              sizeof(value)))
-                        printf("  scsi_level=%s\n", value);
-                else if (op->verbose > 0)
-                        printf("  scsi_level=?\n");
-                if (get_value(path_name, "state", value,
-                              sizeof(value)))
-                        printf("  state=%s\n", value);
-                else if (op->verbose > 0)
-                        printf("  state=?\n");
-                if (get_value(path_name, "timeout", value,
-                              sizeof(value)))
-                        printf("  timeout=%s\n", value);
-                else if (op->verbose > 0)
-                        printf("  timeout=?\n");
-                if (get_value(path_name, "type", value,
-                              sizeof(value)))
-                        printf("  type=%s\n", value);
-                else if (op->verbose > 0)
-                        printf("  type=?\n");
+        if (NULL == size) {
+                out_printf("  %6s", "-");
                 return;
         }
+        blk512s = atoll(size);
+        if (op->ssize > 2) {
+                int lbs = 0;
+
+                if (lbs_s) {
+                        lbs = atoi(lbs_s);
+                        if (lbs < 1)
+                                out_printf("  %12s,[lbs<1 ?]", size);
+                        else if (512 == lbs)
+                                out_printf("  %12s%s", size,
+                                           (op->ssize > 3) ? ",512" : "");
+                        else {
+                                int64_t byts = 512 * blk512s;
 
-        if (get_value(path_name, "state", value, sizeof(value)))
-                printf("  state=%s", value);
-        else
-                printf("  state=?");
-        if (get_value(path_name, "queue_depth", value, sizeof(value)))
-                printf(" queue_depth=%s", value);
-        else
-                printf(" queue_depth=?");
-        if (get_value(path_name, "scsi_level", value, sizeof(value)))
-                printf(" scsi_level=%s", value);
-        else
-                printf(" scsi_level=?");
-        if (get_value(path_name, "type", value, sizeof(value)))
-                printf(" type=%s", value);
-        else
-                printf(" type=?");
-        if (get_value(path_name, "device_blocked", value, sizeof(value)))
-                printf(" device_blocked=%s", value);
-        else
-                printf(" device_blocked=?");
-        if (get_value(path_name, "timeout", value, sizeof(value)))
-                printf(" timeout=%s", value);
-        else
-                printf(" timeout=?");
-        printf("\n");
-        if (op->long_opt == 2) {
-                if (get_value(path_name, "iocounterbits", value,
-                              sizeof(value)))
-                        printf("  iocounterbits=%s", value);
-                else
-                        printf("  iocounterbits=?");
-                if (get_value(path_name, "iodone_cnt", value,
-                               sizeof(value)))
-                        printf(" iodone_cnt=%s", value);
-                else
-                        printf(" iodone_cnt=?");
-                if (get_value(path_name, "ioerr_cnt", value,
-                               sizeof(value)))
-                        printf(" ioerr_cnt=%s", value);
-                else
-                        printf(" ioerr_cnt=?");
-                if (get_value(path_name, "iorequest_cnt", value,
-                               sizeof(value)))
-                        printf(" iorequest_cnt=%s", value);
-                else
-                        printf(" iorequest_cnt=?");
-                printf("\n");
-                if (get_value(path_name, "queue_type", value,
-                               sizeof(value)))
-                        printf("  queue_type=%s", value);
+                                snprintf(value, vlen, "%" PRId64,
+                                         (byts / lbs));
+                                if (op->ssize > 3)
+                                        out_printf("  %12s,%d", value, lbs);
+                                else
+                                        out_printf("  %12s", value);
+                        }
+                } else
+                        out_printf("  %12s,512", size);
+        } else {
+                enum string_size_units unit_val = (0x1 & op->ssize) ?
+                                         STRING_UNITS_10 : STRING_UNITS_2;
+
+                blk512s <<= 9;
+                if (blk512s > 0 &&
+                    size2string(blk512s, unit_val, value, vlen))
+                        out_printf("  %6s", value);
                 else
-                        printf("  queue_type=?");
-                printf("\n");
+                        out_printf("  %6s", "-");
         }
 }
 
-#if (HAVE_NVME && (! IGNORE_NVME))
+/* Attributes in a SCSI device (LU) directory that may be output */
+enum sdev_attr_idx {
+        SA_VENDOR = 0,
+        SA_MODEL,
+        SA_REV,
+        SA_TYPE,
+        SA_SCSI_LEVEL,
+        SA_STATE,
+        SA_QUEUE_DEPTH,
+        SA_DEVICE_BLOCKED,
+        SA_TIMEOUT,
+        SA_IOCOUNTERBITS,
+        SA_IODONE_CNT,
+        SA_IOERR_CNT,
+        SA_IOREQUEST_CNT,
+        SA_QUEUE_TYPE,
+        SDEV_NUM_ATTRS,
+};
 
-/* NVMe longer data for namespace listing */
+static const char * sdev_attrs[SDEV_NUM_ATTRS] = {
+        "vendor", "model", "rev", "type", "scsi_level", "state",
+        "queue_depth", "device_blocked", "timeout", "iocounterbits",
+        "iodone_cnt", "ioerr_cnt", "iorequest_cnt", "queue_type",
+};
+
+#define SA_BIT(idx) (1U << (idx))
+#define SA_LONG1_MASK (SA_BIT(SA_STATE) | SA_BIT(SA_QUEUE_DEPTH) | \
+                       SA_BIT(SA_SCSI_LEVEL) | SA_BIT(SA_TYPE) | \
+                       SA_BIT(SA_DEVICE_BLOCKED) | SA_BIT(SA_TIMEOUT))
+#define SA_LONG_MASK (SA_LONG1_MASK | SA_BIT(SA_IOCOUNTERBITS) | \
+                      SA_BIT(SA_IODONE_CNT) | SA_BIT(SA_IOERR_CNT) | \
+                      SA_BIT(SA_IOREQUEST_CNT) | SA_BIT(SA_QUEUE_TYPE))
+/* Those that change without a uevent, so are never cached (--cache) */
+#define SA_LIVE_MASK (SA_BIT(SA_STATE) | SA_BIT(SA_QUEUE_DEPTH) | \
+                      SA_BIT(SA_DEVICE_BLOCKED) | SA_BIT(SA_TIMEOUT) | \
+                      SA_BIT(SA_IODONE_CNT) | SA_BIT(SA_IOERR_CNT) | \
+                      SA_BIT(SA_IOREQUEST_CNT))
+
+/* Columns that --columns=LIST may name */
+enum col_id {
+        COL_HCTL = 0,
+        COL_TYPE,
+        COL_PDT,
+        COL_VENDOR,
+        COL_MODEL,
+        COL_REV,
+        COL_TRANSPORT,
+        COL_LU_NAME,
+        COL_WWN,
+        COL_NODE,
+        COL_DEV,
+        COL_SCSI_ID,
+        COL_SG,
+        COL_SG_DEV,
+        COL_PROTECTION,
+        COL_INTEGRITY,
+        COL_PROTMODE,
+        COL_ENCLOSURE,
+        COL_SIZE,
+        COL_BLOCKS,
+        COL_LBS,
+        COL_STATE,
+        COL_QUEUE_DEPTH,
+        COL_SCSI_LEVEL,
+        COL_DEVICE_BLOCKED,
+        COL_TIMEOUT,
+        COL_IOCOUNTERBITS,
+        COL_IODONE_CNT,
+        COL_IOERR_CNT,
+        COL_IOREQUEST_CNT,
+        COL_QUEUE_TYPE,
+        NUM_COLS,
+};
+
+/* For each column: its name, the width it is padded to and what the
+ * collector must read from sysfs for a SCSI device to fill it in. */
+struct col_def {
+        const char * name;
+        int width;
+        uint32_t need;          /* PLAN_* */
+        uint32_t sdev_attrs;    /* SA_BIT()s */
+};
+
+static const struct col_def col_defs[NUM_COLS] = {
+        {"hctl", 13, 0, 0},
+        {"type", 7, 0, SA_BIT(SA_TYPE)},
+        {"pdt", 4, 0, SA_BIT(SA_TYPE)},
+        {"vendor", 8, 0, SA_BIT(SA_VENDOR)},
+        {"model", 16, 0, SA_BIT(SA_MODEL)},
+        {"rev", 4, 0, SA_BIT(SA_REV)},
+        {"transport", 30, PLAN_TPORT, 0},
+        {"lu_name", 32, PLAN_LU_NAME, 0},
+        {"wwn", DISK_WWN_MAX_LEN - 1, PLAN_NODE | PLAN_WWN, 0},
+        {"node", 9, PLAN_NODE, 0},
+        {"dev", 7, PLAN_NODE | PLAN_DEV, 0},
+        {"scsi_id", 9, PLAN_NODE | PLAN_SCSI_ID, 0},
+        {"sg", 9, PLAN_SG, 0},
+        {"sg_dev", 7, PLAN_SG | PLAN_SG_DEV, 0},
+        {"protection", 9, PLAN_PROT, 0},
+        {"integrity", 16, PLAN_PROT, 0},
+        {"protmode", 4, PLAN_PROTMODE, 0},
+        {"enclosure", 22, PLAN_ENCL, 0},
+        {"size", 6, PLAN_SIZE, SA_BIT(SA_TYPE)},
+        {"blocks", 12, PLAN_SIZE | PLAN_LBS, SA_BIT(SA_TYPE)},
+        {"lbs", 4, PLAN_SIZE | PLAN_LBS, SA_BIT(SA_TYPE)},
+        {"state", 7, 0, SA_BIT(SA_STATE)},
+        {"queue_depth", 3, 0, SA_BIT(SA_QUEUE_DEPTH)},
+        {"scsi_level", 2, 0, SA_BIT(SA_SCSI_LEVEL)},
+        {"device_blocked", 1, 0, SA_BIT(SA_DEVICE_BLOCKED)},
+        {"timeout", 3, 0, SA_BIT(SA_TIMEOUT)},
+        {"iocounterbits", 2, 0, SA_BIT(SA_IOCOUNTERBITS)},
+        {"iodone_cnt", 10, 0, SA_BIT(SA_IODONE_CNT)},
+        {"ioerr_cnt", 4, 0, SA_BIT(SA_IOERR_CNT)},
+        {"iorequest_cnt", 10, 0, SA_BIT(SA_IOREQUEST_CNT)},
+        {"queue_type", 6, 0, SA_BIT(SA_QUEUE_TYPE)},
+};
+
+/* Decodes the comma separated column names in 'arg' into op->plan.cols .
+ * Returns false (after saying why) if a name is not known. */
+static bool
+parse_columns(const char * arg, struct lsscsi_opts * op)
+{
+        int k, n;
+        const char * cp;
+        struct col_plan * pp = &op->plan;
+
+        for (cp = arg; *cp; cp += n + (',' == cp[n])) {
+                n = strcspn(cp, ",");
+                if (0 == n)
+                        continue;
+                for (k = 0; k < NUM_COLS; ++k) {
+                        if (((int)strlen(col_defs[k].name) == n) &&
+                            (0 == strncmp(cp, col_defs[k].name, n)))
+                                break;
+                }
+                if (k >= NUM_COLS) {
+                        pr2serr("--columns: '%.*s' is not a column, choose "
+                                "from:\n ", n, cp);
+                        for (k = 0; k < NUM_COLS; ++k)
+                                pr2serr(" %s", col_defs[k].name);
+                        pr2serr("\n");
+                        return false;
+                }
+                if (pp->num_cols >= MAX_COLS) {
+                        pr2serr("--columns: no more than %d please\n",
+                                MAX_COLS);
+                        return false;
+                }
+                pp->cols[pp->num_cols++] = k;
+        }
+        if (0 == pp->num_cols) {
+                pr2serr("--columns: expects a list of column names\n");
+                return false;
+        }
+        return true;
+}
+
+/* Works out what is to be read for each SCSI device from the options,
+ * so that collect_sdev() reads no more than the output needs. */
 static void
-longer_nd_entry(const char * path_name, const char * devname,
-                const struct lsscsi_opts * op)
+plan_sdev(struct lsscsi_opts * op)
 {
-        char value[LMAX_NAME];
-        const int vlen = sizeof(value);
+        int k;
+        struct col_plan * pp = &op->plan;
+
+        pp->need = 0;
+        pp->sdev_attrs = 0;
+        if (pp->num_cols > 0) {
+                for (k = 0; k < pp->num_cols; ++k) {
+                        pp->need |= col_defs[pp->cols[k]].need;
+                        pp->sdev_attrs |= col_defs[pp->cols[k]].sdev_attrs;
+                }
+        } else if (op->classic) {
+                pp->sdev_attrs = SA_BIT(SA_VENDOR) | SA_BIT(SA_MODEL) |
+                                 SA_BIT(SA_REV) | SA_BIT(SA_TYPE) |
+                                 SA_BIT(SA_SCSI_LEVEL);
+                if (op->generic)
+                        pp->need |= PLAN_SG;
+        } else {
+                pp->need = PLAN_NODE;
+                if (op->pdt || (! op->brief) || op->ssize)
+                        pp->sdev_attrs |= SA_BIT(SA_TYPE);
+                if (op->transport_info)
+                        pp->need |= PLAN_TPORT;
+                else if (op->unit)
+                        pp->need |= PLAN_LU_NAME;
+                else if (! op->brief)
+                        pp->sdev_attrs |= SA_BIT(SA_VENDOR) |
+                                          SA_BIT(SA_MODEL) | SA_BIT(SA_REV);
+                if (op->wwn)
+                        pp->need |= PLAN_WWN;
+                if (op->dev_maj_min)
+                        pp->need |= PLAN_DEV;
+                if (op->scsi_id)
+                        pp->need |= PLAN_SCSI_ID;
+                if (op->generic)
+                        pp->need |= PLAN_SG |
+                                    (op->dev_maj_min ? PLAN_SG_DEV : 0);
+                if (op->protection)
+                        pp->need |= PLAN_PROT;
+                if (op->protmode)
+                        pp->need |= PLAN_PROTMODE;
+                if (op->enclosure)
+                        pp->need |= PLAN_ENCL;
+                if (op->ssize)
+                        pp->need |= PLAN_SIZE |
+                                    ((op->ssize > 2) ? PLAN_LBS : 0);
+        }
+        if (op->json) {
+                /* the members filled for every record. Only scsi_id and
+                 * enclosure, which cost a scan of /dev/disk/by-id and a
+                 * walk of /sys/class/enclosure , follow the options as
+                 * above and are otherwise null */
+                pp->need |= PLAN_TPORT | PLAN_LU_NAME | PLAN_NODE |
+                            PLAN_WWN | PLAN_DEV | PLAN_SG | PLAN_SG_DEV |
+                            PLAN_PROT | PLAN_PROTMODE | PLAN_SIZE | PLAN_LBS;
+                pp->sdev_attrs |= SA_LONG_MASK | SA_BIT(SA_TYPE) |
+                                  SA_BIT(SA_VENDOR) | SA_BIT(SA_MODEL) |
+                                  SA_BIT(SA_REV);
+                return;
+        }
+        if ((op->long_opt > 0) && (! op->transport_info))
+                pp->sdev_attrs |= (1 == op->long_opt) ? SA_LONG1_MASK :
+                                                        SA_LONG_MASK;
+        if ((op->verbose > 0) && (! op->classic))
+                pp->need |= PLAN_RESOLVED;
+}
 
-        if (devname) { ; }      /* suppress warning */
-        if (op->long_opt) {
-                bool sing = (op->long_opt > 2);
-                const char * sep = sing ? "\n" : "";
+/* The device node (e.g. /dev/sda) of a LU, if any */
+enum sdev_node_state {
+        SN_NONE = 0,            /* no block or (non sg) char device */
+        SN_FOUND,
+        SN_SCAN_ERR,            /* its directory could not be scanned */
+};
 
-                if (get_value(path_name, "capability", value, vlen))
-                        printf("  capability=%s%s", value, sep);
-                else
-                        printf("  capability=?%s", sep);
-                if (get_value(path_name, "ext_range", value, vlen))
-                        printf("  ext_range=%s%s", value, sep);
-                else
-                        printf("  ext_range=?%s", sep);
-                if (get_value(path_name, "hidden", value, vlen))
-                        printf("  hidden=%s%s", value, sep);
-                else
-                        printf("  hidden=?%s", sep);
-                if (get_value(path_name, "nsid", value, vlen))
-                        printf("  nsid=%s%s", value, sep);
-                else
-                        printf("  nsid=?%s", sep);
-                if (get_value(path_name, "range", value, vlen))
-                        printf("  range=%s%s", value, sep);
-                else
-                        printf("  range=?%s", sep);
-                if (get_value(path_name, "removable", value, vlen))
-                        printf("  removable=%s%s", value, sep);
-                else
-                        printf("  removable=?%s", sep);
-                if (op->long_opt > 1) {
-                        if (! sing)
-                                printf("\n");
-                        if (get_value(path_name, "queue/nr_requests", value,
-                                      vlen))
-                                printf("  nr_requests=%s%s", value, sep);
-                        else
-                                printf("  nr_requests=?%s", sep);
-                        if (get_value(path_name, "queue/read_ahead_kb", value,
-                                      vlen))
-                                printf("  read_ahead_kb=%s%s", value, sep);
-                        else
-                                printf("  read_ahead_kb=?%s", sep);
-                        if (get_value(path_name, "queue/write_cache", value,
-                                      vlen))
-                                printf("  write_cache=%s%s", value, sep);
-                        else
-                                printf("  write_cache=?%s", sep);
-                        if (! sing)
-                                printf("\n");
-                        if (get_value(path_name, "queue/logical_block_size",
-                                      value, vlen))
-                                printf("  logical_block_size=%s%s", value,
-                                       sep);
-                        else
-                                printf("  logical_block_size=?%s", sep);
-                        if (get_value(path_name, "queue/physical_block_size",
-                                      value, vlen))
-                                printf("  physical_block_size=%s%s", value,
-                                       sep);
-                        else
-                                printf("  physical_block_size=?%s", sep);
+/* All that is output for one SCSI device (LU), collected from sysfs by
+ * collect_sdev() for the options given, then output by one of the
+ * renderers: sdev_render(), classic_sdev_render() and longer_d_entry().
+ * A string that could not be read is empty with its '_ok' flag clear. */
+struct sdev_rec {
+        struct addr_hctl hctl;
+        bool hctl_ok;
+        uint32_t attr_ok;               /* SA_BIT() of each one read */
+        int type;
+        int type_err;   /* 0: ok, 1: not read, 2: not a number, 3: > 31 */
+        bool tport_ok;                  /* --transport */
+        int transport_id;               /* TRANSPORT_*, with tport */
+        enum sdev_node_state node;
+        enum dev_type node_type;
+        bool wwn_ok;                    /* --wwn */
+        bool dev_ok;                    /* --device */
+        bool sg_ok;                     /* --generic */
+        bool sg_dev_ok;
+        bool prot_type_ok;              /* --protection */
+        bool integrity_ok;
+        bool protmode_ok;               /* --protmode */
+        bool size_ok;                   /* --size */
+        bool lbs_ok;
+        bool resolved_ok;               /* --verbose */
+        char * scsi_id;                 /* --scsi_id, NULL if none */
+        const struct encl_slot * esp;   /* --enclosure, NULL if none */
+        /* strings from here on, only valid as flagged above */
+        char devname[LMAX_NAME];        /* "<h:c:t:l>" */
+        char dir[LMAX_DEVPATH];         /* in /sys/bus/scsi/devices */
+        char attr_val[SDEV_NUM_ATTRS][LMAX_NAME];
+        char tport[LMAX_NAME];
+        char lu_name[LMAX_NAME];        /* --unit, empty if none */
+        char node_dir[LMAX_PATH];       /* e.g. .../block/sda */
+        char dev_node[LMAX_NAME];
+        char wwn[DISK_WWN_MAX_LEN];
+        char dev[LMAX_NAME];
+        char sg_node[LMAX_NAME];
+        char sg_dev[LMAX_NAME];
+        char prot_type[LMAX_NAME];
+        char integrity[LMAX_NAME];
+        char protmode[LMAX_NAME];
+        char size[LMAX_NAME];           /* in 512 byte blocks */
+        char lbs[32];
+        char resolved[LMAX_PATH];
+};
+
+/* Reads the attributes in 'mask' not already read */
+static void
+sdev_rec_attrs(struct sdev_rec * rp, uint32_t mask)
+{
+        int k;
+
+        for (k = 0; k < SDEV_NUM_ATTRS; ++k) {
+                if ((mask & SA_BIT(k)) && (! (rp->attr_ok & SA_BIT(k))) &&
+                    get_value(rp->dir, sdev_attrs[k], rp->attr_val[k],
+                              LMAX_NAME))
+                        rp->attr_ok |= SA_BIT(k);
+        }
+}
+
+/* Value of attribute 'idx' or "?" if it could not be read */
+static const char *
+sdev_rec_attr(const struct sdev_rec * rp, int idx)
+{
+        return (rp->attr_ok & SA_BIT(idx)) ? rp->attr_val[idx] : "?";
+}
+
+/* Gets the device node name (or kernel name) of the sysfs device in
+ * 'dir', and optionally its major:minor , into 'node' and 'dev'. */
+static void
+collect_node(char * dir, enum dev_type typ, const char * missing,
+             char * node, int node_len, bool * dev_okp, char * dev,
+             const struct lsscsi_opts * op)
+{
+        if (op->kname)
+                snprintf(node, node_len, "%s/%s", dev_dir, basename(dir));
+        else if (! get_dev_node(dir, node, typ))
+                snprintf(node, node_len, "%s", missing);
+        if (dev_okp)
+                *dev_okp = get_value(dir, "dev", dev, LMAX_NAME);
+}
+
+/* Finds the block or (non sg) char device of a LU and gets its device
+ * node name, plus the extras that options ask for. */
+static void
+collect_sdev_node(struct sdev_rec * rp, struct scan_ctx * sc,
+                  const struct lsscsi_opts * op)
+{
+        char extra[LMAX_DEVPATH];
+        char * wd = rp->node_dir;
+        const char * blkdir;
+
+        wd[0] = '\0';
+        if (1 == non_sg_scan(rp->dir, sc, op)) {
+                blkdir = NULL;
+                rp->node = SN_FOUND;
+                if ((FT_BLOCK == sc->non_sg.ft) &&
+                    (LU_MAP_BLK & lu_map_valid))
+                        blkdir = sdev_block_dir(rp->dir, sc);
+                if (blkdir)     /* from the LU map, no need to scan */
+                        my_strcopy(wd, blkdir, LMAX_PATH);
+                else if (DT_DIR == sc->non_sg.d_type) {
+                        snprintf(wd, LMAX_PATH, "%s/%s", rp->dir,
+                                 sc->non_sg.name);
+                        if (1 == scan_for_first(wd, sc, op))
+                                my_strcopy(extra, sc->aa_first.name,
+                                           sizeof(extra));
+                        else {
+                                rp->node = SN_SCAN_ERR;
+                                wd[0] = '\0';
+                        }
+                } else {
+                        my_strcopy(wd, rp->dir, LMAX_PATH);
+                        my_strcopy(extra, sc->non_sg.name, sizeof(extra));
                 }
-                if (! sing)
-                        printf("\n");
+                if (wd[0] && (NULL == blkdir))
+                        /* wd unchanged if extra not a directory */
+                        if_directory_resolve(wd, extra, wd, LMAX_PATH);
+        }
+        if (SN_FOUND == rp->node) {
+                uint32_t need = op->plan.need;
+
+                rp->node_type = (FT_BLOCK == sc->non_sg.ft) ? BLK_DEV :
+                                                              CHR_DEV;
+                if ((need & PLAN_WWN) && (BLK_DEV == rp->node_type))
+                        rp->wwn_ok = get_disk_wwn(wd, rp->wwn,
+                                                  sizeof(rp->wwn));
+                collect_node(wd, rp->node_type, "-       ", rp->dev_node,
+                             sizeof(rp->dev_node),
+                             (need & PLAN_DEV) ? &rp->dev_ok : NULL, rp->dev,
+                             op);
+                if (need & PLAN_SCSI_ID)
+                        rp->scsi_id = get_disk_scsi_id(rp->dev_node);
         }
 }
 
-#endif          /* (HAVE_NVME && (! IGNORE_NVME)) */
+/* Fills in *rp with what the options ask to be output about the SCSI
+ * device (LU) 'devname' in 'dir_name'. */
+static void
+collect_sdev(const char * dir_name, const char * devname,
+             struct scan_ctx * sc, const struct lsscsi_opts * op,
+             struct sdev_rec * rp)
+{
+        uint32_t need = op->plan.need;
+        char sg_wd[LMAX_PATH];
+        const char * blkdir;
+        const char * sddir;
+
+        memset(rp, 0, offsetof(struct sdev_rec, devname));
+        my_strcopy(rp->devname, devname, sizeof(rp->devname));
+        snprintf(rp->dir, sizeof(rp->dir), "%s/%s", dir_name, devname);
+        rp->hctl_ok = parse_colon_list(devname, &rp->hctl);
+        if (! rp->hctl_ok)
+                invalidate_hctl(&rp->hctl);
+
+        sdev_rec_attrs(rp, op->plan.sdev_attrs);
+        rp->type = -1;
+        if (! (rp->attr_ok & SA_BIT(SA_TYPE)))
+                rp->type_err = 1;
+        else if (1 != sscanf(rp->attr_val[SA_TYPE], "%d", &rp->type))
+                rp->type_err = 2;
+        else if ((rp->type < 0) || (rp->type > 31))
+                rp->type_err = 3;
+
+        if (need & PLAN_TPORT) {
+                rp->tport_ok = transport_tport(devname, sc, op,
+                                               sizeof(rp->tport), rp->tport);
+                rp->transport_id = sc->transport_id;
+        }
+        if (need & PLAN_LU_NAME)
+                get_lu_name(devname, rp->lu_name, sizeof(rp->lu_name),
+                            op->unit > 3);
+        if (need & PLAN_NODE)
+                collect_sdev_node(rp, sc, op);
+        if ((need & PLAN_SG) &&
+            if_directory_resolve_generic(rp->dir, sc, sg_wd, sizeof(sg_wd))) {
+                rp->sg_ok = true;
+                collect_node(sg_wd, CHR_DEV, "-", rp->sg_node,
+                             sizeof(rp->sg_node),
+                             (need & PLAN_SG_DEV) ? &rp->sg_dev_ok : NULL,
+                             rp->sg_dev, op);
+        }
+        if (need & PLAN_PROT) {
+                sddir = sdev_sd_dir(rp->dir, sc);
+                blkdir = sdev_block_dir(rp->dir, sc);
+                rp->prot_type_ok = sddir &&
+                        get_value(sddir, "protection_type", rp->prot_type,
+                                  sizeof(rp->prot_type));
+                rp->integrity_ok = blkdir &&
+                        get_value(blkdir, "integrity/format", rp->integrity,
+                                  sizeof(rp->integrity));
+        }
+        if (need & PLAN_PROTMODE) {
+                sddir = sdev_sd_dir(rp->dir, sc);
+                rp->protmode_ok = sddir &&
+                        get_value(sddir, "protection_mode", rp->protmode,
+                                  sizeof(rp->protmode));
+        }
+        if (need & PLAN_ENCL)
+                rp->esp = get_encl_slot(devname, NULL);
+        if ((need & PLAN_SIZE) && (0 == rp->type_err) && (0 == rp->type)) {
+                blkdir = sdev_block_dir(rp->dir, sc);
+                rp->size_ok = blkdir &&
+                        get_value(blkdir, "size", rp->size,
+                                  sizeof(rp->size));
+                if (rp->size_ok && (need & PLAN_LBS))
+                        rp->lbs_ok = get_value(blkdir,
+                                               "queue/logical_block_size",
+                                               rp->lbs, sizeof(rp->lbs));
+        }
+        if (need & PLAN_RESOLVED)
+                rp->resolved_ok = if_directory_resolve(rp->dir, "",
+                                                       rp->resolved,
+                                                       sizeof(rp->resolved));
+}
 
 static void
-one_classic_sdev_entry(const char * dir_name, const char * devname,
-                       const struct lsscsi_opts * op)
+free_sdev_rec(struct sdev_rec * rp)
 {
-        int type, scsi_level;
-        char buff[LMAX_DEVPATH];
-        char wd[LMAX_PATH];
-        char dev_node[LMAX_NAME];
-        char value[LMAX_NAME];
-        struct addr_hctl hctl;
+        free(rp->scsi_id);
+        rp->scsi_id = NULL;
+}
 
-        snprintf(buff, sizeof(buff), "%s/%s", dir_name, devname);
-        if (! parse_colon_list(devname, &hctl))
-                invalidate_hctl(&hctl);
-        printf("Host: scsi%d Channel: %02d Target: %02d Lun: %02" PRIu64 "\n",
-               hctl.h, hctl.c, hctl.t, hctl.l);
+/* Order of the attributes output by --list (one per line) */
+static const int sdev_list_attrs[] = {
+        SA_DEVICE_BLOCKED, SA_IOCOUNTERBITS, SA_IODONE_CNT, SA_IOERR_CNT,
+        SA_IOREQUEST_CNT, SA_QUEUE_DEPTH, SA_QUEUE_TYPE, SA_SCSI_LEVEL,
+        SA_STATE, SA_TIMEOUT, SA_TYPE, -1,
+};
+
+/* Lines output by --long (once, then also the others if twice) */
+static const int sdev_long1_attrs[] = {
+        SA_STATE, SA_QUEUE_DEPTH, SA_SCSI_LEVEL, SA_TYPE, SA_DEVICE_BLOCKED,
+        SA_TIMEOUT, -1,
+};
+static const int sdev_long2_attrs[] = {
+        SA_IOCOUNTERBITS, SA_IODONE_CNT, SA_IOERR_CNT, SA_IOREQUEST_CNT, -1,
+};
+static const int sdev_long3_attrs[] = {
+        SA_QUEUE_TYPE, -1,
+};
+
+/* Outputs the attributes in 'idxs' (terminated by -1) on one line */
+static void
+sdev_long_line(const struct sdev_rec * rp, const int * idxs)
+{
+        int k;
+
+        for (k = 0; idxs[k] >= 0; ++k)
+                out_printf("%s%s=%s", (k ? " " : "  "), sdev_attrs[idxs[k]],
+                           sdev_rec_attr(rp, idxs[k]));
+        out_printf("\n");
+}
+
+/* Outputs the --long or --list lines of a SCSI device (LU) */
+static void
+longer_d_entry(const struct sdev_rec * rp, struct scan_ctx * sc,
+               const struct lsscsi_opts * op)
+{
+        int k, idx;
 
-        if (get_value(buff, "vendor", value, sizeof(value)))
-                printf("  Vendor: %-8s", value);
+        if (op->enclosure)
+                longer_encl_slot(rp->devname, op);
+        if (op->transport_info) {
+                transport_tport_longer(rp->devname, sc, op);
+                return;
+        }
+        if (op->long_opt >= 3) {
+                for (k = 0; (idx = sdev_list_attrs[k]) >= 0; ++k) {
+                        if (rp->attr_ok & SA_BIT(idx))
+                                out_printf("  %s=%s\n", sdev_attrs[idx],
+                                           rp->attr_val[idx]);
+                        else if (op->verbose > 0)
+                                out_printf("  %s=?\n", sdev_attrs[idx]);
+                }
+                return;
+        }
+        sdev_long_line(rp, sdev_long1_attrs);
+        if (op->long_opt == 2) {
+                sdev_long_line(rp, sdev_long2_attrs);
+                sdev_long_line(rp, sdev_long3_attrs);
+        }
+}
+
+/* Outputs a SCSI device (LU) in the style of /proc/scsi/scsi */
+static void
+classic_sdev_render(const struct sdev_rec * rp, struct scan_ctx * sc,
+                    const struct lsscsi_opts * op)
+{
+        int scsi_level;
+        static const char * type_errs[] = {"", "?", "??", "???"};
+
+        out_printf("Host: scsi%d Channel: %02d Target: %02d Lun: %02"
+                   PRIu64 "\n", rp->hctl.h, rp->hctl.c, rp->hctl.t, rp->hctl.l);
+
+        if (rp->attr_ok & SA_BIT(SA_VENDOR))
+                out_printf("  Vendor: %-8s", rp->attr_val[SA_VENDOR]);
         else
-                printf("  Vendor: ?       ");
-        if (get_value(buff, "model", value, sizeof(value)))
-                printf(" Model: %-16s", value);
+                out_printf("  Vendor: ?       ");
+        if (rp->attr_ok & SA_BIT(SA_MODEL))
+                out_printf(" Model: %-16s", rp->attr_val[SA_MODEL]);
         else
-                printf(" Model: ?               ");
-        if (get_value(buff, "rev", value, sizeof(value)))
-                printf(" Rev: %-4s", value);
+                out_printf(" Model: ?               ");
+        if (rp->attr_ok & SA_BIT(SA_REV))
+                out_printf(" Rev: %-4s", rp->attr_val[SA_REV]);
         else
-                printf(" Rev: ?   ");
-        printf("\n");
-        if (! get_value(buff, "type", value, sizeof(value))) {
-                printf("  Type:   %-33s", "?");
-        } else if (1 != sscanf(value, "%d", &type)) {
-                printf("  Type:   %-33s", "??");
-        } else if ((type < 0) || (type > 31)) {
-                printf("  Type:   %-33s", "???");
-        } else
-                printf("  Type:   %-33s", scsi_device_types[type]);
-        if (! get_value(buff, "scsi_level", value, sizeof(value))) {
-                printf("ANSI SCSI revision: ?\n");
-        } else if (1 != sscanf(value, "%d", &scsi_level)) {
-                printf("ANSI SCSI revision: ??\n");
+                out_printf(" Rev: ?   ");
+        out_printf("\n");
+        out_printf("  Type:   %-33s", rp->type_err ? type_errs[rp->type_err] :
+                                  scsi_device_types[rp->type]);
+        if (! (rp->attr_ok & SA_BIT(SA_SCSI_LEVEL))) {
+                out_printf("ANSI SCSI revision: ?\n");
+        } else if (1 != sscanf(rp->attr_val[SA_SCSI_LEVEL], "%d",
+                               &scsi_level)) {
+                out_printf("ANSI SCSI revision: ??\n");
         } else if (scsi_level == 0) {
-                printf("ANSI SCSI revision: none\n");
+                out_printf("ANSI SCSI revision: none\n");
         } else
-                printf("ANSI SCSI revision: %02x\n", (scsi_level - 1) ?
+                out_printf("ANSI SCSI revision: %02x\n", (scsi_level - 1) ?
                                             scsi_level - 1 : 1);
-        if (op->generic) {
-                if (if_directory_ch2generic(buff)) {
-                        if (NULL == getcwd(wd, sizeof(wd)))
-                                printf("generic_dev error\n");
-                        else {
-                                if (op->kname)
-                                        snprintf(dev_node, sizeof(dev_node),
-                                                 "%s/%s", dev_dir,
-                                                 basename(wd));
-                                else if (! get_dev_node(wd, dev_node,
-                                                        CHR_DEV))
-                                        snprintf(dev_node, sizeof(dev_node),
-                                                 "-");
-                                printf("%s\n", dev_node);
-                        }
-                }
-                else
-                        printf("-\n");
-        }
+        if (op->generic)
+                out_printf("%s\n", rp->sg_ok ? rp->sg_node : "-");
         if (op->long_opt > 0)
-                longer_d_entry(buff, devname, op);
+                longer_d_entry(rp, sc, op);
         if (op->verbose)
-                printf("  dir: %s\n", buff);
+                out_printf("  dir: %s\n", rp->dir);
 }
 
 static void
@@ -3258,322 +5977,448 @@ tag_lun(const uint8_t * lunp, int * tag_arr)
         }
 }
 
-/* List one SCSI device (LU) on a line. */
+/* Puts the --columns form of the size in 'size' (512 byte blocks) and
+ * 'lbs_s' (logical block size), either NULL if not read, into b . */
+static const char *
+size_col_str(int col, const char * size, const char * lbs_s,
+             const struct lsscsi_opts * op, char * b, int blen)
+{
+        int lbs;
+        uint64_t blk512s;
+
+        if (NULL == size)
+                return "-";
+        blk512s = atoll(size);
+        lbs = lbs_s ? atoi(lbs_s) : 512;
+        if (COL_LBS == col)
+                snprintf(b, blen, "%d", lbs);
+        else if (COL_BLOCKS == col)
+                snprintf(b, blen, "%" PRIu64, (lbs > 0) ?
+                         ((blk512s << 9) / lbs) : blk512s);
+        else if (! ((blk512s > 0) &&
+                    size2string(blk512s << 9, (2 == op->ssize) ?
+                                STRING_UNITS_2 : STRING_UNITS_10, b, blen)))
+                return "-";
+        return b;
+}
+
+/* Removes trailing spaces from b and returns it */
+static char *
+trim_trailing(char * b)
+{
+        int n;
+
+        for (n = strlen(b); (n > 0) && (' ' == b[n - 1]); --n)
+                b[n - 1] = '\0';
+        return b;
+}
+
+/* Outputs 'val' for the k-th of the --columns , padded to its width
+ * except for the last one */
 static void
-one_sdev_entry(const char * dir_name, const char * devname,
-               const struct lsscsi_opts * op)
+col_render(int k, const char * val, const struct lsscsi_opts * op)
 {
-        bool get_wwn = false;
-        int type, n, vlen;
+        const struct col_plan * pp = &op->plan;
+
+        if ((k + 1) < pp->num_cols)
+                out_field(val, col_defs[pp->cols[k]].width);
+        else {
+                out_puts(val);
+                out_write("\n", 1);
+        }
+}
+
+/* Returns the text of column 'col' for a SCSI device, which may be put
+ * in b . A value that is not available is "-". */
+static const char *
+sdev_col_str(const struct sdev_rec * rp, int col,
+             const struct lsscsi_opts * op, char * b, int blen)
+{
+        int n;
+        const struct encl_slot * esp;
+
+        switch (col) {
+        case COL_HCTL:
+                if (op->lunhex && rp->hctl_ok) {
+                        char bb[80];
+
+                        snprintf(b, blen, "[%s]", tuple2string(&rp->hctl,
+                                 0xf | ((1 == op->lunhex) ? 0x10 : 0x20),
+                                 sizeof(bb), bb));
+                } else
+                        snprintf(b, blen, "[%s]", rp->devname);
+                return b;
+        case COL_TYPE:
+                if (rp->type_err)
+                        return "-";
+                my_strcopy(b, scsi_short_device_types[rp->type], blen);
+                return trim_trailing(b);
+        case COL_PDT:
+                if (rp->type_err)
+                        return "-1";
+                snprintf(b, blen, "0x%x", rp->type);
+                return b;
+        case COL_VENDOR:
+        case COL_MODEL:
+        case COL_REV:
+        case COL_STATE:
+        case COL_QUEUE_DEPTH:
+        case COL_SCSI_LEVEL:
+        case COL_DEVICE_BLOCKED:
+        case COL_TIMEOUT:
+        case COL_IOCOUNTERBITS:
+        case COL_IODONE_CNT:
+        case COL_IOERR_CNT:
+        case COL_IOREQUEST_CNT:
+        case COL_QUEUE_TYPE:
+                for (n = 0; n < SDEV_NUM_ATTRS; ++n) {
+                        if (SA_BIT(n) == col_defs[col].sdev_attrs)
+                                break;
+                }
+                return ((n < SDEV_NUM_ATTRS) && (rp->attr_ok & SA_BIT(n))) ?
+                       rp->attr_val[n] : "-";
+        case COL_TRANSPORT:
+                return rp->tport_ok ? rp->tport : "-";
+        case COL_LU_NAME:
+                return rp->lu_name[0] ? rp->lu_name : "-";
+        case COL_WWN:
+                return rp->wwn_ok ? rp->wwn : "-";
+        case COL_NODE:
+                if (SN_FOUND != rp->node)
+                        return "-";
+                my_strcopy(b, rp->dev_node, blen);
+                return trim_trailing(b);
+        case COL_DEV:
+                return rp->dev_ok ? rp->dev : "-";
+        case COL_SCSI_ID:
+                return rp->scsi_id ? rp->scsi_id : "-";
+        case COL_SG:
+                return rp->sg_ok ? rp->sg_node : "-";
+        case COL_SG_DEV:
+                return rp->sg_dev_ok ? rp->sg_dev : "-";
+        case COL_PROTECTION:
+                if ((! rp->prot_type_ok) || ('0' == rp->prot_type[0]))
+                        return "-";
+                snprintf(b, blen, "DIF/Type%s", rp->prot_type);
+                return b;
+        case COL_INTEGRITY:
+                return rp->integrity_ok ? rp->integrity : "-";
+        case COL_PROTMODE:
+                return (rp->protmode_ok && strcmp(rp->protmode, "none")) ?
+                       rp->protmode : "-";
+        case COL_ENCLOSURE:
+                esp = rp->esp;
+                if (NULL == esp)
+                        return "-";
+                snprintf(b, blen, "%s,%s",
+                         esp->encl_id[0] ? esp->encl_id : esp->encl_name,
+                         esp->slot[0] ? esp->slot : esp->component);
+                return b;
+        case COL_SIZE:
+        case COL_BLOCKS:
+        case COL_LBS:
+                return size_col_str(col, rp->size_ok ? rp->size : NULL,
+                                    rp->lbs_ok ? rp->lbs : NULL, op, b,
+                                    blen);
+        default:
+                return "-";
+        }
+}
+
+/* Outputs a SCSI device (LU) on a line, then any --long lines */
+static void
+sdev_render(const struct sdev_rec * rp, struct scan_ctx * sc,
+            const struct lsscsi_opts * op)
+{
+        int k, n, vlen;
         int devname_len = 13;
-        char buff[LMAX_DEVPATH];
-        char extra[LMAX_DEVPATH];
         char value[LMAX_NAME];
-        char wd[LMAX_PATH];
-        struct addr_hctl hctl;
 
-        if (op->classic) {
-                one_classic_sdev_entry(dir_name, devname, op);
-                return;
-        }
         vlen = sizeof(value);
-        snprintf(buff, sizeof(buff), "%s/%s", dir_name, devname);
-        if (op->lunhex && parse_colon_list(devname, &hctl)) {
+        if (op->plan.num_cols > 0) {
+                for (k = 0; k < op->plan.num_cols; ++k)
+                        col_render(k, sdev_col_str(rp, op->plan.cols[k], op,
+                                                   value, vlen), op);
+                goto long_lines;
+        }
+        if (op->lunhex && rp->hctl_ok) {
                 int sel_mask = 0xf;
                 char b[80];
 
                 sel_mask |= (1 == op->lunhex) ? 0x10 : 0x20;
                 snprintf(value, vlen, "[%s]",
-                         tuple2string(&hctl, sel_mask, sizeof(b), b));
+                         tuple2string(&rp->hctl, sel_mask, sizeof(b), b));
                 devname_len = 28;
         } else
-                snprintf(value, vlen, "[%s]", devname);
+                snprintf(value, vlen, "[%s]", rp->devname);
 
-        if ((int)strlen(value) >= devname_len)
-                 printf("%s ", value);  /* if very long, append a space */
-        else /* left justified with field length of devname_len */
-                printf("%-*s", devname_len, value);
+        if ((int)strlen(value) >= devname_len) {
+                out_puts(value);        /* if very long, append a space */
+                out_write(" ", 1);
+        } else /* left justified with field length of devname_len */
+                out_pad(value, devname_len);
         if (op->pdt) {
                 char b[16];
 
-                if (get_value(buff, "type", value, vlen) &&
-                    (1 == sscanf(value, "%d", &type)) &&
-                    (type >= 0) && (type < 32))
-                        snprintf(b, sizeof(b), "0x%x", type);
+                if (0 == rp->type_err)
+                        snprintf(b, sizeof(b), "0x%x", rp->type);
                 else
                         snprintf(b, sizeof(b), "-1");
-                printf("%-8s", b);
+                out_pad(b, 8);
         } else if (op->brief)
                 ;
-        else if (! get_value(buff, "type", value, vlen)) {
-                printf("type?   ");
-        } else if (1 != sscanf(value, "%d", &type)) {
-                printf("type??  ");
-        } else if ((type < 0) || (type > 31)) {
-                printf("type??? ");
-        } else
-                printf("%s ", scsi_short_device_types[type]);
+        else if (1 == rp->type_err)
+                out_puts("type?   ");
+        else if (2 == rp->type_err)
+                out_puts("type??  ");
+        else if (3 == rp->type_err)
+                out_puts("type??? ");
+        else {
+                out_puts(scsi_short_device_types[rp->type]);
+                out_write(" ", 1);
+        }
 
-        if (op->wwn)
-                get_wwn = true;
         if (op->transport_info) {
-                if (transport_tport(devname, op, vlen, value))
-                        printf("%-30s  ", value);
+                if (rp->tport_ok)
+                        out_field(rp->tport, 30);
                 else
-                        printf("                                ");
+                        out_puts("                                ");
         } else if (op->unit) {
-                get_lu_name(devname, value, vlen, op->unit > 3);
+                my_strcopy(value, rp->lu_name, vlen);
                 n = strlen(value);
                 if (n < 1)      /* left justified "none" means no lu name */
-                        printf("%-32s  ", "none");
+                        out_printf("%-32s  ", "none");
                 else if (1 == op->unit) {
                         if (n < 33)
-                                printf("%-32s  ", value);
+                                out_printf("%-32s  ", value);
                         else {
                                 value[32] = '_';
                                 value[33] = ' ';
                                 value[34] = '\0';
-                                printf("%-34s", value);
+                                out_printf("%-34s", value);
                         }
                 } else if (2 == op->unit) {
                         if (n < 33)
-                                printf("%-32s  ", value);
+                                out_printf("%-32s  ", value);
                         else {
                                 value[n - 32] = '_';
-                                printf("%-32s  ", value + n - 32);
+                                out_printf("%-32s  ", value + n - 32);
                         }
                 } else     /* -uuu, output in full, append rest of line */
-                        printf("%-s  ", value);
+                        out_printf("%-s  ", value);
         } else if (! op->brief) {
-                if (get_value(buff, "vendor", value, vlen))
-                        printf("%-8s ", value);
-                else
-                        printf("vendor?  ");
+                if (rp->attr_ok & SA_BIT(SA_VENDOR)) {
+                        out_pad(rp->attr_val[SA_VENDOR], 8);
+                        out_write(" ", 1);
+                } else
+                        out_puts("vendor?  ");
 
-                if (get_value(buff, "model", value, vlen))
-                        printf("%-16s ", value);
-                else
-                        printf("model?           ");
+                if (rp->attr_ok & SA_BIT(SA_MODEL)) {
+                        out_pad(rp->attr_val[SA_MODEL], 16);
+                        out_write(" ", 1);
+                } else
+                        out_puts("model?           ");
 
-                if (get_value(buff, "rev", value, vlen))
-                        printf("%-4s  ", value);
+                if (rp->attr_ok & SA_BIT(SA_REV))
+                        out_field(rp->attr_val[SA_REV], 4);
                 else
-                        printf("rev?  ");
+                        out_puts("rev?  ");
         }
 
-        if (1 == non_sg_scan(buff, op)) {
-                if (DT_DIR == non_sg.d_type) {
-                        snprintf(wd, sizeof(wd), "%s/%s", buff, non_sg.name);
-                        if (1 == scan_for_first(wd, op))
-                                my_strcopy(extra, aa_first.name,
-                                           sizeof(extra));
-                        else {
-                                printf("unexpected scan_for_first error");
-                                wd[0] = '\0';
-                        }
-                } else {
-                        my_strcopy(wd, buff, sizeof(wd));
-                        my_strcopy(extra, non_sg.name, sizeof(extra));
-                }
-                if (wd[0] && (if_directory_chdir(wd, extra))) {
-                        if (NULL == getcwd(wd, sizeof(wd))) {
-                                printf("getcwd error");
-                                wd[0] = '\0';
-                        }
+        if (SN_SCAN_ERR == rp->node)
+                out_puts("unexpected scan_for_first error");
+        else if (SN_FOUND == rp->node) {
+                if (op->wwn) {
+                        if (rp->wwn_ok)
+                                out_printf("%-*s  ", DISK_WWN_MAX_LEN - 1,
+                                           rp->wwn);
+                        else
+                                out_puts("                                ");
                 }
-                if (wd[0]) {
-                        char dev_node[LMAX_NAME] = "";
-                        char wwn_str[DISK_WWN_MAX_LEN];
-                        enum dev_type typ;
-
-                        typ = (FT_BLOCK == non_sg.ft) ? BLK_DEV : CHR_DEV;
-                        if (get_wwn) {
-                                if ((BLK_DEV == typ) &&
-                                    get_disk_wwn(wd, wwn_str, sizeof(wwn_str)))
-                                        printf("%-*s  ", DISK_WWN_MAX_LEN - 1,
-                                               wwn_str);
-                                else
-                                        printf("                          "
-                                               "      ");
-
-                        }
-                        if (op->kname)
-                                snprintf(dev_node, sizeof(dev_node), "%s/%s",
-                                        dev_dir, basename(wd));
-                        else if (! get_dev_node(wd, dev_node, typ))
-                                snprintf(dev_node, sizeof(dev_node),
-                                         "-       ");
-
-                        printf("%-9s", dev_node);
-                        if (op->dev_maj_min) {
-                                if (get_value(wd, "dev", value, vlen))
-                                        printf("[%s]", value);
-                                else
-                                        printf("[dev?]");
-                        }
-
-                        if (op->scsi_id) {
-                                char *scsi_id;
-
-                                scsi_id = get_disk_scsi_id(dev_node);
-                                printf("  %s", scsi_id ? scsi_id : "-");
-                                free(scsi_id);
-                        }
+                out_pad(rp->dev_node, 9);
+                if (op->dev_maj_min) {
+                        if (rp->dev_ok)
+                                out_printf("[%s]", rp->dev);
+                        else
+                                out_puts("[dev?]");
                 }
+                if (op->scsi_id)
+                        out_printf("  %s", rp->scsi_id ? rp->scsi_id : "-");
         } else {
-                if (get_wwn)
-                        printf("                                ");
+                if (op->wwn)
+                        out_puts("                                ");
                 if (op->scsi_id)
-                        printf("%-9s  -", "-");
+                        out_printf("%-9s  -", "-");
                 else
-                        printf("%-9s", "-");
+                        out_printf("%-9s", "-");
         }
 
         if (op->generic) {
-                if (if_directory_ch2generic(buff)) {
-                        if (NULL == getcwd(wd, sizeof(wd)))
-                                printf("  generic_dev error");
-                        else {
-                                char dev_node[LMAX_NAME] = "";
-
-                                if (op->kname)
-                                        snprintf(dev_node, sizeof(dev_node),
-                                                 "%s/%s", dev_dir,
-                                                 basename(wd));
-                                else if (! get_dev_node(wd, dev_node,
-                                                        CHR_DEV))
-                                        snprintf(dev_node, sizeof(dev_node),
-                                                 "-");
-                                printf("  %-9s", dev_node);
-                                if (op->dev_maj_min) {
-                                        if (get_value(wd, "dev", value,
-                                                      sizeof(value)))
-                                                printf("[%s]", value);
-                                        else
-                                                printf("[dev?]");
-                                }
+                if (rp->sg_ok) {
+                        out_printf("  %-9s", rp->sg_node);
+                        if (op->dev_maj_min) {
+                                if (rp->sg_dev_ok)
+                                        out_printf("[%s]", rp->sg_dev);
+                                else
+                                        out_puts("[dev?]");
                         }
-                }
-                else
-                        printf("  %-9s", "-");
+                } else
+                        out_printf("  %-9s", "-");
         }
 
         if (op->protection) {
-                char sddir[LMAX_DEVPATH];
-                char blkdir[LMAX_DEVPATH];
-
-                my_strcopy(sddir,  buff, sizeof(sddir));
-                my_strcopy(blkdir, buff, sizeof(blkdir));
-
-                if (sd_scan(sddir) &&
-                    if_directory_chdir(sddir, ".") &&
-                    get_value(".", "protection_type", value, sizeof(value))) {
-
-                        if (!strncmp(value, "0", 1))
-                                printf("  %-9s", "-");
+                if (rp->prot_type_ok) {
+                        if (!strncmp(rp->prot_type, "0", 1))
+                                out_printf("  %-9s", "-");
                         else
-                                printf("  DIF/Type%1s", value);
-
+                                out_printf("  DIF/Type%1s", rp->prot_type);
                 } else
-                        printf("  %-9s", "-");
+                        out_printf("  %-9s", "-");
 
-                if (block_scan(blkdir) &&
-                    if_directory_chdir(blkdir, "integrity") &&
-                    get_value(".", "format", value, sizeof(value)))
-                        printf("  %-16s", value);
+                if (rp->integrity_ok)
+                        out_printf("  %-16s", rp->integrity);
                 else
-                        printf("  %-16s", "-");
+                        out_printf("  %-16s", "-");
         }
 
         if (op->protmode) {
-                char sddir[LMAX_DEVPATH];
-
-                my_strcopy(sddir, buff, sizeof(sddir));
+                if (rp->protmode_ok && strcmp(rp->protmode, "none"))
+                        out_printf("  %-4s", rp->protmode);
+                else
+                        out_printf("  %-4s", "-");
+        }
 
-                if (sd_scan(sddir) &&
-                    if_directory_chdir(sddir, ".") &&
-                    get_value(sddir, "protection_mode", value,
-                              sizeof(value))) {
+        if (op->enclosure) {
+                const struct encl_slot * esp = rp->esp;
 
-                        if (!strcmp(value, "none"))
-                                printf("  %-4s", "-");
-                        else
-                                printf("  %-4s", value);
+                if (esp) {
+                        snprintf(value, vlen, "%s,%s",
+                                 esp->encl_id[0] ? esp->encl_id :
+                                                   esp->encl_name,
+                                 esp->slot[0] ? esp->slot : esp->component);
+                        out_printf("  %-22s", value);
                 } else
-                        printf("  %-4s", "-");
+                        out_printf("  %-22s", "-");
         }
 
-        if (op->ssize) {
-                uint64_t blk512s;
-                char blkdir[LMAX_DEVPATH];
+        if (op->ssize)
+                size_render(rp->size_ok ? rp->size : NULL,
+                            rp->lbs_ok ? rp->lbs : NULL, op);
+        out_write("\n", 1);
+long_lines:
+        if (op->long_opt > 0)
+                longer_d_entry(rp, sc, op);
+        if (op->verbose > 0)
+                out_printf("  dir: %s  [%s]\n", rp->dir,
+                           rp->resolved_ok ? rp->resolved : "");
+}
 
-                my_strcopy(blkdir, buff, sizeof(blkdir));
-                value[0] = 0;
-                if (! ((0 == type) && block_scan(blkdir) &&
-                       if_directory_chdir(blkdir, ".") &&
-                       get_value(".", "size", value, vlen)) ) {
-                        printf("  %6s", "-");
-                        goto fini_line;
-                }
-                blk512s = atoll(value);
-
-                if (op->ssize > 2) {
-                        int lbs = 0;
-                        char bb[32];
-
-                        if (get_value(".", "queue/logical_block_size", bb,
-                                      sizeof(bb))) {
-                                lbs = atoi(bb);
-                                if (lbs < 1)
-                                        printf("  %12s,[lbs<1 ?]", value);
-                                else if (512 == lbs)
-                                        printf("  %12s%s", value,
-                                               (op->ssize > 3) ? ",512" : "");
-                                else {
-                                        int64_t byts = 512 * blk512s;
-
-                                        snprintf(value, vlen, "%" PRId64,
-                                                 (byts / lbs));
-                                        if (op->ssize > 3)
-                                                printf("  %12s,%d", value,
-                                                       lbs);
-                                        else
-                                                printf("  %12s", value);
-                                }
-                        } else
-                                printf("  %12s,512", value);
-                } else {
-                        enum string_size_units unit_val = (0x1 & op->ssize) ?
-                                         STRING_UNITS_10 : STRING_UNITS_2;
+/* Outputs "key":{...} holding the attributes in 'idxs' (terminated by -1)
+ * that could be read */
+static void
+sdev_json_attrs(const struct sdev_rec * rp, const char * key,
+                const int * idxs)
+{
+        int k;
 
-                        blk512s <<= 9;
-                        if (blk512s > 0 &&
-                            size2string(blk512s, unit_val, value, vlen))
-                                printf("  %6s", value);
-                        else
-                                printf("  %6s", "-");
-                }
+        json_obj_begin(key);
+        for (k = 0; idxs[k] >= 0; ++k) {
+                if (rp->attr_ok & SA_BIT(idxs[k]))
+                        json_str(sdev_attrs[idxs[k]],
+                                 rp->attr_val[idxs[k]]);
         }
+        json_obj_end();
+}
 
-fini_line:
-        printf("\n");
-        if (op->long_opt > 0)
-                longer_d_entry(buff, devname, op);
-        if (op->verbose > 0) {
-                printf("  dir: %s  [", buff);
-                if (if_directory_chdir(buff, "")) {
-                        if (NULL == getcwd(wd, sizeof(wd)))
-                                printf("?");
-                        else
-                                printf("%s", wd);
+/* Outputs a SCSI device (LU) as a --json record. The members are the
+ * same for every device (and NVMe namespace), null if not available. */
+static void
+sdev_json_render(const struct sdev_rec * rp, const struct lsscsi_opts * op)
+{
+        bool ok;
+        int n;
+        const struct encl_slot * esp;
+        char b[LMAX_NAME];
+
+        json_rec_begin(op);
+        json_str("hctl", rp->devname);
+        json_num("host", rp->hctl_ok, rp->hctl.h);
+        json_num("channel", rp->hctl_ok, rp->hctl.c);
+        json_num("target", rp->hctl_ok, rp->hctl.t);
+        json_num("lun", rp->hctl_ok, (int64_t)rp->hctl.l);
+        if (rp->hctl_ok)
+                snprintf(b, sizeof(b), "0x%016" PRIx64,
+                         lun_word_flip(rp->hctl.l));
+        json_str("lun_hex", rp->hctl_ok ? b : NULL);
+        json_num("nsid", false, 0);
+        if (0 == rp->type_err) {
+                my_strcopy(b, scsi_short_device_types[rp->type], sizeof(b));
+                trim_trailing(b);
+        }
+        json_str("type", (0 == rp->type_err) ? b : NULL);
+        json_num("pdt", (0 == rp->type_err), rp->type);
+        for (n = SA_VENDOR; n <= SA_REV; ++n) {
+                ok = !! (rp->attr_ok & SA_BIT(n));
+                if (ok) {
+                        my_strcopy(b, rp->attr_val[n], sizeof(b));
+                        trim_trailing(b);
                 }
-                printf("]\n");
+                json_str(sdev_attrs[n], ok ? b : NULL);
+        }
+        ok = (SN_FOUND == rp->node) && ('-' != rp->dev_node[0]);
+        json_str("device", ok ? rp->dev_node : NULL);
+        json_str("maj_min", (SN_FOUND == rp->node) && rp->dev_ok ?
+                            rp->dev : NULL);
+        json_str("generic", rp->sg_ok && ('-' != rp->sg_node[0]) ?
+                            rp->sg_node : NULL);
+        json_str("generic_maj_min", rp->sg_dev_ok ? rp->sg_dev : NULL);
+        json_str("wwn", rp->wwn_ok ? rp->wwn : NULL);
+        json_str("lu_name", rp->lu_name[0] ? rp->lu_name : NULL);
+        json_str("scsi_id", rp->scsi_id);
+        json_str("transport_type", rp->tport_ok ?
+                                   transport_names[rp->transport_id] : NULL);
+        json_str("transport", rp->tport_ok ? rp->tport : NULL);
+        json_num_str("size_bytes", rp->size_ok, rp->size, 512);
+        json_num_str("logical_block_size", rp->lbs_ok, rp->lbs, 1);
+        json_num_str("protection_type", rp->prot_type_ok, rp->prot_type, 1);
+        json_str("integrity", rp->integrity_ok ? rp->integrity : NULL);
+        json_str("protection_mode", rp->protmode_ok ? rp->protmode : NULL);
+        esp = rp->esp;
+        if (esp) {
+                json_str("enclosure", esp->encl_id[0] ? esp->encl_id :
+                                                        esp->encl_name);
+                json_str("enclosure_slot", esp->slot[0] ? esp->slot :
+                                                          esp->component);
+        } else {
+                json_str("enclosure", NULL);
+                json_str("enclosure_slot", NULL);
         }
+        sdev_json_attrs(rp, "attributes", sdev_list_attrs);
+        json_rec_end();
+}
+
+/* List one SCSI device (LU): collect what is to be output, then output
+ * it in the style the options ask for. */
+static void
+one_sdev_entry(const char * dir_name, const char * devname,
+               struct scan_ctx * sc, const struct lsscsi_opts * op)
+{
+        struct sdev_rec rec;
+
+        collect_sdev(dir_name, devname, sc, op, &rec);
+        if (op->json)
+                sdev_json_render(&rec, op);
+        else if (op->classic)
+                classic_sdev_render(&rec, sc, op);
+        else
+                sdev_render(&rec, sc, op);
+        free_sdev_rec(&rec);
 }
 
 static int
-sdev_dir_scan_select(const struct dirent * s)
+sdev_dir_scan_select(const struct dirent * s, void * ctx)
 {
+        const struct lsscsi_opts * op = (const struct lsscsi_opts *)ctx;
 /* Following no longer needed but leave for early lk 2.6 series */
         if (strstr(s->d_name, "mt"))
                 return 0;       /* st auxiliary device names */
@@ -3587,18 +6432,19 @@ sdev_dir_scan_select(const struct dirent * s)
         if (!strncmp(s->d_name, "target", 6)) /* SCSI target */
                 return 0;
         if (strchr(s->d_name, ':')) {
-                if (filter_active) {
+                if (op->filter_active) {
+                        const struct addr_hctl * fp = &op->filter;
                         struct addr_hctl s_hctl;
 
                         if (! parse_colon_list(s->d_name, &s_hctl)) {
                                 pr2serr("%s: parse failed\n", __func__);
                                 return 0;
                         }
-                        if (((-1 == filter.h) || (s_hctl.h == filter.h)) &&
-                            ((-1 == filter.c) || (s_hctl.c == filter.c)) &&
-                            ((-1 == filter.t) || (s_hctl.t == filter.t)) &&
-                            ((UINT64_LAST == filter.l) ||
-                             (s_hctl.l == filter.l)))
+                        if (((-1 == fp->h) || (s_hctl.h == fp->h)) &&
+                            ((-1 == fp->c) || (s_hctl.c == fp->c)) &&
+                            ((-1 == fp->t) || (s_hctl.t == fp->t)) &&
+                            ((UINT64_LAST == fp->l) ||
+                             (s_hctl.l == fp->l)))
                                 return 1;
                         else
                                 return 0;
@@ -3611,30 +6457,231 @@ sdev_dir_scan_select(const struct dirent * s)
 
 #if (HAVE_NVME && (! IGNORE_NVME))
 
-/* List one NVMe namespace (NS) on a line. */
+/* Attributes of an NVMe controller that are output for each of its
+ * namespaces. Each one is read when first needed and then reused for the
+ * rest of that controller's namespaces. */
+struct nvme_ctl {
+        const char * dir;       /* <sysfsroot>/class/nvme/nvme<n> */
+        int cntlid_state;       /* 0: not read, 1: ok, 2: undecoded, -1: no */
+        int cntlid;
+        bool model_read;
+        bool rev_read;
+        bool tport_read;
+        int model_len;          /* after trimming */
+        char cntlid_s[LMAX_NAME];
+        char model[48];
+        char rev[LMAX_NAME];    /* firmware_rev, empty if none */
+        char tport[LMAX_NAME];  /* as output for --transport */
+};
+
 static void
-one_ndev_entry(const char * nvme_ctl_abs, const char * nvme_ns_rel,
-               const struct lsscsi_opts * op)
+nvme_ctl_init(struct nvme_ctl * ncp, const char * nvme_ctl_abs)
 {
-        int n, m;
+        memset(ncp, 0, sizeof(*ncp));
+        ncp->dir = nvme_ctl_abs;
+}
+
+static void
+nvme_ctl_cntlid(struct nvme_ctl * ncp)
+{
+        if (0 != ncp->cntlid_state)
+                return;
+        if (! get_value(ncp->dir, "cntlid", ncp->cntlid_s,
+                        sizeof(ncp->cntlid_s)))
+                ncp->cntlid_state = -1;
+        else if (1 == sscanf(ncp->cntlid_s, "%d", &ncp->cntlid))
+                ncp->cntlid_state = 1;
+        else
+                ncp->cntlid_state = 2;
+}
+
+static const char *
+nvme_ctl_model(struct nvme_ctl * ncp)
+{
+        if (! ncp->model_read) {
+                ncp->model_read = true;
+                if (! get_value(ncp->dir, "model", ncp->model,
+                                sizeof(ncp->model)))
+                        snprintf(ncp->model, sizeof(ncp->model), "-    ");
+                ncp->model_len = trim_lead_trail(ncp->model, true, true);
+        }
+        return ncp->model;
+}
+
+static const char *
+nvme_ctl_rev(struct nvme_ctl * ncp)
+{
+        if (! ncp->rev_read) {
+                ncp->rev_read = true;
+                if (get_value(ncp->dir, "firmware_rev", ncp->rev,
+                              sizeof(ncp->rev)))
+                        trim_lead_trail(ncp->rev, true, true);
+                else
+                        ncp->rev[0] = '\0';
+        }
+        return ncp->rev;
+}
+
+/* The transport of a PCIe controller is followed by the subsystem vendor
+ * and device ids of the PCI function. */
+static const char *
+nvme_ctl_transport(struct nvme_ctl * ncp)
+{
+        const int tlen = sizeof(ncp->tport);
+        char b[80];
+        char bb[80];
+
+        if (ncp->tport_read)
+                return ncp->tport;
+        ncp->tport_read = true;
+        if (! get_value(ncp->dir, "transport", ncp->tport, tlen))
+                snprintf(ncp->tport, tlen, "transport?");
+        else if (0 == strcmp("pcie" , ncp->tport)) {
+                if (get_value(ncp->dir, "device/subsystem_vendor", b,
+                              sizeof(b)) &&
+                    get_value(ncp->dir, "device/subsystem_device", bb,
+                              sizeof(bb)))
+                        snprintf(ncp->tport, tlen, "pcie %s:%s", b, bb);
+                else
+                        snprintf(ncp->tport, tlen, "transport?");
+        }
+        return ncp->tport;
+}
+
+/* Attributes in a NVMe namespace directory that may be output */
+enum ndev_attr_idx {
+        NA_WWID = 0,
+        NA_DEV,
+        NA_SIZE,
+        NA_CAPABILITY,
+        NA_EXT_RANGE,
+        NA_HIDDEN,
+        NA_NSID,
+        NA_RANGE,
+        NA_REMOVABLE,
+        NA_NR_REQUESTS,
+        NA_READ_AHEAD_KB,
+        NA_WRITE_CACHE,
+        NA_LOGICAL_BLOCK_SIZE,
+        NA_PHYSICAL_BLOCK_SIZE,
+        NDEV_NUM_ATTRS,
+};
+
+/* Relative to the namespace's directory; --long shows the basename */
+static const char * ndev_attrs[NDEV_NUM_ATTRS] = {
+        "wwid", "dev", "size", "capability", "ext_range", "hidden", "nsid",
+        "range", "removable", "queue/nr_requests", "queue/read_ahead_kb",
+        "queue/write_cache", "queue/logical_block_size",
+        "queue/physical_block_size",
+};
+
+#define NA_BIT(idx) (1U << (idx))
+
+/* All that is output for one NVMe namespace, collected by collect_ndev()
+ * and output by ndev_render() and longer_nd_entry(). Attributes of its
+ * controller are in the controller's record. */
+struct ndev_rec {
+        struct nvme_ctl * ncp;
+        struct addr_hctl hctl;          /* N:<ctl>:<cntlid>:<nsid> */
+        uint32_t nsid;
+        uint32_t attr_ok;               /* NA_BIT() of each one read */
+        bool resolved_ok;               /* --verbose */
+        /* strings from here on, only valid as flagged above */
+        char name[LMAX_NAME];           /* e.g. "nvme0n1" */
+        char dir[LMAX_DEVPATH];
+        char attr_val[NDEV_NUM_ATTRS][LMAX_NAME];
+        char dev_node[LMAX_NAME + 16];
+        char resolved[LMAX_PATH];
+};
+
+/* Value of attribute 'idx' or "?" if it could not be read */
+static const char *
+ndev_rec_attr(const struct ndev_rec * rp, int idx)
+{
+        return (rp->attr_ok & NA_BIT(idx)) ? rp->attr_val[idx] : "?";
+}
+
+/* Works out what is to be read for each NVMe namespace from the options,
+ * as plan_sdev() does for SCSI devices. */
+static void
+plan_ndev(struct lsscsi_opts * op)
+{
+        int k, col;
+        struct col_plan * pp = &op->plan;
+
+        pp->nvme_need = 0;
+        pp->ndev_attrs = 0;
+        for (k = 0; k < pp->num_cols; ++k) {
+                col = pp->cols[k];
+                if (COL_MODEL == col)
+                        pp->nvme_need |= PLAN_CTL_MODEL;
+                else if (COL_TRANSPORT == col)
+                        pp->nvme_need |= PLAN_TPORT;
+                else if ((COL_LU_NAME == col) || (COL_WWN == col))
+                        pp->ndev_attrs |= NA_BIT(NA_WWID);
+                else if (COL_NODE == col)
+                        pp->nvme_need |= PLAN_NODE;
+                else if (COL_DEV == col) {
+                        pp->nvme_need |= PLAN_NODE;
+                        pp->ndev_attrs |= NA_BIT(NA_DEV);
+                } else if (COL_SIZE == col)
+                        pp->ndev_attrs |= NA_BIT(NA_SIZE);
+                else if ((COL_BLOCKS == col) || (COL_LBS == col))
+                        pp->ndev_attrs |= NA_BIT(NA_SIZE) |
+                                          NA_BIT(NA_LOGICAL_BLOCK_SIZE);
+        }
+        if (0 == pp->num_cols) {
+                pp->nvme_need = PLAN_NODE;
+                if (op->wwn || (op->unit && ! op->transport_info))
+                        pp->ndev_attrs |= NA_BIT(NA_WWID);
+                else if (op->transport_info)
+                        pp->nvme_need |= PLAN_TPORT;
+                else if (! op->brief)
+                        pp->nvme_need |= PLAN_CTL_MODEL;
+                if (op->dev_maj_min)
+                        pp->ndev_attrs |= NA_BIT(NA_DEV);
+                if (op->ssize) {
+                        pp->ndev_attrs |= NA_BIT(NA_SIZE);
+                        if (op->ssize > 2)
+                                pp->ndev_attrs |=
+                                        NA_BIT(NA_LOGICAL_BLOCK_SIZE);
+                }
+        }
+        if (op->json) {         /* all members, as plan_sdev() */
+                pp->nvme_need |= PLAN_NODE | PLAN_TPORT | PLAN_CTL_MODEL;
+                pp->ndev_attrs |= ~0U >> (32 - NDEV_NUM_ATTRS);
+                return;
+        }
+        if (op->long_opt > 0) {
+                for (k = NA_CAPABILITY; k <= NA_REMOVABLE; ++k)
+                        pp->ndev_attrs |= NA_BIT(k);
+                if (op->long_opt > 1) {
+                        for ( ; k < NDEV_NUM_ATTRS; ++k)
+                                pp->ndev_attrs |= NA_BIT(k);
+                }
+        }
+        if (op->verbose > 0)
+                pp->nvme_need |= PLAN_RESOLVED;
+}
+
+/* Fills in *rp with what the options ask to be output about the NVMe
+ * namespace 'nvme_ns_rel' of the controller in ncp . Returns false if
+ * the namespace does not meet the filter (on cntlid). */
+static bool
+collect_ndev(struct nvme_ctl * ncp, const char * nvme_ns_rel,
+             const struct lsscsi_opts * op, struct ndev_rec * rp)
+{
+        int k;
         int cdev_minor = 0;
         int cntlid = 0;
         int vb = op->verbose;
-        int devname_len = 13;
-        int sel_mask = 0xf;
-        uint32_t nsid = 0;
+        uint32_t need = op->plan.nvme_need;
         char * cp;
-        char buff[LMAX_DEVPATH];
-        char value[LMAX_NAME];
-        char dev_node[LMAX_NAME + 16] = "";
-        char wd[LMAX_PATH];
-        char devname[64];
-        char ctl_model[48];
-        char b[80];
-        const int vlen = sizeof(value);
-        struct addr_hctl hctl;
 
-        snprintf(buff, sizeof(buff), "%s/%s", nvme_ctl_abs, nvme_ns_rel);
+        memset(rp, 0, offsetof(struct ndev_rec, name));
+        rp->ncp = ncp;
+        my_strcopy(rp->name, nvme_ns_rel, sizeof(rp->name));
+        snprintf(rp->dir, sizeof(rp->dir), "%s/%s", ncp->dir, nvme_ns_rel);
         if ((0 == strncmp(nvme_ns_rel, "nvme", 4)) &&
             (1 == sscanf(nvme_ns_rel + 4, "%d", &cdev_minor)))
                 ;
@@ -3642,17 +6689,19 @@ one_ndev_entry(const char * nvme_ctl_abs, const char * nvme_ns_rel,
                 pr2serr("%s: unable to find %s in %s\n", __func__,
                         "cdev_minor", nvme_ns_rel);
 
-        if (get_value(nvme_ctl_abs, "cntlid", value, vlen)) {
-                if (1 != sscanf(value, "%d", &cntlid)) {
-                        if (vb)
-                                pr2serr("%s: trying to decode: %s as "
-                                        "cntlid\n", __func__, value);
-                }
-                if (filter_active && (-1 != filter.t) && (cntlid != filter.t))
-                        return;         /* doesn't meet filter condition */
+        nvme_ctl_cntlid(ncp);
+        if (ncp->cntlid_state > 0) {
+                if (1 == ncp->cntlid_state)
+                        cntlid = ncp->cntlid;
+                else if (vb)
+                        pr2serr("%s: trying to decode: %s as cntlid\n",
+                                __func__, ncp->cntlid_s);
+                if (op->filter_active && (-1 != op->filter.t) &&
+                    (cntlid != op->filter.t))
+                        return false;   /* doesn't meet filter condition */
         } else if (vb)
                 pr2serr("%s: unable to find %s under %s\n", __func__,
-                        "cntlid", nvme_ctl_abs);
+                        "cntlid", ncp->dir);
 
 #ifdef __cplusplus
         cp = strrchr((char *)nvme_ns_rel, 'n');
@@ -3660,170 +6709,318 @@ one_ndev_entry(const char * nvme_ctl_abs, const char * nvme_ns_rel,
         cp = strrchr(nvme_ns_rel, 'n');
 #endif
         if ((NULL == cp) || ('v' == *(cp + 1)) ||
-            (1 != sscanf(cp + 1, "%u", &nsid))) {
+            (1 != sscanf(cp + 1, "%u", &rp->nsid))) {
                 if (vb)
                         pr2serr("%s: unable to find nsid in %s\n", __func__,
                                 nvme_ns_rel);
         }
-        mk_nvme_tuple(&hctl, cdev_minor, cntlid, nsid);
+        mk_nvme_tuple(&rp->hctl, cdev_minor, cntlid, rp->nsid);
+
+        if (need & PLAN_TPORT)
+                nvme_ctl_transport(ncp);
+        if (need & PLAN_CTL_MODEL)
+                nvme_ctl_model(ncp);
+        for (k = 0; k < NDEV_NUM_ATTRS; ++k) {
+                if ((op->plan.ndev_attrs & NA_BIT(k)) &&
+                    get_value(rp->dir, ndev_attrs[k], rp->attr_val[k],
+                              LMAX_NAME))
+                        rp->attr_ok |= NA_BIT(k);
+        }
+
+        if (! (need & PLAN_NODE))
+                ;
+        else if (op->kname)
+                snprintf(rp->dev_node, sizeof(rp->dev_node), "%s/%s",
+                         dev_dir, nvme_ns_rel);
+        else if (! get_dev_node(rp->dir, rp->dev_node, BLK_DEV))
+                snprintf(rp->dev_node, sizeof(rp->dev_node), "-       ");
+        if (need & PLAN_RESOLVED)
+                rp->resolved_ok = if_directory_resolve(rp->dir, "",
+                                                       rp->resolved,
+                                                       sizeof(rp->resolved));
+        return true;
+}
+
+/* NVMe longer data for namespace listing */
+static void
+longer_nd_entry(const struct ndev_rec * rp, const struct lsscsi_opts * op)
+{
+        int k;
+        bool sing = (op->long_opt > 2);
+        const char * sep = sing ? "\n" : "";
+        const char * cp;
+
+        for (k = NA_CAPABILITY; k < NDEV_NUM_ATTRS; ++k) {
+                if (NA_NR_REQUESTS == k) {
+                        if (op->long_opt < 2)
+                                break;
+                        if (! sing)
+                                out_printf("\n");
+                } else if ((NA_LOGICAL_BLOCK_SIZE == k) && (! sing))
+                        out_printf("\n");
+                cp = strrchr(ndev_attrs[k], '/');
+                out_printf("  %s=%s%s", cp ? cp + 1 : ndev_attrs[k],
+                           ndev_rec_attr(rp, k), sep);
+        }
+        if (! sing)
+                out_printf("\n");
+}
+
+/* Returns the text of column 'col' for a NVMe namespace, as
+ * sdev_col_str() does for a SCSI device */
+static const char *
+ndev_col_str(const struct ndev_rec * rp, int col,
+             const struct lsscsi_opts * op, char * b, int blen)
+{
+        const char * cp;
+
+        switch (col) {
+        case COL_HCTL:
+        {
+                char bb[80];
+
+                snprintf(b, blen, "[%s]", tuple2string(&rp->hctl,
+                         0xf | (op->lunhex ? ((1 == op->lunhex) ? 0x10 :
+                                              0x20) : 0),
+                         sizeof(bb), bb));
+                return b;
+        }
+        case COL_TYPE:
+                return "disk";
+        case COL_PDT:
+                return "0x0";
+        case COL_MODEL:
+                return rp->ncp->model_read ? rp->ncp->model : "-";
+        case COL_TRANSPORT:
+                return rp->ncp->tport_read ? rp->ncp->tport : "-";
+        case COL_LU_NAME:
+        case COL_WWN:
+                if (! (rp->attr_ok & NA_BIT(NA_WWID)))
+                        return "-";
+                cp = rp->attr_val[NA_WWID];
+                if ((COL_LU_NAME == col) && (op->unit < 4) &&
+                    (0 == strncmp("eui.", cp, 4)))
+                        cp += 4;
+                return cp;
+        case COL_NODE:
+                my_strcopy(b, rp->dev_node, blen);
+                return b[0] ? trim_trailing(b) : "-";
+        case COL_DEV:
+                return (rp->attr_ok & NA_BIT(NA_DEV)) ?
+                       rp->attr_val[NA_DEV] : "-";
+        case COL_SIZE:
+        case COL_BLOCKS:
+        case COL_LBS:
+                return size_col_str(col, (rp->attr_ok & NA_BIT(NA_SIZE)) ?
+                                    rp->attr_val[NA_SIZE] : NULL,
+                                    (rp->attr_ok &
+                                     NA_BIT(NA_LOGICAL_BLOCK_SIZE)) ?
+                                    rp->attr_val[NA_LOGICAL_BLOCK_SIZE] :
+                                    NULL, op, b, blen);
+        default:
+                return "-";
+        }
+}
+
+/* List one NVMe namespace (NS) on a line, then any --long lines */
+static void
+ndev_render(const struct ndev_rec * rp, const struct lsscsi_opts * op)
+{
+        int k, n, m;
+        int devname_len = 13;
+        int sel_mask = 0xf;
+        struct nvme_ctl * ncp = rp->ncp;
+        char value[LMAX_NAME];
+        char devname[64];
+        char ctl_model[48];
+        char b[80];
+        const int vlen = sizeof(value);
+
+        if (op->plan.num_cols > 0) {
+                for (k = 0; k < op->plan.num_cols; ++k)
+                        col_render(k, ndev_col_str(rp, op->plan.cols[k], op,
+                                                   value, vlen), op);
+                goto long_lines;
+        }
 
         if (op->lunhex) {
                 sel_mask |= (1 == op->lunhex) ? 0x10 : 0x20;
                 devname_len = 28;
         }
         snprintf(value, vlen, "[%s]",
-                 tuple2string(&hctl, sel_mask, sizeof(devname), devname));
+                 tuple2string(&rp->hctl, sel_mask, sizeof(devname), devname));
 
-        if ((int)strlen(value) >= devname_len)
-                printf("%s ", value);  /* if very long, append a space */
-        else /* left justified with field length of devname_len */
-                printf("%-*s", devname_len, value);
+        if ((int)strlen(value) >= devname_len) {
+                out_puts(value);        /* if very long, append a space */
+                out_write(" ", 1);
+        } else /* left justified with field length of devname_len */
+                out_pad(value, devname_len);
 
         if (op->pdt)
-                printf("%-8s", "0x0");
+                out_pad("0x0", 8);
         else if (op->brief)
                 ;
-        else if (vb) /* NVMe namespace can only be NVM device */
-                printf("dsk/nvm ");
+        else if (op->verbose) /* NVMe namespace can only be NVM device */
+                out_puts("dsk/nvm ");
         else
-                printf("disk    ");
+                out_puts("disk    ");
 
 
         if (op->wwn) {
-                if (get_value(buff, "wwid", value, vlen))
-                        printf("%-41s  ", value);
+                if (rp->attr_ok & NA_BIT(NA_WWID))
+                        out_field(rp->attr_val[NA_WWID], 41);
                 else
-                        printf("%-41s  ", "wwid?");
-        } else if (op->transport_info) {
-                if (get_value(buff, "device/transport", value, vlen)) {
-                        const char * svp = "device/device/subsystem_vendor";
-                        const char * sdp = "device/device/subsystem_device";
-                        char bb[80];
-
-                        if (0 == strcmp("pcie" , value)) {
+                        out_field("wwid?", 41);
+        } else if (op->transport_info)
+                out_field(nvme_ctl_transport(ncp), 41);
+        else if (op->unit) {
+                if (rp->attr_ok & NA_BIT(NA_WWID)) {
+                        const char * wwid = rp->attr_val[NA_WWID];
 
-                                if (get_value(buff, svp, b, sizeof(b)) &&
-                                    get_value(buff, sdp, bb, sizeof(bb))) {
-                                        snprintf(value , vlen, "pcie %s:%s",
-                                                 b, bb);
-                                        printf("%-41s  ", value);
-                                } else
-                                        printf("%-41s  ", "transport?");
-                        } else
-                                printf("%-41s  ", value);
-                } else
-                        printf("%-41s  ", "transport?");
-        } else if (op->unit) {
-                if (get_value(buff, "wwid", value, vlen)) {
                         if ((op->unit < 4) &&
-                            (0 == strncmp("eui.", value, 4)))
-                                printf("%-41s  ", value + 4);
+                            (0 == strncmp("eui.", wwid, 4)))
+                                out_field(wwid + 4, 41);
                         else
-                                printf("%-41s  ", value);
+                                out_field(wwid, 41);
                 } else
-                        printf("%-41s  ", "wwid?");
+                        out_field("wwid?", 41);
         } else if (! op->brief) {
-                if (! get_value(nvme_ctl_abs, "model", ctl_model,
-                                sizeof(ctl_model)))
-                        snprintf(ctl_model, sizeof(ctl_model), "-    ");
-                n = trim_lead_trail(ctl_model, true, true);
-                snprintf(b, sizeof(b), "__%u", nsid);
+                my_strcopy(ctl_model, nvme_ctl_model(ncp),
+                           sizeof(ctl_model));
+                n = ncp->model_len;
+                snprintf(b, sizeof(b), "__%u", rp->nsid);
                 m = strlen(b);
                 if (n > (41 - m))
                         memcpy(ctl_model + 41 - m, b, m + 1);
                 else
                         strcat(ctl_model, b);
-                printf("%-41s  ", ctl_model);
+                out_field(ctl_model, 41);
         }
 
-        if (op->kname)
-                snprintf(dev_node, sizeof(dev_node), "%s/%s",
-                         dev_dir, nvme_ns_rel);
-        else if (! get_dev_node(buff, dev_node, BLK_DEV))
-                snprintf(dev_node, sizeof(dev_node), "-       ");
-
-        printf("%-9s", dev_node);
+        out_pad(rp->dev_node, 9);
         if (op->dev_maj_min) {
-                if (get_value(buff, "dev", value, vlen))
-                        printf(" [%s]", value);
+                if (rp->attr_ok & NA_BIT(NA_DEV))
+                        out_printf(" [%s]", rp->attr_val[NA_DEV]);
                 else
-                        printf(" [dev?]");
+                        out_puts(" [dev?]");
         }
+        if (op->ssize)
+                size_render((rp->attr_ok & NA_BIT(NA_SIZE)) ?
+                            rp->attr_val[NA_SIZE] : NULL,
+                            (rp->attr_ok & NA_BIT(NA_LOGICAL_BLOCK_SIZE)) ?
+                            rp->attr_val[NA_LOGICAL_BLOCK_SIZE] : NULL, op);
+        out_write("\n", 1);
+long_lines:
+        if (op->long_opt > 0)
+                longer_nd_entry(rp, op);
+        if (op->verbose > 0)
+                out_printf("  dir: %s  [%s]\n", rp->dir,
+                           rp->resolved_ok ? rp->resolved : "");
+}
 
-        if (op->ssize) {
-                uint64_t blk512s;
-
-                if (! get_value(buff, "size", value, vlen)) {
-                        printf("  %6s", "-");
-                        goto fini_line;
-                }
-                blk512s = atoll(value);
-                /* tabbing 8 should be banned, use goto to win some space */
-                if (op->ssize > 2) {
-                        int lbs = 0;
-                        char bb[32];
-
-                        if (get_value(buff, "queue/logical_block_size", bb,
-                                      sizeof(bb))) {
-                                lbs = atoi(bb);
-                                if (lbs < 1)
-                                        printf("  %12s,[lbs<1 ?]", value);
-                                else if (512 == lbs)
-                                        printf("  %12s%s", value,
-                                               (op->ssize > 3) ? ",512" : "");
-                                else {
-                                        int64_t byts = 512 * blk512s;
-
-                                        snprintf(value, vlen, "%" PRId64,
-                                                 (byts / lbs));
-                                        if (op->ssize > 3)
-                                                printf("  %12s,%d", value,
-                                                       lbs);
-                                        else
-                                                printf("  %12s", value);
-                                }
-                        } else
-                                printf("  %12s,512", value);
-                } else {
-                        enum string_size_units unit_val = (0x1 & op->ssize) ?
-                                         STRING_UNITS_10 : STRING_UNITS_2;
+/* Outputs "transport_type" and "transport" of a NVMe controller */
+static void
+nvme_ctl_json_transport(struct nvme_ctl * ncp)
+{
+        const char * cp = nvme_ctl_transport(ncp);
+        char b[LMAX_NAME];
 
-                        blk512s <<= 9;
-                        if (blk512s > 0 &&
-                            size2string(blk512s, unit_val, value, vlen))
-                                printf("  %6s", value);
-                        else
-                                printf("  %6s", "-");
-                }
+        if (0 == strcmp(cp, "transport?")) {
+                json_str("transport_type", NULL);
+                json_str("transport", NULL);
+                return;
         }
+        snprintf(b, sizeof(b), "%.*s", (int)strcspn(cp, " "), cp);
+        json_str("transport_type", b);
+        json_str("transport", cp);
+}
 
-fini_line:
-        printf("\n");
-        if (op->long_opt > 0)
-                longer_nd_entry(buff, devname, op);
-        if (vb > 0) {
-                printf("  dir: %s  [", buff);
-                if (if_directory_chdir(buff, "")) {
-                        if (NULL == getcwd(wd, sizeof(wd)))
-                                printf("?");
-                        else
-                                printf("%s", wd);
+/* Outputs a NVMe namespace as a --json record, with the same members as
+ * sdev_json_render() */
+static void
+ndev_json_render(const struct ndev_rec * rp, const struct lsscsi_opts * op)
+{
+        int k;
+        struct nvme_ctl * ncp = rp->ncp;
+        const char * wwid = (rp->attr_ok & NA_BIT(NA_WWID)) ?
+                            rp->attr_val[NA_WWID] : NULL;
+        const char * cp;
+        char b[80];
+
+        json_rec_begin(op);
+        json_str("hctl", tuple2string(&rp->hctl, 0xf, sizeof(b), b));
+        json_num("host", false, 0);
+        json_num("channel", true, rp->hctl.c);
+        json_num("target", true, rp->hctl.t);
+        json_num("lun", false, 0);
+        json_str("lun_hex", NULL);
+        json_num("nsid", true, rp->nsid);
+        json_str("type", "disk");
+        json_num("pdt", true, 0);
+        json_str("vendor", NULL);
+        cp = nvme_ctl_model(ncp);
+        json_str("model", ('-' == cp[0]) ? NULL : cp);
+        cp = nvme_ctl_rev(ncp);
+        json_str("rev", cp[0] ? cp : NULL);
+        json_str("device", ('-' == rp->dev_node[0]) ? NULL : rp->dev_node);
+        json_str("maj_min", (rp->attr_ok & NA_BIT(NA_DEV)) ?
+                            rp->attr_val[NA_DEV] : NULL);
+        json_str("generic", NULL);
+        json_str("generic_maj_min", NULL);
+        json_str("wwn", wwid);
+        json_str("lu_name", wwid);
+        json_str("scsi_id", NULL);
+        nvme_ctl_json_transport(ncp);
+        json_num_str("size_bytes", !! (rp->attr_ok & NA_BIT(NA_SIZE)),
+                     rp->attr_val[NA_SIZE], 512);
+        json_num_str("logical_block_size",
+                     !! (rp->attr_ok & NA_BIT(NA_LOGICAL_BLOCK_SIZE)),
+                     rp->attr_val[NA_LOGICAL_BLOCK_SIZE], 1);
+        json_num("protection_type", false, 0);
+        json_str("integrity", NULL);
+        json_str("protection_mode", NULL);
+        json_str("enclosure", NULL);
+        json_str("enclosure_slot", NULL);
+        json_obj_begin("attributes");
+        for (k = NA_CAPABILITY; k < NDEV_NUM_ATTRS; ++k) {
+                if (rp->attr_ok & NA_BIT(k)) {
+                        cp = strrchr(ndev_attrs[k], '/');
+                        json_str(cp ? cp + 1 : ndev_attrs[k],
+                                 rp->attr_val[k]);
                 }
-                printf("]\n");
         }
+        json_obj_end();
+        json_rec_end();
+}
+
+/* List one NVMe namespace: collect what is to be output, then output it */
+static void
+one_ndev_entry(struct nvme_ctl * ncp, const char * nvme_ns_rel,
+               const struct lsscsi_opts * op)
+{
+        struct ndev_rec rec;
+
+        if (! collect_ndev(ncp, nvme_ns_rel, op, &rec))
+                return;
+        if (op->json)
+                ndev_json_render(&rec, op);
+        else
+                ndev_render(&rec, op);
 }
 
 static int
-ndev_dir_scan_select(const struct dirent * s)
+ndev_dir_scan_select(const struct dirent * s, void * ctx)
 {
+        const struct lsscsi_opts * op = (const struct lsscsi_opts *)ctx;
         int cdev_minor; /* /dev/nvme<n> char device minor */
 
         if ((0 == strncmp(s->d_name, "nvme", 4)) &&
             (1 == sscanf(s->d_name + 4, "%d", &cdev_minor))) {
-                if (filter_active) {
-                        if (((-1 == filter.h) ||
-                             (NVME_HOST_NUM == filter.h)) &&
-                            ((-1 == filter.c) || (cdev_minor == filter.c)))
+                if (op->filter_active) {
+                        const struct addr_hctl * fp = &op->filter;
+
+                        if (((-1 == fp->h) || (NVME_HOST_NUM == fp->h)) &&
+                            ((-1 == fp->c) || (cdev_minor == fp->c)))
                                 return 1;
                         else
                                 return 0;
@@ -3834,8 +7031,9 @@ ndev_dir_scan_select(const struct dirent * s)
 }
 
 static int
-ndev_dir_scan_select2(const struct dirent * s)
+ndev_dir_scan_select2(const struct dirent * s, void * ctx)
 {
+        const struct lsscsi_opts * op = (const struct lsscsi_opts *)ctx;
         int cdev_minor;
         uint32_t nsid;
         char * cp;
@@ -3852,12 +7050,13 @@ ndev_dir_scan_select2(const struct dirent * s)
                 return 0;
         if ((1 == sscanf(s->d_name + 4, "%d", &cdev_minor)) &&
             (1 == sscanf(cp + 1, "%u", &nsid))) {
-                if (filter_active) {    /* filter cntlid (.t) in caller */
-                        if (((-1 == filter.h) ||
-                             (NVME_HOST_NUM == filter.h)) &&
-                            ((-1 == filter.c) || (cdev_minor == filter.c)) &&
-                      /*    ((-1 == filter.t) || (s_hctl.t == filter.t)) && */
-                            ((UINT64_LAST == filter.l) || (nsid == filter.l)))
+                if (op->filter_active) {    /* filter cntlid (.t) in caller */
+                        const struct addr_hctl * fp = &op->filter;
+
+                        if (((-1 == fp->h) || (NVME_HOST_NUM == fp->h)) &&
+                            ((-1 == fp->c) || (cdev_minor == fp->c)) &&
+                      /*    ((-1 == fp->t) || (s_hctl.t == fp->t)) && */
+                            ((UINT64_LAST == fp->l) || (nsid == fp->l)))
                                 return 1;
                         else
                                 return 0;
@@ -3867,6 +7066,67 @@ ndev_dir_scan_select2(const struct dirent * s)
         return 0;
 }
 
+/* Outputs a NVMe controller as a --json record, with the same members as
+ * shost_json_render() */
+static void
+nhost_json_render(const char * dir_name, const char * nvme_ctl_rel,
+                  const struct lsscsi_opts * op)
+{
+        bool ok;
+        int k;
+        uint32_t cdev_minor = 0;
+        struct nvme_ctl ctl;
+        const char * cp;
+        char buff[LMAX_DEVPATH];
+        char value[LMAX_DEVPATH];
+        char b[80];
+        char bb[80];
+        static const char * const mm_names[] = {"MAJOR", "MINOR"};
+        char * const mm_vals[] = {b, bb};
+        static const char * const ctl_attrs[] = {
+                "cntlid", "state", "subsysnqn", "device/current_link_width",
+                "device/current_link_speed", NULL,
+        };
+
+        snprintf(buff, sizeof(buff), "%s%s", dir_name, nvme_ctl_rel);
+        nvme_ctl_init(&ctl, buff);
+        json_rec_begin(op);
+        json_str("name", nvme_ctl_rel);
+        json_num("host", false, 0);
+        ok = (1 == sscanf(nvme_ctl_rel, "nvme%u", &cdev_minor));
+        json_num("controller", ok, cdev_minor);
+        json_str("driver", NULL);
+        if (op->kname) {
+                snprintf(value, sizeof(value), "%s/%s", dev_dir,
+                         nvme_ctl_rel);
+                ok = true;
+        } else
+                ok = get_dev_node(buff, value, CHR_DEV);
+        json_str("device", ok ? value : NULL);
+        ok = (2 == name_eq2values(buff, "uevent", 2, mm_names, sizeof(b),
+                                  mm_vals));
+        snprintf(value, sizeof(value), "%s:%s", b, bb);
+        json_str("maj_min", ok ? value : NULL);
+        cp = nvme_ctl_model(&ctl);
+        json_str("model", ('-' == cp[0]) ? NULL : cp);
+        ok = get_value(buff, "serial", value, sizeof(value));
+        if (ok)
+                trim_lead_trail(value, true, true);
+        json_str("serial", ok ? value : NULL);
+        cp = nvme_ctl_rev(&ctl);
+        json_str("rev", cp[0] ? cp : NULL);
+        nvme_ctl_json_transport(&ctl);
+        json_obj_begin("attributes");
+        for (k = 0; ctl_attrs[k]; ++k) {
+                if (get_value(buff, ctl_attrs[k], value, sizeof(value))) {
+                        cp = strrchr(ctl_attrs[k], '/');
+                        json_str(cp ? cp + 1 : ctl_attrs[k], value);
+                }
+        }
+        json_obj_end();
+        json_rec_end();
+}
+
 static void
 one_nhost_entry(const char * dir_name, const char * nvme_ctl_rel,
                 const struct lsscsi_opts * op)
@@ -3882,103 +7142,108 @@ one_nhost_entry(const char * dir_name, const char * nvme_ctl_rel,
         char b[80];
         char bb[80];
 
+        if (op->json) {
+                nhost_json_render(dir_name, nvme_ctl_rel, op);
+                return;
+        }
         vlen = sizeof(value);
         if (1 == sscanf(nvme_ctl_rel, "nvme%u", &cdev_minor))
-                printf("[N:%u]  ", cdev_minor);
+                out_printf("[N:%u]  ", cdev_minor);
         else
-                printf("[N:?]  ");
+                out_printf("[N:?]  ");
         snprintf(buff, sizeof(buff), "%s%s", dir_name, nvme_ctl_rel);
 
         if (op->kname)
                 snprintf(value, vlen, "%s/%s", dev_dir, nvme_ctl_rel);
         else if (! get_dev_node(buff, value, CHR_DEV))
                 snprintf(value, vlen, "-       ");
-        printf("%-9s", value);
+        out_printf("%-9s", value);
         if (op->dev_maj_min) {
-                char * bp;
+                static const char * const mm_names[] = {"MAJOR", "MINOR"};
+                char * const mm_vals[] = {b, bb};
 
-                bp = name_eq2value(buff, "uevent", "MAJOR", sizeof(b), b);
-                if (strlen(bp) > 1)
-                        printf(" [%s:%s]", bp, name_eq2value(buff, "uevent",
-                                                 "MINOR", sizeof(bb), bb));
+                name_eq2values(buff, "uevent", 2, mm_names, sizeof(b),
+                               mm_vals);
+                if (strlen(b) > 1)
+                        out_printf(" [%s:%s]", b, bb);
                 else
-                        printf(" [dev?]");
+                        out_printf(" [dev?]");
         }
         if (op->transport_info) {
                 const char * svp = "device/subsystem_vendor";
                 const char * sdp = "device/subsystem_device";
 
-                printf("    ");
+                out_printf("    ");
                 if (get_value(buff, "transport", value, vlen)) {
                         if (0 == strcmp("pcie" , value)) {
                                 if (get_value(buff, svp, b, sizeof(b)) &&
                                     get_value(buff, sdp, bb, sizeof(bb)))
-                                        printf("pcie %s:%s", b, bb);
+                                        out_printf("pcie %s:%s", b, bb);
                                 else
-                                        printf("pcie ?:?");
+                                        out_printf("pcie ?:?");
                         } else
-                                printf("%s%s\n", (vb ? "transport=" : ""),
-                                       value);
+                                out_printf("%s%s\n", (vb ? "transport=" : ""),
+                                           value);
                 } else if (vb)
-                        printf("transport=?\n");
-                printf("\n");
+                        out_printf("transport=?\n");
+                out_printf("\n");
         } else if (op->wwn) {
                 if (get_value(buff, "subsysnqn", value, vlen))
-                        printf("   %s%s\n", (vb ? "subsysnqn=" : ""),
+                        out_printf("   %s%s\n", (vb ? "subsysnqn=" : ""),
                               value);
                 else if (vb)
-                        printf("subsysnqn=?\n");
+                        out_printf("subsysnqn=?\n");
         } else if (op->unit) {
                 if (get_value(buff, "device/subsystem_vendor", value, vlen)) {
-                        printf("   %s%s:", (vb ? "vin=" : ""), value);
+                        out_printf("   %s%s:", (vb ? "vin=" : ""), value);
                         if (get_value(buff, "device/subsystem_device", value,
                             vlen))
-                                printf("%s\n", value);
+                                out_printf("%s\n", value);
                         else
-                                printf("??\n");
+                                out_printf("??\n");
                 } else if (vb)
-                        printf("subsystem_vendor=?\n");
+                        out_printf("subsystem_vendor=?\n");
         } else if (op->long_opt > 0) {
                 bool sing = (op->long_opt > 2);
                 const char * sep = sing ? "\n" : "";
 
                 if (get_value(buff, "cntlid", value, vlen))
-                        printf("%s  cntlid=%s%s", sep, value, sep);
+                        out_printf("%s  cntlid=%s%s", sep, value, sep);
                 else if (vb)
-                        printf("%s  cntlid=?%s", sep, sep);
+                        out_printf("%s  cntlid=?%s", sep, sep);
                 if (get_value(buff, "state", value, vlen))
-                        printf("  state=%s%s", value, sep);
+                        out_printf("  state=%s%s", value, sep);
                 else if (vb)
-                        printf("  state=?%s", sep);
+                        out_printf("  state=?%s", sep);
                 if (get_value(buff, "device/current_link_width", value, vlen))
-                        printf("  current_link_width=%s%s", value, sep);
+                        out_printf("  current_link_width=%s%s", value, sep);
                 else if (vb)
-                        printf("  current_link_width=?%s", sep);
+                        out_printf("  current_link_width=?%s", sep);
                 if (get_value(buff, "firmware_rev", value, vlen))
-                        printf("  firmware_rev=%s%s", value, sep);
+                        out_printf("  firmware_rev=%s%s", value, sep);
                 else if (vb)
-                        printf("  firmware_rev=?%s", sep);
+                        out_printf("  firmware_rev=?%s", sep);
                 if (! sing)
-                        printf("\n");
+                        out_printf("\n");
                 if (op->long_opt > 1) {
                         if (get_value(buff, "device/current_link_speed",
                                       value, vlen))
-                                printf("  current_link_speed=%s%s", value,
-                                       sep);
+                                out_printf("  current_link_speed=%s%s", value,
+                                           sep);
                         else if (vb)
-                                printf("  current_link_speed=?%s", sep);
+                                out_printf("  current_link_speed=?%s", sep);
                         if (get_value(buff, "model", value, vlen)) {
                                 trim_lead_trail(value, true, true);
-                                printf("  model=%s%s", value, sep);
+                                out_printf("  model=%s%s", value, sep);
                         } else if (vb)
-                                printf("  model=?%s", sep);
+                                out_printf("  model=?%s", sep);
                         if (get_value(buff, "serial", value, vlen)) {
                                 trim_lead_trail(value, true, true);
-                                printf("  serial=%s%s", value, sep);
+                                out_printf("  serial=%s%s", value, sep);
                         } else if (vb)
-                                printf("  serial=?%s", sep);
+                                out_printf("  serial=?%s", sep);
                         if (! sing)
-                                printf("\n");
+                                out_printf("\n");
                 }
         } else if (! op->brief) {
                 if (get_value(buff, "model", value, vlen) &&
@@ -3988,7 +7253,7 @@ one_nhost_entry(const char * dir_name, const char * nvme_ctl_rel,
                         trunc_pad2n(value, 32, true);
                 } else
                         strcpy(value, nullname1);
-                printf("  %-32s ", value);
+                out_printf("  %-32s ", value);
 
                 if (get_value(buff, "serial", value, vlen) &&
                     strncmp(value, nullname1, 6) &&
@@ -3997,7 +7262,7 @@ one_nhost_entry(const char * dir_name, const char * nvme_ctl_rel,
                         trunc_pad2n(value, 18, true);
                 } else
                         strcpy(value, nullname1);
-                printf(" %-18s ", value);
+                out_printf(" %-18s ", value);
 
                 if (get_value(buff, "firmware_rev", value, vlen) &&
                     strncmp(value, nullname1, 6) &&
@@ -4006,101 +7271,335 @@ one_nhost_entry(const char * dir_name, const char * nvme_ctl_rel,
                         trunc_pad2n(value, 8, false);
                 } else
                         strcpy(value, nullname1);
-                printf(" %-8s\n", value);
+                out_printf(" %-8s\n", value);
         } else
-                printf("\n");
+                out_printf("\n");
         if (vb > 0) {
-                printf("  dir: %s\n  device dir: ", buff);
-                if (if_directory_chdir(buff, "device")) {
-                        if (NULL == getcwd(wd, sizeof(wd)))
-                                printf("?");
-                        else
-                                printf("%s", wd);
-                }
-                printf("\n");
+                out_printf("  dir: %s\n  device dir: ", buff);
+                if (if_directory_resolve(buff, "device", wd, sizeof(wd)))
+                        out_printf("%s", wd);
+                out_printf("\n");
         }
 }
 
 #endif          /* (HAVE_NVME && (! IGNORE_NVME)) */
 
-/* This is a compare function for numeric sort based on hctl tuple.
- * Returns -1 if (a->d_name < b->d_name) ; 0 if they are equal
- * and 1 otherwise. */
-static int
-sdev_scandir_sort(const struct dirent ** a, const struct dirent ** b)
+/* Sort key for SCSI device names, "<h:c:t:l>" */
+static bool
+sdev_sort_key(const char * name, struct addr_hctl * kp)
 {
-        const char * lnam = (*a)->d_name;
-        const char * rnam = (*b)->d_name;
-        struct addr_hctl left_hctl;
-        struct addr_hctl right_hctl;
+        return parse_colon_list(name, kp);
+}
 
-        if (! parse_colon_list(lnam, &left_hctl)) {
-                pr2serr("%s: left parse failed: %.20s\n", __func__,
-                        (lnam ? lnam : "<null>"));
-                return -1;
+#if (HAVE_NVME && (! IGNORE_NVME))
+
+/* Sort key for NVMe controller names like "nvme2" (or "<h:c:t:l>"),
+ * which become hctl tuple N:2:0:0 */
+static bool
+nhost_sort_key(const char * name, struct addr_hctl * kp)
+{
+        if (strchr(name, ':'))
+                return parse_colon_list(name, kp);
+        if (1 != sscanf(name, "nvme%d", &kp->c))
+                return false;
+        kp->h = NVME_HOST_NUM;
+        kp->t = 0;
+        kp->l = 0;
+        return true;
+}
+
+/* Sort key for NVMe namespace names like "nvme2n3" (or "nvme2c1n3"), which
+ * become hctl tuple N:2:0:3 . Ordering is by namespace id within the
+ * controller as the cntlid is not part of the name. */
+static bool
+nns_sort_key(const char * name, struct addr_hctl * kp)
+{
+        uint32_t nsid;
+        const char * cp;
+
+        if (1 != sscanf(name, "nvme%d", &kp->c))
+                return false;
+        cp = strrchr(name + 4, 'n');
+        if ((NULL == cp) || (1 != sscanf(cp + 1, "%u", &nsid)))
+                return false;
+        kp->h = NVME_HOST_NUM;
+        kp->t = 0;
+        kp->l = nsid;
+        return true;
+}
+
+#endif          /* (HAVE_NVME && (! IGNORE_NVME)) */
+
+#if HAVE_IO_URING
+
+/* Starts batched reads of the attributes one_sdev_entry() will want from
+ * the device directory 'dir_name'/'devname'. */
+static void
+sdev_prefetch(const char * dir_name, const char * devname,
+              const struct lsscsi_opts * op)
+{
+        int k;
+        int n = 0;
+        char buff[LMAX_DEVPATH];
+        const char * names[URING_MAX_ATTRS];
+
+        snprintf(buff, sizeof(buff), "%s/%s", dir_name, devname);
+        for (k = 0; k < SDEV_NUM_ATTRS; ++k) {
+                if (op->plan.sdev_attrs & SA_BIT(k))
+                        names[n++] = sdev_attrs[k];
         }
-        if (! parse_colon_list(rnam, &right_hctl)) {
-                pr2serr("%s: right parse failed: %.20s\n", __func__,
-                        (rnam ? rnam : "<null>"));
-                return 1;
+        uring_prefetch(buff, names, n);
+}
+
+#endif  /* HAVE_IO_URING */
+
+/* Output one entry for each of namelist[lo] to namelist[hi - 1]. */
+static void
+sdev_entries(const char * dir_name, struct dirent ** namelist, int lo,
+             int hi, const struct lsscsi_opts * op)
+{
+        int k;
+        char name[LMAX_NAME];
+        struct scan_ctx sc;
+
+        for (k = lo; k < hi; ++k) {
+#if HAVE_IO_URING
+                /* keep the next device's reads in flight during this one */
+                if (k == lo)
+                        sdev_prefetch(dir_name, namelist[k]->d_name, op);
+                if ((k + 1) < hi)
+                        sdev_prefetch(dir_name, namelist[k + 1]->d_name, op);
+#endif
+                my_strcopy(name, namelist[k]->d_name, sizeof(name));
+                scan_ctx_init(&sc);
+                one_sdev_entry(dir_name, name, &sc, op);
+        }
+}
+
+/* Append the contents of fp to the output then close fp. Returns true if
+ * fp was not empty. A worker's --json records each start with a comma
+ * (see entries_jobs()), with 'first_rec' the leading one is dropped. */
+static bool
+copy_to_stdout(FILE * fp, bool first_rec)
+{
+        bool any = false;
+        size_t n;
+        char b[OUT_CHUNK_SZ];
+
+        rewind(fp);
+        while ((n = fread(b, 1, sizeof(b), fp)) > 0) {
+                if (first_rec && (! any) && (',' == b[0]))
+                        out_write(b + 1, n - 1);
+                else
+                        out_write(b, n);
+                any = true;
+        }
+        fclose(fp);
+        return any;
+}
+
+/* Outputs the entries for namelist[lo] to namelist[hi - 1]. */
+typedef void (*entries_fn)(const char * dir_name, struct dirent ** namelist,
+                           int lo, int hi, const struct lsscsi_opts * op);
+
+/* Splits namelist into op->jobs contiguous chunks, each processed by 'fn'
+ * in a forked worker whose stdout is redirected to a temporary file. Once a
+ * worker has finished, its output is copied to stdout so the result is in
+ * the same order as a single pass would give. If a worker cannot be
+ * started, or does not finish successfully (its output may then be
+ * partial, so it is dropped), its chunk is processed in this process, in
+ * sequence. */
+static void
+entries_jobs(entries_fn fn, const char * dir_name, struct dirent ** namelist,
+             int num, const struct lsscsi_opts * op)
+{
+        int k, jobs, per, rem, lo, status;
+        pid_t res;
+        int * chunk;
+        pid_t * pids;
+        FILE ** fps;
+
+        jobs = (op->jobs > num) ? num : op->jobs;
+        chunk = (int *)calloc(jobs + 1, sizeof(int));
+        pids = (pid_t *)calloc(jobs, sizeof(pid_t));
+        fps = (FILE **)calloc(jobs, sizeof(FILE *));
+        if ((NULL == chunk) || (NULL == pids) || (NULL == fps)) {
+                fn(dir_name, namelist, 0, num, op);
+                goto fini;
+        }
+        per = num / jobs;
+        rem = num % jobs;
+        for (k = 0, lo = 0; k < jobs; ++k) {
+                chunk[k] = lo;
+                lo += per + ((k < rem) ? 1 : 0);
+        }
+        chunk[jobs] = num;
+        out_flush();
+        for (k = 0; k < jobs; ++k) {
+                pids[k] = -1;
+                fps[k] = tmpfile();
+                if (NULL == fps[k]) {
+                        if (op->verbose > 0)
+                                perror("tmpfile");
+                        continue;
+                }
+                pids[k] = fork();
+                if (0 == pids[k]) {     /* worker */
+                        if (dup2(fileno(fps[k]), STDOUT_FILENO) < 0)
+                                _exit(1);
+                        out_init(false);
+                        out_tee(-1);    /* the parent tees what it copies */
+                        /* as if records precede, see copy_to_stdout() */
+                        json_recs = 1;
+                        fn(dir_name, namelist, chunk[k], chunk[k + 1], op);
+                        _exit(out_flush() ? 0 : 1);
+                } else if (pids[k] < 0) {
+                        if (op->verbose > 0)
+                                perror("fork");
+                        fclose(fps[k]);
+                        fps[k] = NULL;
+                }
         }
-        return cmp_hctl(&left_hctl, &right_hctl);
+        for (k = 0; k < jobs; ++k) {
+                if (pids[k] < 0) {
+                        fn(dir_name, namelist, chunk[k], chunk[k + 1], op);
+                        continue;
+                }
+                while (((res = waitpid(pids[k], &status, 0)) < 0) &&
+                       (EINTR == errno))
+                        ;
+                if ((res < 0) || (! WIFEXITED(status)) ||
+                    (0 != WEXITSTATUS(status))) {
+                        pr2serr("%s: worker %d failed, listing its entries "
+                                "again\n", __func__, k);
+                        fclose(fps[k]);
+                        fn(dir_name, namelist, chunk[k], chunk[k + 1], op);
+                        continue;
+                }
+                if (copy_to_stdout(fps[k], op->json && (0 == json_recs)) &&
+                    op->json)
+                        json_recs = 1;
+        }
+fini:
+        free(fps);
+        free(pids);
+        free(chunk);
+}
+
+/* List SCSI devices (LUs). */
+
+/* Selects the directories (not symlinks) in a SCSI host's subtree that
+ * may lead to one of its targets, and the target directories that match
+ * the filter's channel and target. */
+static int
+host_subtree_select(const struct dirent * s, void * ctx)
+{
+        const struct lsscsi_opts * op = (const struct lsscsi_opts *)ctx;
+        int h, c, t;
+
+        if ((DT_DIR != s->d_type) || ('.' == s->d_name[0]))
+                return 0;
+        if (0 == strncmp(s->d_name, "target", 6)) {
+                if (3 != sscanf(s->d_name + 6, "%d:%d:%d", &h, &c, &t))
+                        return 0;
+                return (((-1 == op->filter.c) || (c == op->filter.c)) &&
+                        ((-1 == op->filter.t) || (t == op->filter.t)));
+        }
+        if (isdigit((uint8_t)s->d_name[0]) || (0 == strcmp(s->d_name, "power")))
+                return 0;       /* LUs outside a target, or sysfs internals */
+        return 1;
 }
 
-#if (HAVE_NVME && (! IGNORE_NVME))
-
-/* This is a compare function for numeric sort based on hctl tuple. Similar
- * to sdev_scandir_sort() but converts entries like "nvme2" into a hctl tuple.
- * Returns -1 if (a->d_name < b->d_name) ; 0 if they are equal
- * and 1 otherwise. */
+/* Appends the LUs found below 'dir_name', which is in the device subtree
+ * of a SCSI host, to the '*nump' entries in '*listp'. Intermediate
+ * directories (e.g. SAS ports, end devices and expanders, FC remote ports
+ * and iSCSI sessions) are descended until target directories are found.
+ * There is no depth limit: targets behind cascaded expanders sit deep in
+ * the tree, and as symlinks are not followed the walk cannot loop. Returns
+ * 0 on success, else -1 with errno set (e.g. ENAMETOOLONG when a path does
+ * not fit) so that the caller can fall back to /sys/bus/scsi/devices . */
 static int
-nhost_scandir_sort(const struct dirent ** a, const struct dirent ** b)
+host_subtree_sdevs(const char * dir_name, struct dirent *** listp,
+                   int * nump, const struct lsscsi_opts * op)
 {
-        const char * lnam = (*a)->d_name;
-        const char * rnam = (*b)->d_name;
-        struct addr_hctl left_hctl;
-        struct addr_hctl right_hctl;
+        int num, n, k, res;
+        struct dirent ** namelist;
+        struct dirent ** nlist;
+        char buff[LMAX_DEVPATH];
 
-        if (strchr(lnam, ':')) {
-                if (! parse_colon_list(lnam, &left_hctl)) {
-                        pr2serr("%s: left parse failed: %.20s\n", __func__,
-                                (lnam ? lnam : "<null>"));
-                        return -1;
-                }
-        } else {
-                if (1 == sscanf(lnam, "nvme%d", &left_hctl.c)) {
-                        left_hctl.h = NVME_HOST_NUM;
-                        left_hctl.t = 0;
-                        left_hctl.l = 0;
-                } else {
-                        pr2serr("%s: left sscanf failed: %.20s\n", __func__,
-                                (lnam ? lnam : "<null>"));
-                        return -1;
-                }
-        }
-        if (strchr(rnam, ':')) {
-                if (! parse_colon_list(rnam, &right_hctl)) {
-                        pr2serr("%s: right parse failed: %.20s\n", __func__,
-                                (rnam ? rnam : "<null>"));
-                        return 1;
+        num = sysfs_scandir_ctx(dir_name, &namelist, host_subtree_select,
+                                NULL, (void *)op);
+        if (num < 0)
+                return -1;
+        res = 0;
+        for (k = 0; k < num; ++k) {
+                if (snprintf(buff, sizeof(buff), "%s/%s", dir_name,
+                             namelist[k]->d_name) >= (int)sizeof(buff)) {
+                        errno = ENAMETOOLONG;
+                        res = -1;
+                        break;
                 }
-        } else {
-                if (1 == sscanf(rnam, "nvme%d", &right_hctl.c)) {
-                        right_hctl.h = NVME_HOST_NUM;
-                        right_hctl.t = 0;
-                        right_hctl.l = 0;
-                } else {
-                        pr2serr("%s: right sscanf failed: %.20s\n", __func__,
-                                (rnam ? rnam : "<null>"));
-                        return -1;
+                if (0 == strncmp(namelist[k]->d_name, "target", 6)) {
+                        n = sysfs_scandir_ctx(buff, &nlist,
+                                              sdev_dir_scan_select, NULL,
+                                              (void *)op);
+                        if (n > 0) {
+                                struct dirent ** lp;
+
+                                lp = (struct dirent **)realloc(*listp,
+                                        (*nump + n) * sizeof(struct dirent *));
+                                if (NULL == lp) {
+                                        while (n > 0)
+                                                free(nlist[--n]);
+                                        free(nlist);
+                                        errno = ENOMEM;
+                                        res = -1;
+                                        break;
+                                }
+                                memcpy(lp + *nump, nlist,
+                                       n * sizeof(struct dirent *));
+                                *listp = lp;
+                                *nump += n;
+                        }
+                        if (n >= 0)
+                                free(nlist);
+                } else if (host_subtree_sdevs(buff, listp, nump, op) < 0) {
+                        res = -1;
+                        break;
                 }
         }
-        return cmp_hctl(&left_hctl, &right_hctl);
+        for (k = 0; k < num; ++k)
+                free(namelist[k]);
+        free(namelist);
+        return res;
 }
 
-#endif          /* (HAVE_NVME && (! IGNORE_NVME)) */
+/* When the filter pins the host number, the LUs are found by walking that
+ * host's device subtree rather than reading the whole of
+ * /sys/bus/scsi/devices . Returns the number of LUs placed, sorted, in
+ * '*namelist', or -1 if the host's subtree could not be read. */
+static int
+host_filter_sdevs(struct dirent *** namelist, const struct lsscsi_opts * op)
+{
+        int k, num;
+        struct dirent ** list;
+        char buff[LMAX_DEVPATH];
+
+        snprintf(buff, sizeof(buff), "%s%shost%d/device", sysfsroot,
+                 scsi_host, op->filter.h);
+        list = NULL;
+        num = 0;
+        if (host_subtree_sdevs(buff, &list, &num, op) < 0) {
+                for (k = 0; k < num; ++k)
+                        free(list[k]);
+                free(list);
+                return -1;
+        }
+        sort_hctl_namelist(list, num, sdev_sort_key);
+        *namelist = list;
+        return num;
+}
 
-/* List SCSI devices (LUs). */
 static void
 list_sdevices(const struct lsscsi_opts * op)
 {
@@ -4111,237 +7610,344 @@ list_sdevices(const struct lsscsi_opts * op)
 
         snprintf(buff, sizeof(buff), "%s%s", sysfsroot, bus_scsi_devs);
 
-        num = scandir(buff, &namelist, sdev_dir_scan_select,
-                      sdev_scandir_sort);
+        num = -1;
+        if (op->filter_active && (-1 != op->filter.h))
+                num = host_filter_sdevs(&namelist, op);
+        if (num < 0)
+                num = sysfs_scandir_ctx(buff, &namelist, sdev_dir_scan_select,
+                                        sdev_sort_key, (void *)op);
         if (num < 0) {  /* scsi mid level may not be loaded */
                 if (op->verbose > 0) {
                         snprintf(name, sizeof(name), "%s: scandir: %s",
                                  __func__, buff);
                         perror(name);
-                        printf("SCSI mid level module may not be loaded\n");
+                        if (! op->json)     /* keep stdout JSON */
+                                out_printf("SCSI mid level module may not "
+                                           "be loaded\n");
                 }
                 if (op->classic)
-                        printf("Attached devices: none\n");
+                        out_printf("Attached devices: none\n");
                 return;
         }
         if (op->classic)
-                printf("Attached devices: %s\n", (num ? "" : "none"));
-
-        for (k = 0; k < num; ++k) {
-                my_strcopy(name, namelist[k]->d_name, sizeof(name));
-                transport_id = TRANSPORT_UNKNOWN;
-                one_sdev_entry(buff, name, op);
+                out_printf("Attached devices: %s\n", (num ? "" : "none"));
+        /* with a filter few devices may be listed, so look up each one */
+        if ((! op->filter_active) && (num > 1))
+                collect_lu_map(num, LU_MAP_BLK |
+                               ((op->plan.need & PLAN_SG) ? LU_MAP_SG : 0) |
+                               ((op->plan.need & PLAN_TPORT) ? LU_MAP_SAS :
+                                                               0));
+
+        if ((op->jobs > 1) && (num > 1)) {
+                /* do this once here, rather than once in each worker */
+                if (op->plan.need & PLAN_WWN)
+                        collect_disk_wwn_nodes();
+                entries_jobs(sdev_entries, buff, namelist, num, op);
+        } else
+                sdev_entries(buff, namelist, 0, num, op);
+        for (k = 0; k < num; ++k)
                 free(namelist[k]);
-        }
         free(namelist);
-        if (op->wwn)
-                free_disk_wwn_node_list();
 }
 
 #if (HAVE_NVME && (! IGNORE_NVME))
 
-/* List NVME devices (namespaces). */
+/* Output the namespaces of each NVMe controller in name_list[lo] to
+ * name_list[hi - 1]. */
 static void
-list_ndevices(const struct lsscsi_opts * op)
+ndev_entries(const char * dir_name, struct dirent ** name_list, int lo,
+             int hi, const struct lsscsi_opts * op)
 {
-        int num, num2, k, j;
-        struct dirent ** name_list;
+        int num2, k, j;
         struct dirent ** namelist2;
-        char buff[LMAX_DEVPATH];
         char buff2[LMAX_DEVPATH];
         char ebuf[120];
+        struct nvme_ctl nctl;
 
-        snprintf(buff, sizeof(buff), "%s%s", sysfsroot, class_nvme);
-
-        num = scandir(buff, &name_list, ndev_dir_scan_select,
-                      nhost_scandir_sort);
-        if (num < 0) {  /* NVMe module may not be loaded */
-                if (op->verbose > 0) {
-                        snprintf(ebuf, sizeof(ebuf), "%s: scandir: %s",
-                                 __func__, buff);
-                        perror(ebuf);
-                        printf("NVMe module may not be loaded\n");
-                }
-                return;
-        }
-        for (k = 0; k < num; ++k) {
-                snprintf(buff2, sizeof(buff2), "%s%s", buff,
+        for (k = lo; k < hi; ++k) {
+                snprintf(buff2, sizeof(buff2), "%s%s", dir_name,
                          name_list[k]->d_name);
-                free(name_list[k]);
-                num2 = scandir(buff2, &namelist2, ndev_dir_scan_select2,
-                               sdev_scandir_sort);
+                num2 = sysfs_scandir_ctx(buff2, &namelist2,
+                                         ndev_dir_scan_select2,
+                                         nns_sort_key, (void *)op);
                 if (num2 < 0) {
                         if (op->verbose > 0) {
                                 snprintf(ebuf, sizeof(ebuf), "%s: scandir"
-                                         "(2): %s", __func__, buff);
+                                         "(2): %s", __func__, dir_name);
                                 perror(ebuf);
                         }
-                        /* already freed name_list[k] so move to next */
-                        ++k;
                         break;
                 }
+                nvme_ctl_init(&nctl, buff2);
                 for (j = 0; j < num2; ++j) {
-                        transport_id = TRANSPORT_UNKNOWN;
-                        one_ndev_entry(buff2, namelist2[j]->d_name, op);
+                        one_ndev_entry(&nctl, namelist2[j]->d_name, op);
                         free(namelist2[j]);
                 }
                 free(namelist2);
         }
-        for ( ; k < num; ++k) /* clean out rest of name_list[] */
-                free(name_list[k]);
+}
 
+/* List NVME devices (namespaces). With --jobs=N the controllers are shared
+ * out between the workers. */
+static void
+list_ndevices(const struct lsscsi_opts * op)
+{
+        int num, k;
+        struct dirent ** name_list;
+        char buff[LMAX_DEVPATH];
+        char ebuf[120];
+
+        snprintf(buff, sizeof(buff), "%s%s", sysfsroot, class_nvme);
+
+        num = sysfs_scandir_ctx(buff, &name_list, ndev_dir_scan_select,
+                                nhost_sort_key, (void *)op);
+        if (num < 0) {  /* NVMe module may not be loaded */
+                if (op->verbose > 0) {
+                        snprintf(ebuf, sizeof(ebuf), "%s: scandir: %s",
+                                 __func__, buff);
+                        perror(ebuf);
+                        if (! op->json)
+                                out_printf("NVMe module may not be "
+                                           "loaded\n");
+                }
+                return;
+        }
+        if ((op->jobs > 1) && (num > 1))
+                entries_jobs(ndev_entries, buff, name_list, num, op);
+        else
+                ndev_entries(buff, name_list, 0, num, op);
+        for (k = 0; k < num; ++k)
+                free(name_list[k]);
         free(name_list);
-        if (op->wwn)
-                free_disk_wwn_node_list();
 }
 
 #endif          /* (HAVE_NVME && (! IGNORE_NVME)) */
 
+/* Attributes in a SCSI host directory that --long may output */
+enum shost_attr_idx {
+        HA_CAN_QUEUE = 0,
+        HA_CMD_PER_LUN,
+        HA_HOST_BUSY,
+        HA_SG_TABLESIZE,
+        HA_STATE,
+        HA_UNCHECKED_ISA_DMA,
+        HA_UNIQUE_ID,
+        SHOST_NUM_ATTRS,
+};
+
+static const char * shost_attrs[SHOST_NUM_ATTRS] = {
+        "can_queue", "cmd_per_lun", "host_busy", "sg_tablesize", "state",
+        "unchecked_isa_dma", "unique_id",
+};
+
+#define HA_BIT(idx) (1U << (idx))
+
+/* All that is output for one SCSI host, collected by collect_shost() and
+ * output by shost_render() and longer_h_entry() */
+struct shost_rec {
+        bool host_id_ok;
+        bool name_ok;                   /* proc_name or driver */
+        bool tport_ok;                  /* --transport */
+        bool device_ok;                 /* --verbose */
+        int transport_id;               /* TRANSPORT_*, with tport */
+        unsigned int host_id;
+        uint32_t attr_ok;               /* HA_BIT() of each one read */
+        /* strings from here on, only valid as flagged above */
+        char devname[LMAX_NAME];        /* "host<n>" */
+        char dir[LMAX_DEVPATH];
+        char name[LMAX_NAME];
+        char tport[LMAX_NAME];
+        char attr_val[SHOST_NUM_ATTRS][LMAX_NAME];
+        char device[LMAX_PATH];
+};
+
+/* Fills in *rp with what the options ask to be output about the SCSI host
+ * 'devname' in 'dir_name'. */
+static void
+collect_shost(const char * dir_name, const char * devname,
+              struct scan_ctx * sc, const struct lsscsi_opts * op,
+              struct shost_rec * rp)
+{
+        int k;
+        const char * nullname1 = "<NULL>";
+        const char * nullname2 = "(null)";
+        char wd[LMAX_PATH];
+
+        memset(rp, 0, offsetof(struct shost_rec, devname));
+        my_strcopy(rp->devname, devname, sizeof(rp->devname));
+        rp->host_id_ok = (1 == sscanf(devname, "host%u", &rp->host_id));
+        snprintf(rp->dir, sizeof(rp->dir), "%s/%s", dir_name, devname);
+        if ((get_value(rp->dir, "proc_name", rp->name, sizeof(rp->name))) &&
+            (strncmp(rp->name, nullname1, 6)) &&
+            (strncmp(rp->name, nullname2, 6)))
+                rp->name_ok = true;
+        else if (if_directory_resolve(rp->dir, "device/../driver", wd,
+                                      sizeof(wd))) {
+                my_strcopy(rp->name, basename(wd), sizeof(rp->name));
+                rp->name_ok = true;
+        }
+        if (op->transport_info || op->json) {
+                rp->tport_ok = transport_init(devname, sc, /* op, */
+                                              sizeof(rp->tport), rp->tport);
+                rp->transport_id = sc->transport_id;
+        }
+        if (op->json || ((op->long_opt > 0) && (! op->transport_info))) {
+                for (k = 0; k < SHOST_NUM_ATTRS; ++k) {
+                        if (get_value(rp->dir, shost_attrs[k],
+                                      rp->attr_val[k], LMAX_NAME))
+                                rp->attr_ok |= HA_BIT(k);
+                }
+        }
+        if (op->verbose > 0)
+                rp->device_ok = if_directory_resolve(rp->dir, "device",
+                                                     rp->device,
+                                                     sizeof(rp->device));
+}
+
 /* List host (initiator) attributes when --long given (one or more times). */
 static void
-longer_h_entry(const char * path_name, const struct lsscsi_opts * op)
+longer_h_entry(const struct shost_rec * rp, struct scan_ctx * sc,
+               const struct lsscsi_opts * op)
 {
-        char value[LMAX_NAME];
+        int k;
 
         if (op->transport_info) {
-                transport_init_longer(path_name, op);
+                transport_init_longer(rp->dir, sc, op);
                 return;
         }
         if (op->long_opt >= 3) {
-                if (get_value(path_name, "can_queue", value, sizeof(value)))
-                        printf("  can_queue=%s\n", value);
-                else if (op->verbose)
-                        printf("  can_queue=?\n");
-                if (get_value(path_name, "cmd_per_lun", value, sizeof(value)))
-                        printf("  cmd_per_lun=%s\n", value);
-                else if (op->verbose)
-                        printf("  cmd_per_lun=?\n");
-                if (get_value(path_name, "host_busy", value, sizeof(value)))
-                        printf("  host_busy=%s\n", value);
-                else if (op->verbose)
-                        printf("  host_busy=?\n");
-                if (get_value(path_name, "sg_tablesize", value,
-                              sizeof(value)))
-                        printf("  sg_tablesize=%s\n", value);
-                else if (op->verbose)
-                        printf("  sg_tablesize=?\n");
-                if (get_value(path_name, "state", value, sizeof(value)))
-                        printf("  state=%s\n", value);
-                else if (op->verbose)
-                        printf("  state=?\n");
-                if (get_value(path_name, "unchecked_isa_dma", value,
-                              sizeof(value)))
-                        printf("  unchecked_isa_dma=%s\n", value);
-                else if (op->verbose)
-                        printf("  unchecked_isa_dma=?\n");
-                if (get_value(path_name, "unique_id", value, sizeof(value)))
-                        printf("  unique_id=%s\n", value);
-                else if (op->verbose)
-                        printf("  unique_id=?\n");
+                for (k = 0; k < SHOST_NUM_ATTRS; ++k) {
+                        if (rp->attr_ok & HA_BIT(k))
+                                out_printf("  %s=%s\n", shost_attrs[k],
+                                           rp->attr_val[k]);
+                        else if (op->verbose)
+                                out_printf("  %s=?\n", shost_attrs[k]);
+                }
         } else if (op->long_opt > 0) {
-                if (get_value(path_name, "cmd_per_lun", value, sizeof(value)))
-                        printf("  cmd_per_lun=%-4s ", value);
+                if (rp->attr_ok & HA_BIT(HA_CMD_PER_LUN))
+                        out_printf("  cmd_per_lun=%-4s ",
+                                   rp->attr_val[HA_CMD_PER_LUN]);
                 else
-                        printf("  cmd_per_lun=???? ");
+                        out_printf("  cmd_per_lun=???? ");
 
-                if (get_value(path_name, "host_busy", value, sizeof(value)))
-                        printf("host_busy=%-4s ", value);
+                if (rp->attr_ok & HA_BIT(HA_HOST_BUSY))
+                        out_printf("host_busy=%-4s ",
+                                   rp->attr_val[HA_HOST_BUSY]);
                 else
-                        printf("host_busy=???? ");
+                        out_printf("host_busy=???? ");
 
-                if (get_value(path_name, "sg_tablesize", value,
-                              sizeof(value)))
-                        printf("sg_tablesize=%-4s ", value);
+                if (rp->attr_ok & HA_BIT(HA_SG_TABLESIZE))
+                        out_printf("sg_tablesize=%-4s ",
+                                   rp->attr_val[HA_SG_TABLESIZE]);
                 else
-                        printf("sg_tablesize=???? ");
+                        out_printf("sg_tablesize=???? ");
 
-                if (get_value(path_name, "unchecked_isa_dma", value,
-                              sizeof(value)))
-                        printf("unchecked_isa_dma=%-2s ", value);
+                if (rp->attr_ok & HA_BIT(HA_UNCHECKED_ISA_DMA))
+                        out_printf("unchecked_isa_dma=%-2s ",
+                                   rp->attr_val[HA_UNCHECKED_ISA_DMA]);
                 else
-                        printf("unchecked_isa_dma=?? ");
-                printf("\n");
+                        out_printf("unchecked_isa_dma=?? ");
+                out_printf("\n");
                 if (2 == op->long_opt) {
-                        if (get_value(path_name, "can_queue", value,
-                                      sizeof(value)))
-                                printf("  can_queue=%-4s ", value);
-                        if (get_value(path_name, "state", value,
-                                      sizeof(value)))
-                                printf("  state=%-8s ", value);
-                        if (get_value(path_name, "unique_id", value,
-                                      sizeof(value)))
-                                printf("  unique_id=%-2s ", value);
-                        printf("\n");
+                        if (rp->attr_ok & HA_BIT(HA_CAN_QUEUE))
+                                out_printf("  can_queue=%-4s ",
+                                           rp->attr_val[HA_CAN_QUEUE]);
+                        if (rp->attr_ok & HA_BIT(HA_STATE))
+                                out_printf("  state=%-8s ",
+                                           rp->attr_val[HA_STATE]);
+                        if (rp->attr_ok & HA_BIT(HA_UNIQUE_ID))
+                                out_printf("  unique_id=%-2s ",
+                                           rp->attr_val[HA_UNIQUE_ID]);
+                        out_printf("\n");
                 }
         }
 }
 
+/* Outputs a SCSI host on a line, then any --long lines */
+static void
+shost_render(const struct shost_rec * rp, struct scan_ctx * sc,
+             const struct lsscsi_opts * op)
+{
+        if (rp->host_id_ok)
+                out_printf("[%u]  ", rp->host_id);
+        else
+                out_printf("[?]  ");
+        if (rp->name_ok)
+                out_printf("  %-12s  ", rp->name);
+        else
+                out_printf("  proc_name=????  ");
+        if (rp->tport_ok)
+                out_printf("%s\n", rp->tport);
+        else
+                out_printf("\n");
+
+        if (op->long_opt > 0)
+                longer_h_entry(rp, sc, op);
+
+        if (op->verbose > 0)
+                out_printf("  dir: %s\n  device dir: %s\n", rp->dir,
+                           rp->device_ok ? rp->device : "");
+}
+
+/* Outputs a SCSI host as a --json record. NVMe controllers (see
+ * nhost_json_render()) have the same members. */
+static void
+shost_json_render(const struct shost_rec * rp, const struct lsscsi_opts * op)
+{
+        int k;
+
+        json_rec_begin(op);
+        json_str("name", rp->devname);
+        json_num("host", rp->host_id_ok, rp->host_id);
+        json_num("controller", false, 0);
+        json_str("driver", rp->name_ok ? rp->name : NULL);
+        json_str("device", NULL);
+        json_str("maj_min", NULL);
+        json_str("model", NULL);
+        json_str("serial", NULL);
+        json_str("rev", NULL);
+        json_str("transport_type", rp->tport_ok ?
+                                   transport_names[rp->transport_id] : NULL);
+        json_str("transport", rp->tport_ok ? rp->tport : NULL);
+        json_obj_begin("attributes");
+        for (k = 0; k < SHOST_NUM_ATTRS; ++k) {
+                if (rp->attr_ok & HA_BIT(k))
+                        json_str(shost_attrs[k], rp->attr_val[k]);
+        }
+        json_obj_end();
+        json_rec_end();
+}
+
 static void
 one_host_entry(const char * dir_name, const char * devname,
-               const struct lsscsi_opts * op)
+               struct scan_ctx * sc, const struct lsscsi_opts * op)
 {
-        unsigned int host_id;
-        const char * nullname1 = "<NULL>";
-        const char * nullname2 = "(null)";
-        char buff[LMAX_DEVPATH];
-        char value[LMAX_NAME];
-        char wd[LMAX_PATH];
+        struct shost_rec rec;
 
         if (op->classic) {
                 // one_classic_host_entry(dir_name, devname, op);
-                printf("  <'--classic' not supported for hosts>\n");
+                out_printf("  <'--classic' not supported for hosts>\n");
                 return;
         }
-        if (1 == sscanf(devname, "host%u", &host_id))
-                printf("[%u]  ", host_id);
+        collect_shost(dir_name, devname, sc, op, &rec);
+        if (op->json)
+                shost_json_render(&rec, op);
         else
-                printf("[?]  ");
-        snprintf(buff, sizeof(buff), "%s/%s", dir_name, devname);
-        if ((get_value(buff, "proc_name", value, sizeof(value))) &&
-            (strncmp(value, nullname1, 6)) && (strncmp(value, nullname2, 6)))
-                printf("  %-12s  ", value);
-        else if (if_directory_chdir(buff, "device/../driver")) {
-                if (NULL == getcwd(wd, sizeof(wd)))
-                        printf("  %-12s  ", nullname2);
-                else
-                        printf("  %-12s  ", basename(wd));
-
-        } else
-                printf("  proc_name=????  ");
-        if (op->transport_info) {
-                if (transport_init(devname, /* op, */ sizeof(value), value))
-                        printf("%s\n", value);
-                else
-                        printf("\n");
-        } else
-                printf("\n");
-
-        if (op->long_opt > 0)
-                longer_h_entry(buff, op);
-
-        if (op->verbose > 0) {
-                printf("  dir: %s\n  device dir: ", buff);
-                if (if_directory_chdir(buff, "device")) {
-                        if (NULL == getcwd(wd, sizeof(wd)))
-                                printf("?");
-                        else
-                                printf("%s", wd);
-                }
-                printf("\n");
-        }
+                shost_render(&rec, sc, op);
 }
 
 static int
-host_dir_scan_select(const struct dirent * s)
+host_dir_scan_select(const struct dirent * s, void * ctx)
 {
+        const struct lsscsi_opts * op = (const struct lsscsi_opts *)ctx;
         int h;
 
         if (0 == strncmp("host", s->d_name, 4)) {
-                if (filter_active) {
-                        if (-1 == filter.h)
+                if (op->filter_active) {
+                        if (-1 == op->filter.h)
                                 return 1;
                         else if ((1 == sscanf(s->d_name + 4, "%d", &h) &&
-                                 (h == filter.h)))
+                                 (h == op->filter.h)))
                                 return 1;
                         else
                                 return 0;
@@ -4351,25 +7957,19 @@ host_dir_scan_select(const struct dirent * s)
         return 0;
 }
 
-/* Returns -1 if (a->d_name < b->d_name) ; 0 if they are equal
- * and 1 otherwise.
- */
-static int
-shost_scandir_sort(const struct dirent ** a, const struct dirent ** b)
+/* Sort key for SCSI host names, "host<h>" becomes h:0:0:0 */
+static bool
+shost_sort_key(const char * name, struct addr_hctl * kp)
 {
-        unsigned int l, r;
-        const char * lnam = (*a)->d_name;
-        const char * rnam = (*b)->d_name;
+        unsigned int h;
 
-        if (1 != sscanf(lnam, "host%u", &l))
-                return -1;
-        if (1 != sscanf(rnam, "host%u", &r))
-                return 1;
-        if (l < r)
-                return -1;
-        else if (r < l)
-                return 1;
-        return 0;
+        if ((1 != sscanf(name, "host%u", &h)) || (h > INT_MAX))
+                return false;
+        kp->h = (int)h;
+        kp->c = 0;
+        kp->t = 0;
+        kp->l = 0;
+        return true;
 }
 
 static void
@@ -4379,11 +7979,12 @@ list_shosts(const struct lsscsi_opts * op)
         struct dirent ** namelist;
         char buff[LMAX_DEVPATH];
         char name[LMAX_NAME];
+        struct scan_ctx sc;
 
         snprintf(buff, sizeof(buff), "%s%s", sysfsroot, scsi_host);
 
-        num = scandir(buff, &namelist, host_dir_scan_select,
-                      shost_scandir_sort);
+        num = sysfs_scandir_ctx(buff, &namelist, host_dir_scan_select,
+                                shost_sort_key, (void *)op);
         if (num < 0) {
                 snprintf(name, sizeof(name), "%s: scandir: %s",
                          __func__, buff);
@@ -4391,12 +7992,12 @@ list_shosts(const struct lsscsi_opts * op)
                 return;
         }
         if (op->classic)
-                printf("Attached hosts: %s\n", (num ? "" : "none"));
+                out_printf("Attached hosts: %s\n", (num ? "" : "none"));
 
         for (k = 0; k < num; ++k) {
                 my_strcopy(name, namelist[k]->d_name, sizeof(name));
-                transport_id = TRANSPORT_UNKNOWN;
-                one_host_entry(buff, name, op);
+                scan_ctx_init(&sc);
+                one_host_entry(buff, name, &sc, op);
                 free(namelist[k]);
         }
         free(namelist);
@@ -4415,25 +8016,24 @@ list_nhosts(const struct lsscsi_opts * op)
 
         snprintf(buff, sizeof(buff), "%s%s", sysfsroot, class_nvme);
 
-        num = scandir(buff, &namelist, ndev_dir_scan_select,
-                      nhost_scandir_sort);
+        num = sysfs_scandir_ctx(buff, &namelist, ndev_dir_scan_select,
+                                nhost_sort_key, (void *)op);
         if (num < 0) {  /* NVMe module may not be loaded */
                 if (op->verbose > 0) {
                         snprintf(ebuf, sizeof(ebuf), "%s: scandir: %s",
                                  __func__, buff);
                         perror(ebuf);
-                        printf("NVMe module may not be loaded\n");
+                        if (! op->json)
+                                out_printf("NVMe module may not be "
+                                           "loaded\n");
                 }
                 return;
         }
         for (k = 0; k < num; ++k) {
-                transport_id = TRANSPORT_UNKNOWN;
                 one_nhost_entry(buff, namelist[k]->d_name, op);
                 free(namelist[k]);
         }
         free(namelist);
-        if (op->wwn)
-                free_disk_wwn_node_list();
 }
 
 #endif          /* (HAVE_NVME && (! IGNORE_NVME)) */
@@ -4568,31 +8168,275 @@ err_out:
         return false;
 }
 
+/* Compiles the options, including --columns=LIST , into op->plan .
+ * Returns false if LIST is not valid. */
+static bool
+make_col_plan(struct lsscsi_opts * op, bool do_hosts)
+{
+        if (op->json && op->classic) {
+                pr2serr("--classic ignored when --json given\n");
+                op->classic = false;
+        }
+        if (op->json && op->columns)
+                pr2serr("--columns ignored when --json given\n");
+        else if (op->columns) {
+                if (do_hosts)
+                        pr2serr("--columns ignored when --hosts given\n");
+                else if (op->classic)
+                        pr2serr("--columns ignored when --classic given\n");
+                else if (! parse_columns(op->columns, op))
+                        return false;
+        }
+        plan_sdev(op);
+#if (HAVE_NVME && (! IGNORE_NVME))
+        plan_ndev(op);
+#endif
+        return true;
+}
+
+/* With --cache=DIR the output is kept in a file in DIR, after a header
+ * holding what it depends on: the version of this utility, the boot_id,
+ * sysfsroot, the options and the kernel's uevent sequence number. A later
+ * run whose header matches copies the kept output to stdout rather than
+ * walking sysfs. Adding or removing a device (or any other uevent) bumps
+ * the sequence number, so the next run rebuilds the cache. While the
+ * cache is being built, output still goes to stdout as it is produced
+ * (so --json-seq keeps streaming) and each flush is also written to the
+ * new cache file. */
+static const char * boot_id_path = "/proc/sys/kernel/random/boot_id";
+static const char * uevent_seqnum = "/kernel/uevent_seqnum";
+
+struct out_cache {
+        int fd;                 /* new cache file while output is written */
+        int hdr_len;            /* output starts after the header */
+        char seqnum[32];
+        char hdr[LMAX_PATH + 512];
+        char path[LMAX_PATH];
+        char tmp_path[LMAX_PATH];
+};
+
+/* Reads the first line of the (small) file 'path' into b without its
+ * trailing newline. Returns true if it is not empty. */
+static bool
+cache_read_line(const char * path, char * b, int b_len)
+{
+        int fd, n;
+        char * cp;
+
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+                return false;
+        n = read(fd, b, b_len - 1);
+        close(fd);
+        if (n <= 0)
+                return false;
+        b[n] = '\0';
+        cp = strchr(b, '\n');
+        if (cp)
+                *cp = '\0';
+        return ('\0' != b[0]);
+}
+
+static bool
+cache_seqnum(char * b, int b_len)
+{
+        char path[LMAX_PATH];
+
+        snprintf(path, sizeof(path), "%s%s", sysfsroot, uevent_seqnum);
+        return cache_read_line(path, b, b_len);
+}
+
+/* Builds the cache's header and file name. Returns false if the output
+ * is not to be cached, or there is no boot_id or uevent sequence number
+ * to key on, in which case the cache is not used. */
+static bool
+cache_init(struct out_cache * ocp, const char * dir, bool do_hosts,
+           const struct lsscsi_opts * op)
+{
+        int n;
+        const int hlen = sizeof(ocp->hdr);
+        const struct addr_hctl * fp = &op->filter;
+        char boot_id[64];
+
+        memset(ocp, 0, sizeof(*ocp));
+        ocp->fd = -1;
+        /* --long and --json output sysfs attributes (e.g. state and the
+         * I/O counters) that change without a uevent, as may --columns */
+        if ((op->long_opt > 0) || op->json ||
+            (op->plan.sdev_attrs & SA_LIVE_MASK)) {
+                if (op->verbose > 0)
+                        pr2serr("%s: output has live attributes, not "
+                                "caching\n", __func__);
+                return false;
+        }
+        if (! (cache_read_line(boot_id_path, boot_id, sizeof(boot_id)) &&
+               cache_seqnum(ocp->seqnum, sizeof(ocp->seqnum)))) {
+                if (op->verbose > 0)
+                        pr2serr("%s: no boot_id or uevent_seqnum, not "
+                                "caching\n", __func__);
+                return false;
+        }
+        /* --jobs is left out as it does not change stdout. --verbose is
+         * kept: -v adds 'dir:' lines and -vv the sysfsroot line */
+        n = snprintf(ocp->hdr, hlen, "lsscsi cache\nversion=%s\nboot_id=%s\n"
+                     "sysfsroot=%s\nopts=%s%s%s%s%s%s%s%s%s%s%s%s%s%s "
+                     "l=%d x=%d s=%d u=%d v=%d j=%d f=%d:%d:%d:%" PRIx64 "\n"
+                     "columns=%s\n",
+                     version_str, boot_id, sysfsroot, do_hosts ? "H" : "",
+                     op->brief ? "b" : "", op->classic ? "c" : "",
+                     op->dev_maj_min ? "d" : "", op->enclosure ? "e" : "",
+                     op->generic ? "g" : "", op->kname ? "k" : "",
+                     op->no_nvme ? "N" : "", op->pdt ? "D" : "",
+                     op->protection ? "p" : "", op->protmode ? "P" : "",
+                     op->scsi_id ? "i" : "", op->transport_info ? "t" : "",
+                     op->wwn ? "w" : "", op->long_opt, op->lunhex,
+                     op->ssize, op->unit, op->verbose,
+                     op->json, fp->h, fp->c, fp->t, fp->l,
+                     op->columns ? op->columns : "");
+        if ((n < 0) || (n >= hlen)) {
+                pr2serr("%s: header too long, not caching\n", __func__);
+                return false;
+        }
+        /* one file for each key, apart from the sequence number */
+        snprintf(ocp->path, sizeof(ocp->path), "%s/lsscsi-%08x.cache", dir,
+                 str_hash(ocp->hdr));
+        snprintf(ocp->tmp_path, sizeof(ocp->tmp_path), "%s/.lsscsi-XXXXXX",
+                 dir);
+        n += snprintf(ocp->hdr + n, hlen - n, "seqnum=%s\n\n", ocp->seqnum);
+        ocp->hdr_len = (n < hlen) ? n : (hlen - 1);
+        return true;
+}
+
+/* Writes all of the n bytes at bp to fd. Returns false on error. */
+static bool
+cache_write(int fd, const char * bp, int n)
+{
+        int k;
+
+        for ( ; n > 0; n -= k, bp += k) {
+                k = write(fd, bp, n);
+                if (k < 0) {
+                        if (EINTR == errno) {
+                                k = 0;
+                                continue;
+                        }
+                        return false;
+                }
+        }
+        return true;
+}
+
+/* If the cache file matches the header, copy the output it holds to
+ * stdout and return true. The file must be a regular file owned by this
+ * user and writable by no one else. */
+static bool
+cache_hit(const struct out_cache * ocp, const struct lsscsi_opts * op)
+{
+        int fd, n;
+        struct stat st;
+        char b[16384];
+
+        fd = open(ocp->path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd < 0)
+                return false;
+        if ((fstat(fd, &st) < 0) || (! S_ISREG(st.st_mode)) ||
+            (st.st_uid != geteuid()) || (st.st_mode & (S_IWGRP | S_IWOTH)))
+                goto miss;
+        n = read(fd, b, sizeof(b));
+        if ((n < ocp->hdr_len) || memcmp(b, ocp->hdr, ocp->hdr_len))
+                goto miss;
+        if (op->verbose > 0)
+                pr2serr("output from %s\n", ocp->path);
+        n -= ocp->hdr_len;
+        memmove(b, b + ocp->hdr_len, n);
+        do {
+                if (! cache_write(STDOUT_FILENO, b, n))
+                        break;
+        } while ((n = read(fd, b, sizeof(b))) > 0);
+        close(fd);
+        return true;
+miss:
+        close(fd);
+        return false;
+}
+
+/* Starts a new cache file, after its header, that is sent a copy of what
+ * is written to stdout. */
+static void
+cache_begin(struct out_cache * ocp, const struct lsscsi_opts * op)
+{
+        ocp->fd = mkstemp(ocp->tmp_path);
+        if (ocp->fd < 0) {
+                if (op->verbose > 0)
+                        perror(ocp->tmp_path);
+                return;
+        }
+        out_flush();
+        if (! cache_write(ocp->fd, ocp->hdr, ocp->hdr_len)) {
+                if (op->verbose > 0)
+                        perror("cache_begin");
+                close(ocp->fd);
+                unlink(ocp->tmp_path);
+                ocp->fd = -1;
+                return;
+        }
+        out_tee(ocp->fd);
+}
+
+/* Stops copying stdout to the new cache file, which then replaces the
+ * old one, unless a write to it failed or a uevent has arrived since the
+ * header was built (the output may then be a mix of old and new). */
+static void
+cache_end(struct out_cache * ocp)
+{
+        bool ok;
+        char seqnum[32];
+
+        if (ocp->fd < 0)
+                return;
+        out_flush();
+        ok = ! out_ar.tee_err;
+        out_tee(-1);
+        if (close(ocp->fd) < 0)
+                ok = false;
+        ok = ok && cache_seqnum(seqnum, sizeof(seqnum)) &&
+             (0 == strcmp(seqnum, ocp->seqnum));
+        if (! (ok && (0 == rename(ocp->tmp_path, ocp->path))))
+                unlink(ocp->tmp_path);
+}
+
 
 int
 main(int argc, char **argv)
 {
         bool do_sdevices = true;
         bool do_hosts = false;  /* checked before do_sdevices */
+        bool cached = false;
         int c;
         int version_count = 0;
         const char * cp;
+        const char * cache_dir = NULL;
         struct lsscsi_opts * op;
         struct lsscsi_opts opts;
+        struct out_cache oc;
 
         op = &opts;
         cp = getenv("LSSCSI_LUNHEX_OPT");
-        invalidate_hctl(&filter);
         memset(op, 0, sizeof(opts));
+        invalidate_hctl(&op->filter);
         while (1) {
                 int option_index = 0;
 
-                c = getopt_long(argc, argv, "bcCdDghHiklLNpPsStuUvVwxy:",
+                c = getopt_long(argc, argv,
+                                "a:bcCdDeghHij:JklLNo:pPQsStuUvVwxy:",
                                 long_options, &option_index);
                 if (c == -1)
                         break;
 
                 switch (c) {
+                case 'a':
+                        cache_dir = optarg;
+                        break;
                 case 'b':
                         op->brief = true;
                         break;
@@ -4608,6 +8452,9 @@ main(int argc, char **argv)
                 case 'D':       /* --pdt */
                         op->pdt = true;
                         break;
+                case 'e':
+                        op->enclosure = true;
+                        break;
                 case 'g':
                         op->generic = true;
                         break;
@@ -4620,6 +8467,17 @@ main(int argc, char **argv)
                 case 'i':
                         op->scsi_id = true;
                         break;
+                case 'j':
+                        op->jobs = atoi(optarg);
+                        if ((op->jobs < 1) || (op->jobs > MAX_JOBS)) {
+                                pr2serr("--jobs= expects a number from 1 to "
+                                        "%d\n", MAX_JOBS);
+                                return 1;
+                        }
+                        break;
+                case 'J':
+                        op->json = 1;
+                        break;
                 case 'k':
                         op->kname = true;
                         break;
@@ -4632,12 +8490,18 @@ main(int argc, char **argv)
                 case 'N':
                         op->no_nvme = true;
                         break;
+                case 'o':
+                        op->columns = optarg;
+                        break;
                 case 'p':
                         op->protection = true;
                         break;
                 case 'P':
                         op->protmode = true;
                         break;
+                case 'Q':
+                        op->json = 2;
+                        break;
                 case 's':
                         ++op->ssize;
                         break;
@@ -4728,15 +8592,16 @@ main(int argc, char **argv)
                 if ((0 == memcmp("host", a1p, 4)) ||
                     (0 == memcmp("HOST", a1p, 4))) {
                         if (! decode_filter_arg(a1p + 4, a2p, a3p, a4p,
-                                                &filter))
+                                                &op->filter))
                                 return 1;
                 } else {
-                        if (! decode_filter_arg(a1p, a2p, a3p, a4p, &filter))
+                        if (! decode_filter_arg(a1p, a2p, a3p, a4p,
+                                                &op->filter))
                                 return 1;
                 }
-                if ((filter.h != -1) || (filter.c != -1) ||
-                    (filter.t != -1) || (filter.l != UINT64_LAST))
-                        filter_active = true;
+                if ((op->filter.h != -1) || (op->filter.c != -1) ||
+                    (op->filter.t != -1) || (op->filter.l != UINT64_LAST))
+                        op->filter_active = true;
         }
         if ((0 == op->lunhex) && cp) {
                 if (1 == sscanf(cp, "%d", &c))
@@ -4761,8 +8626,19 @@ main(int argc, char **argv)
                         return 1;
                 }
         }
-        if (op->verbose > 1) {
-                printf(" sysfsroot: %s\n", sysfsroot);
+        if (! make_col_plan(op, do_hosts))
+                return 1;
+        if (cache_dir && cache_init(&oc, cache_dir, do_hosts, op)) {
+                if (cache_hit(&oc, op))
+                        return 0;
+                cache_begin(&oc, op);
+                cached = true;
+        }
+        out_init(op->json > 0);
+        if (op->json)
+                json_begin(do_hosts ? "hosts" : "devices", op);
+        else if (op->verbose > 1) {
+                out_printf(" sysfsroot: %s\n", sysfsroot);
         }
         if (do_hosts) {
                 list_shosts(op);
@@ -4777,8 +8653,24 @@ main(int argc, char **argv)
                         list_ndevices(op);
 #endif
         }
+        json_end(op);
+        if (cached)
+                cache_end(&oc);
+        else
+                out_flush();
 
         free_dev_node_list();
+        free_disk_wwn_node_list();
+        free_byid_nodes();
+        free_lu_map();
+        free_host_tports();
+        free_fc_targets();
+        free_iscsi_sessions();
+        free_encl_slots();
+#if HAVE_IO_URING
+        uring_fini();
+#endif
+        sysfs_close_fds();
 
         return 0;
 }
@@ -0,0 +1,191 @@
+#!/bin/sh
+# Times lsscsi against synthetic sysfs trees of increasing size. Trees are
+# built by mk_fake_sysfs (in this directory) and lsscsi is pointed at them
+# with --sysfsroot . Each option set is run several times and the fastest
+# wall clock time is reported, so the numbers from two builds (e.g. before
+# and after a change) can be compared.
+#
+# When run as root, and unshare(1) is available, the fake ROOT/dev tree is
+# bind mounted over /dev in a private mount namespace so device node and
+# /dev/disk/by-id lookups see matching entries. Otherwise those lookups go
+# to the real /dev and mostly fail, which still exercises the code paths.
+#
+# Usually invoked via 'make bench' which passes -b and -g .
+
+usage()
+{
+        cat >&2 <<EOF
+Usage: bench_lsscsi.sh [-b LSSCSI] [-d DIR] [-g GEN] [-h] [-k] [-o OPTS]
+                       [-r RUNS] [-s SIZES]
+  where:
+    -b LSSCSI    lsscsi binary to time (def: ../src/lsscsi)
+    -d DIR       directory holding the generated trees
+                 (def: \${TMPDIR:-/tmp}/lsscsi_bench)
+    -g GEN       mk_fake_sysfs binary (def: ./mk_fake_sysfs)
+    -h           print out usage message
+    -k           keep the generated trees (def: at exit remove the trees
+                 generated by this run, nothing else in DIR)
+    -o OPTS      ';' separated lsscsi option sets to time (def: see below)
+    -r RUNS      runs of each option set, fastest is reported (def: 3)
+    -s SIZES     approximate numbers of SCSI LUNs (def: '100 10000 100000')
+
+Default option sets: $DEF_OPTS
+EOF
+}
+
+DEF_OPTS=";-g;-l;-ll;-c;-t;-tL;-u;-i;-w;-s;-d;-H;-Ht;-Hl;-N"
+
+BIN=../src/lsscsi
+GEN=./mk_fake_sysfs
+DIR=${TMPDIR:-/tmp}/lsscsi_bench
+KEEP=
+OPTS=$DEF_OPTS
+RUNS=3
+SIZES="100 10000 100000"
+
+while getopts "b:d:g:hko:r:s:" opt ; do
+        case $opt in
+        b) BIN=$OPTARG ;;
+        d) DIR=$OPTARG ;;
+        g) GEN=$OPTARG ;;
+        h) usage ; exit 0 ;;
+        k) KEEP=1 ;;
+        o) OPTS=$OPTARG ;;
+        r) RUNS=$OPTARG ;;
+        s) SIZES=$OPTARG ;;
+        *) usage ; exit 1 ;;
+        esac
+done
+
+for f in "$BIN" "$GEN" ; do
+        if [ ! -x "$f" ] ; then
+                echo "bench_lsscsi.sh: $f not found (or not executable)" >&2
+                exit 1
+        fi
+done
+case $BIN in
+        /*) ;;
+        *) BIN=$(pwd)/$BIN ;;
+esac
+case $GEN in
+        /*) ;;
+        *) GEN=$(pwd)/$GEN ;;
+esac
+
+# Re-run in a private mount namespace so ROOT/dev can be put over /dev
+if [ -z "$BENCH_IN_NS" ] && [ "$(id -u)" = 0 ] && \
+   command -v unshare > /dev/null 2>&1 ; then
+        BENCH_IN_NS=1
+        export BENCH_IN_NS
+        if unshare -m --propagation private true 2> /dev/null ; then
+                exec unshare -m --propagation private /bin/sh "$0" \
+                        -b "$BIN" -d "$DIR" -g "$GEN" ${KEEP:+-k} \
+                        -o "$OPTS" -r "$RUNS" -s "$SIZES"
+        fi
+        BENCH_IN_NS=
+fi
+
+# Only what this run created is removed: DIR may be given with -d and
+# hold other files
+MADE=
+MADE_DIR=
+cleanup()
+{
+        rm -f "$DIR/out" "$DIR/err"
+        if [ -z "$KEEP" ] ; then
+                for t in $MADE ; do
+                        rm -rf "$DIR/$t"
+                done
+                if [ -n "$MADE_DIR" ] ; then
+                        rmdir "$DIR" 2> /dev/null
+                fi
+        fi
+}
+trap cleanup EXIT
+trap 'exit 1' HUP INT TERM
+
+if [ ! -d "$DIR" ] ; then
+        mkdir -p "$DIR" || exit 1
+        MADE_DIR=1
+fi
+
+# Prints H T L N for a tree with about $1 LUNs: H hosts, T targets per
+# host, L LUNs per target and N NVMe controllers (with 4 namespaces each)
+shape()
+{
+        if [ "$1" -le 200 ] ; then
+                echo "4 5 $(( ($1 + 19) / 20 )) 2"
+        elif [ "$1" -le 20000 ] ; then
+                echo "20 25 $(( ($1 + 499) / 500 )) 8"
+        else
+                echo "50 100 $(( ($1 + 4999) / 5000 )) 32"
+        fi
+}
+
+# Seconds since the epoch with nanoseconds
+now()
+{
+        date +%s.%N
+}
+
+# Prints $2 - $1 (both from now())
+elapsed()
+{
+        awk "BEGIN { printf \"%.6f\", $2 - $1 }"
+}
+
+echo "lsscsi: $BIN"
+"$BIN" -V 2>&1 | sed 's/^/  /'
+for size in $SIZES ; do
+        set -- $(shape "$size")
+        tree=$DIR/$size
+        if [ ! -d "$tree/sys" ] ; then
+                if [ ! -d "$tree" ] ; then
+                        mkdir "$tree" || exit 1
+                        MADE="$MADE $size"
+                fi
+                t0=$(now)
+                "$GEN" -H "$1" -T "$2" -L "$3" -n "$4" -N 4 -M 8 "$tree" || \
+                        exit 1
+                t1=$(now)
+                gen=$(elapsed "$t0" "$t1")
+        else
+                gen="(kept)"
+        fi
+        luns=$(ls "$tree/sys/bus/scsi/devices" | \
+               grep -c '^[0-9]*:[0-9]*:[0-9]*:[0-9]*$')
+        dev=real
+        if [ -n "$BENCH_IN_NS" ] && mount --bind "$tree/dev" /dev ; then
+                dev=fake
+        fi
+        echo
+        echo "$luns SCSI LUs ($1 hosts x $2 targets x $3 LUNs, $4 NVMe" \
+             "controllers), /dev: $dev, generated in $gen s"
+        printf "  %-12s %10s %10s\n" "options" "best (s)" "lines"
+        IFS=';'
+        for o in $OPTS ; do
+                unset IFS
+                best=
+                k=0
+                while [ $k -lt "$RUNS" ] ; do
+                        t0=$(now)
+                        # no /dev/null when the fake /dev is mounted
+                        "$BIN" --sysfsroot="$tree/sys" $o > "$DIR/out" \
+                                2> "$DIR/err"
+                        t1=$(now)
+                        t=$(elapsed "$t0" "$t1")
+                        if [ -z "$best" ] || \
+                           awk "BEGIN { exit !($t < $best) }" ; then
+                                best=$t
+                        fi
+                        k=$((k + 1))
+                done
+                printf "  %-12s %10.4f %10d\n" "${o:-(none)}" "$best" \
+                        "$(wc -l < "$DIR/out")"
+                IFS=';'
+        done
+        unset IFS
+        if [ "$dev" = fake ] ; then
+                umount /dev
+        fi
+done
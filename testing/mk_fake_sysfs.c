@@ -0,0 +1,1094 @@
+/* Generates a synthetic sysfs tree (plus a matching /dev tree) that lsscsi
+ * can be pointed at with its '--sysfsroot=' option. The layout mimics what
+ * recent Linux kernels expose for SAS, FC, iSCSI, SPI, SATA and USB attached
+ * SCSI devices and for NVMe controllers and namespaces. It is intended for
+ * timing lsscsi against topologies much larger than any test machine has.
+ *
+ *  Copyright (C) 2026 the lsscsi contributors (see the CREDITS file and
+ *  the git history of this file)
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2, or (at your option)
+ *  any later version.
+ */
+
+#define _XOPEN_SOURCE 600
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/types.h>
+#include <linux/limits.h>
+
+
+static const char * version_str = "1.00 20261016";
+
+#define MODE_SAS 0
+#define MODE_FC 1
+#define MODE_ISCSI 2
+#define MODE_SPI 3
+#define MODE_SATA 4
+#define MODE_USB 5
+#define MODE_MIX 6
+
+static const char * mode_names[] = {
+        "sas", "fc", "iscsi", "spi", "sata", "usb", "mix", NULL,
+};
+
+struct gen_opts {
+        bool no_dev;            /* don't create device nodes */
+        int num_expanders;      /* cascaded SAS expanders per host */
+        int num_hosts;
+        int num_targets;        /* per host */
+        int num_luns;           /* per target */
+        int num_nvme_ctls;
+        int num_nvme_ns;        /* per controller */
+        int mode;
+        int mpath_every;        /* every n-th disk gets a dm holder instead */
+        int verbose;
+};
+
+static char root[PATH_MAX];
+static int sd_count;            /* next sd<x> index */
+static int sg_count;            /* next sg<n> minor */
+static int st_count;
+static int dm_count;
+static int iscsi_session_count;
+static long files_made;
+
+static struct option long_options[] = {
+        {"expanders", required_argument, 0, 'E'},
+        {"help", no_argument, 0, 'h'},
+        {"hosts", required_argument, 0, 'H'},
+        {"luns", required_argument, 0, 'L'},
+        {"mode", required_argument, 0, 'm'},
+        {"mpath", required_argument, 0, 'M'},
+        {"no-dev", no_argument, 0, 'D'},
+        {"nvme", required_argument, 0, 'n'},
+        {"namespaces", required_argument, 0, 'N'},
+        {"targets", required_argument, 0, 'T'},
+        {"verbose", no_argument, 0, 'v'},
+        {"version", no_argument, 0, 'V'},
+        {0, 0, 0, 0},
+};
+
+static void
+usage(void)
+{
+        fprintf(stderr,
+                "Usage: mk_fake_sysfs [--expanders=X] [--help] [--hosts=H] "
+                "[--luns=L]\n"
+                "                     [--mode=M] [--mpath=E] "
+                "[--namespaces=N] [--no-dev]\n"
+                "                     [--nvme=C] [--targets=T] [--verbose] "
+                "[--version] ROOT\n"
+                "  where:\n"
+                "    --expanders=X|-E X SAS targets sit behind X "
+                "cascaded expanders\n"
+                "                       (def: 0 -> attached to the HBA)\n"
+                "    --help|-h          print out usage message\n"
+                "    --hosts=H|-H H     number of SCSI hosts (def: 2)\n"
+                "    --luns=L|-L L      LUNs per target (def: 2)\n"
+                "    --mode=M|-m M      transport: sas, fc, iscsi, spi, "
+                "sata, usb or mix\n"
+                "                       (def: mix, cycles through the "
+                "others per host)\n"
+                "    --mpath=E|-M E     every E-th disk is claimed by a "
+                "dm-mpath holder\n"
+                "                       (def: 0 -> none)\n"
+                "    --namespaces=N|-N N    namespaces per NVMe controller "
+                "(def: 2)\n"
+                "    --no-dev|-D        do not create ROOT/dev device "
+                "nodes\n"
+                "    --nvme=C|-n C      number of NVMe controllers (def: 1)\n"
+                "    --targets=T|-T T   targets per host (def: 2)\n"
+                "    --verbose|-v       report what is being built\n"
+                "    --version|-V       print version string then exit\n\n"
+                "Builds ROOT/sys (use with 'lsscsi --sysfsroot=ROOT/sys') "
+                "and ROOT/dev.\nOne enclosure LU is added to each SAS "
+                "host, with a slot for LUN 0 of each\nof its targets, "
+                "and one tape LU to each SPI host.\n");
+}
+
+static void
+die(const char * what, const char * path)
+{
+        fprintf(stderr, "mk_fake_sysfs: %s: %s: %s\n", what, path,
+                strerror(errno));
+        exit(1);
+}
+
+/* vsnprintf() that gives up, rather than build a tree with truncated
+ * paths or values. Returns the length of the string placed in b. */
+static int
+vxsnprintf(char * b, int blen, const char * fmt, va_list args)
+{
+        int n = vsnprintf(b, blen, fmt, args);
+
+        if ((n < 0) || (n >= blen)) {
+                fprintf(stderr, "mk_fake_sysfs: too long (%d bytes max): "
+                        "%.60s...\n", blen - 1, b);
+                exit(1);
+        }
+        return n;
+}
+
+#ifdef __GNUC__
+static int xsnprintf(char * b, int blen, const char * fmt, ...)
+        __attribute__ ((format (printf, 3, 4)));
+#endif
+
+static int
+xsnprintf(char * b, int blen, const char * fmt, ...)
+{
+        int n;
+        va_list args;
+
+        va_start(args, fmt);
+        n = vxsnprintf(b, blen, fmt, args);
+        va_end(args);
+        return n;
+}
+
+/* Like 'mkdir -p' with 'path' relative to root */
+static void
+mkdirs(const char * path)
+{
+        char b[PATH_MAX];
+        char * cp;
+
+        xsnprintf(b, sizeof(b), "%s/%s", root, path);
+        for (cp = b + 1; *cp; ++cp) {
+                if ('/' != *cp)
+                        continue;
+                *cp = '\0';
+                if ((mkdir(b, 0755) < 0) && (EEXIST != errno))
+                        die("mkdir", b);
+                *cp = '/';
+        }
+        if ((mkdir(b, 0755) < 0) && (EEXIST != errno))
+                die("mkdir", b);
+}
+
+static void
+mkparent(const char * path)
+{
+        char b[PATH_MAX];
+        char * cp;
+
+        xsnprintf(b, sizeof(b), "%s", path);
+        cp = strrchr(b, '/');
+        if (cp) {
+                *cp = '\0';
+                mkdirs(b);
+        }
+}
+
+/* Writes 'len' bytes from 'vp' to the file 'fmt' (relative to root) */
+static void
+wrbin(const void * vp, int len, const char * fmt, ...)
+{
+        int fd;
+        va_list args;
+        char rel[PATH_MAX];
+        char b[PATH_MAX];
+
+        va_start(args, fmt);
+        vxsnprintf(rel, sizeof(rel), fmt, args);
+        va_end(args);
+        mkparent(rel);
+        xsnprintf(b, sizeof(b), "%s/%s", root, rel);
+        fd = open(b, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+                die("open", b);
+        if (len != write(fd, vp, len))
+                die("write", b);
+        close(fd);
+        ++files_made;
+}
+
+/* Writes sysfs attribute 'val' (plus a trailing LF) to 'fmt' */
+static void
+wr(const char * val, const char * fmt, ...)
+{
+        va_list args;
+        char rel[PATH_MAX];
+        char b[1024];
+
+        va_start(args, fmt);
+        vxsnprintf(rel, sizeof(rel), fmt, args);
+        va_end(args);
+        xsnprintf(b, sizeof(b), "%s\n", val);
+        wrbin(b, strlen(b), "%s", rel);
+}
+
+/* Creates symlink 'fmt' (relative to root) pointing at 'target' which is
+ * also relative to root. The link text is made relative, as the kernel
+ * does. */
+static void
+lnk(const char * target, const char * fmt, ...)
+{
+        int k, n;
+        const char * lp;
+        const char * tp;
+        const char * cp;
+        va_list args;
+        char rel[PATH_MAX];
+        char txt[PATH_MAX];
+        char b[PATH_MAX];
+
+        va_start(args, fmt);
+        vxsnprintf(rel, sizeof(rel), fmt, args);
+        va_end(args);
+        mkparent(rel);
+        /* find common leading directories of rel and target */
+        for (lp = rel, tp = target, cp = rel; *lp && (*lp == *tp);
+             ++lp, ++tp) {
+                if ('/' == *lp)
+                        cp = lp + 1;
+        }
+        tp = target + (cp - rel);
+        n = 0;
+        txt[0] = '\0';
+        for (lp = cp; *lp; ++lp) {
+                if ('/' == *lp)
+                        n += xsnprintf(txt + n, sizeof(txt) - n, "../");
+        }
+        xsnprintf(txt + n, sizeof(txt) - n, "%s", tp);
+        k = strlen(txt);
+        if ((k > 0) && ('/' == txt[k - 1]))
+                txt[k - 1] = '\0';
+        xsnprintf(b, sizeof(b), "%s/%s", root, rel);
+        if ((symlink(txt, b) < 0) && (EEXIST != errno))
+                die("symlink", b);
+        ++files_made;
+}
+
+static void
+mknode(bool blk, int maj, int min, const char * fmt, ...)
+{
+        va_list args;
+        char rel[PATH_MAX];
+        char b[PATH_MAX];
+
+        va_start(args, fmt);
+        vxsnprintf(rel, sizeof(rel), fmt, args);
+        va_end(args);
+        mkparent(rel);
+        xsnprintf(b, sizeof(b), "%s/%s", root, rel);
+        if ((mknod(b, (blk ? S_IFBLK : S_IFCHR) | 0660, makedev(maj, min))
+             < 0) && (EEXIST != errno))
+                die("mknod", b);
+        ++files_made;
+}
+
+/* Writes the 'dev' and 'uevent' attributes of a class device */
+static void
+wr_dev(const char * cdir, int maj, int min, const char * devname,
+       const char * devtype)
+{
+        char b[256];
+
+        xsnprintf(b, sizeof(b), "%d:%d", maj, min);
+        wr(b, "%s/dev", cdir);
+        if (devtype)
+                xsnprintf(b, sizeof(b), "MAJOR=%d\nMINOR=%d\nDEVNAME=%s\n"
+                          "DEVTYPE=%s", maj, min, devname, devtype);
+        else
+                xsnprintf(b, sizeof(b), "MAJOR=%d\nMINOR=%d\nDEVNAME=%s", maj,
+                          min, devname);
+        wr(b, "%s/uevent", cdir);
+}
+
+/* sd naming: sda .. sdz, sdaa .. sdzz, sdaaa ... */
+static void
+sd_name(int k, char * b, int blen)
+{
+        int n;
+        char rev[8];
+
+        n = 0;
+        do {
+                rev[n++] = 'a' + (k % 26);
+                k = (k / 26) - 1;
+        } while ((k >= 0) && (n < (int)sizeof(rev)));
+        xsnprintf(b, blen, "sd");
+        for (k = 2; (n > 0) && (k < blen - 1); ++k)
+                b[k] = rev[--n];
+        b[k] = '\0';
+}
+
+/* Builds a device identification VPD page (0x83) with a NAA-6 LU name and,
+ * for SAS and FC, a NAA-5 target port designator. For iSCSI a SCSI name
+ * string target port designator is used. Returns page length. */
+static int
+mk_vpd_pg83(uint8_t * up, uint64_t naa_hi, uint64_t naa_lo, int mode,
+            const char * iqn)
+{
+        int k, n, slen;
+
+        memset(up, 0, 256);
+        up[1] = 0x83;
+        n = 4;
+        up[n] = 0x1;            /* binary */
+        up[n + 1] = 0x3;        /* assoc=LU, NAA */
+        up[n + 3] = 16;
+        for (k = 0; k < 8; ++k) {
+                up[n + 4 + k] = (naa_hi >> (56 - (8 * k))) & 0xff;
+                up[n + 12 + k] = (naa_lo >> (56 - (8 * k))) & 0xff;
+        }
+        n += 20;
+        if ((MODE_ISCSI == mode) && iqn) {
+                slen = (strlen(iqn) + 4) & ~0x3;
+                up[n] = 0x53;           /* proto=iSCSI, UTF-8 */
+                up[n + 1] = 0x98;       /* PIV, assoc=tport, SCSI name */
+                up[n + 3] = slen;
+                memcpy(up + n + 4, iqn, strlen(iqn));
+                n += 4 + slen;
+        } else if ((MODE_SAS == mode) || (MODE_FC == mode)) {
+                up[n] = ((MODE_SAS == mode) ? 0x60 : 0x00) | 0x1;
+                up[n + 1] = 0x93;       /* PIV, assoc=tport, NAA */
+                up[n + 3] = 8;
+                for (k = 0; k < 8; ++k)
+                        up[n + 4 + k] = (naa_lo >> (56 - (8 * k))) & 0xff;
+                up[n + 4] = 0x50;
+                n += 12;
+        }
+        up[2] = ((n - 4) >> 8) & 0xff;
+        up[3] = (n - 4) & 0xff;
+        return n;
+}
+
+/* Adds a logical unit (and its upper level driver class devices) under
+ * directory 'tdir'. 'pdt' is the SCSI peripheral device type. */
+static void
+mk_lu(const struct gen_opts * op, int mode, const char * tdir, int h, int c,
+      int t, int l, int pdt)
+{
+        bool disk = (0 == pdt);
+        int plen, sg_min, maj, min;
+        uint64_t naa_hi, naa_lo;
+        char hctl[64];
+        char d[PATH_MAX];
+        char cd[PATH_MAX];
+        char hd[PATH_MAX];
+        char b[256];
+        char sd[16];
+        uint8_t u[256];
+
+        xsnprintf(hctl, sizeof(hctl), "%d:%d:%d:%d", h, c, t, l);
+        xsnprintf(d, sizeof(d), "%s/%s", tdir, hctl);
+        mkdirs(d);
+        lnk(d, "sys/bus/scsi/devices/%s", hctl);
+        xsnprintf(b, sizeof(b), "%d", pdt);
+        wr(b, "%s/type", d);
+        switch (mode) {
+        case MODE_SATA:
+                wr("ATA     ", "%s/vendor", d);
+                wr("FAKE SSD 960GB  ", "%s/model", d);
+                wr("1.02", "%s/rev", d);
+                break;
+        case MODE_USB:
+                wr("Generic ", "%s/vendor", d);
+                wr("USB Flash Disk  ", "%s/model", d);
+                wr("8.07", "%s/rev", d);
+                break;
+        default:
+                if (13 == pdt) {
+                        wr("FAKEENC ", "%s/vendor", d);
+                        wr("JBOD 4U60       ", "%s/model", d);
+                } else if (1 == pdt) {
+                        wr("FAKETAPE", "%s/vendor", d);
+                        wr("LTO-8           ", "%s/model", d);
+                } else {
+                        wr("FAKEDISK", "%s/vendor", d);
+                        wr("MG08SCA16TE     ", "%s/model", d);
+                }
+                wr("0104", "%s/rev", d);
+                break;
+        }
+        wr("7", "%s/scsi_level", d);
+        wr("running", "%s/state", d);
+        wr("0", "%s/device_blocked", d);
+        wr("30", "%s/timeout", d);
+        wr("32", "%s/iocounterbits", d);
+        wr("0x1c2", "%s/iodone_cnt", d);
+        wr("0x0", "%s/ioerr_cnt", d);
+        wr("0x1c2", "%s/iorequest_cnt", d);
+        wr((MODE_SATA == mode) ? "32" : "254", "%s/queue_depth", d);
+        wr("simple", "%s/queue_type", d);
+        xsnprintf(b, sizeof(b), "SCSI_MODALIAS=scsi:t-0x%02x\nMODALIAS="
+                  "scsi:t-0x%02x", pdt, pdt);
+        wr(b, "%s/uevent", d);
+
+        naa_hi = 0x6000c29000000000ULL | ((uint64_t)h << 16) | c;
+        naa_lo = ((uint64_t)t << 32) | (uint64_t)l;
+        xsnprintf(b, sizeof(b), "iqn.2018-10.org.example:tgt%d.%d", h, t);
+        plen = mk_vpd_pg83(u, naa_hi, naa_lo, mode, b);
+        wrbin(u, plen, "%s/vpd_pg83", d);
+
+        /* scsi_device class */
+        xsnprintf(cd, sizeof(cd), "%s/scsi_device/%s", d, hctl);
+        mkdirs(cd);
+        lnk(d, "%s/device", cd);
+        lnk(cd, "sys/class/scsi_device/%s", hctl);
+
+        /* scsi_generic, present for every LU */
+        sg_min = sg_count++;
+        xsnprintf(cd, sizeof(cd), "%s/scsi_generic/sg%d", d, sg_min);
+        xsnprintf(b, sizeof(b), "sg%d", sg_min);
+        wr_dev(cd, 21, sg_min, b, NULL);
+        lnk(d, "%s/device", cd);
+        lnk(cd, "sys/class/scsi_generic/sg%d", sg_min);
+        lnk(cd, "%s/generic", d);
+        if (! op->no_dev)
+                mknode(false, 21, sg_min, "dev/sg%d", sg_min);
+
+        if (disk) {
+                int k = sd_count++;
+                bool mpath = (op->mpath_every > 0) &&
+                             (0 == ((k + 1) % op->mpath_every));
+
+                sd_name(k, sd, sizeof(sd));
+                /* 16 minors per disk, 65536 disks per major (fake) */
+                maj = (k < 65536) ? 8 : (65 + (k / 65536));
+                min = (k % 65536) * 16;
+                xsnprintf(cd, sizeof(cd), "%s/block/%s", d, sd);
+                wr_dev(cd, maj, min, sd, "disk");
+                wr((MODE_USB == mode) ? "31260672" : "31251759104",
+                   "%s/size", cd);
+                wr("0", "%s/ro", cd);
+                wr("0", "%s/removable", cd);
+                wr((0 == (k % 3)) ? "4096" : "512",
+                   "%s/queue/logical_block_size", cd);
+                wr("4096", "%s/queue/physical_block_size", cd);
+                wr("256", "%s/queue/nr_requests", cd);
+                xsnprintf(hd, sizeof(hd), "%s/holders", cd);
+                mkdirs(hd);
+                if (MODE_SAS == mode)
+                        wr("T10-DIF-TYPE1-CRC", "%s/integrity/format", cd);
+                else
+                        wr("none", "%s/integrity/format", cd);
+                lnk(d, "%s/device", cd);
+                lnk(cd, "sys/class/block/%s", sd);
+                lnk(cd, "sys/block/%s", sd);
+
+                xsnprintf(cd, sizeof(cd), "%s/scsi_disk/%s", d, hctl);
+                wr((MODE_SAS == mode) ? "1" : "0", "%s/protection_type", cd);
+                wr((MODE_SAS == mode) ? "dif1" : "none",
+                   "%s/protection_mode", cd);
+                wr("write back", "%s/cache_type", cd);
+                lnk(d, "%s/device", cd);
+                lnk(cd, "sys/class/scsi_disk/%s", hctl);
+
+                if (! op->no_dev) {
+                        mknode(true, maj, min, "dev/%s", sd);
+                        mknode(true, maj, min + 1, "dev/%s1", sd);
+                        xsnprintf(b, sizeof(b), "dev/%s1", sd);
+                        if (mpath) {
+                                int dmn = dm_count++;
+
+                                xsnprintf(cd, sizeof(cd),
+                                          "sys/devices/virtual/block/dm-%d",
+                                          dmn);
+                                xsnprintf(b, sizeof(b), "dm-%d", dmn);
+                                wr_dev(cd, 253, dmn, b, "disk");
+                                lnk(cd, "sys/class/block/dm-%d", dmn);
+                                lnk(cd, "%s/block/%s/holders/dm-%d", d, sd,
+                                    dmn);
+                                mknode(true, 253, dmn, "dev/dm-%d", dmn);
+                                xsnprintf(b, sizeof(b), "dev/dm-%d", dmn);
+                                lnk(b, "dev/disk/by-id/dm-uuid-mpath-"
+                                    "3%016llx%016llx",
+                                    (unsigned long long)naa_hi,
+                                    (unsigned long long)naa_lo);
+                                lnk(b, "dev/disk/by-id/dm-name-mpath%d",
+                                    dmn);
+                        } else {
+                                xsnprintf(b, sizeof(b), "dev/%s", sd);
+                                lnk(b, "dev/disk/by-id/wwn-0x%016llx%016llx",
+                                    (unsigned long long)naa_hi,
+                                    (unsigned long long)naa_lo);
+                                if (MODE_USB == mode)
+                                        lnk(b, "dev/disk/by-id/usb-Generic_"
+                                            "Flash_Disk_%04X%04X-0:%d", h, t, l);
+                                else
+                                        lnk(b, "dev/disk/by-id/scsi-"
+                                            "3%016llx%016llx",
+                                            (unsigned long long)naa_hi,
+                                            (unsigned long long)naa_lo);
+                                xsnprintf(b, sizeof(b), "dev/%s1", sd);
+                                lnk(b, "dev/disk/by-id/wwn-0x%016llx%016llx"
+                                    "-part1", (unsigned long long)naa_hi,
+                                    (unsigned long long)naa_lo);
+                        }
+                }
+        } else if (1 == pdt) {
+                int k = st_count++;
+
+                xsnprintf(cd, sizeof(cd), "%s/scsi_tape/st%d", d, k);
+                xsnprintf(b, sizeof(b), "st%d", k);
+                wr_dev(cd, 9, k, b, NULL);
+                lnk(d, "%s/device", cd);
+                lnk(cd, "sys/class/scsi_tape/st%d", k);
+                lnk(cd, "%s/tape", d);
+                xsnprintf(cd, sizeof(cd), "%s/scsi_tape/nst%d", d, k);
+                xsnprintf(b, sizeof(b), "nst%d", k);
+                wr_dev(cd, 9, k + 128, b, NULL);
+                lnk(d, "%s/device", cd);
+                if (! op->no_dev) {
+                        mknode(false, 9, k, "dev/st%d", k);
+                        mknode(false, 9, k + 128, "dev/nst%d", k);
+                }
+        }
+        if (op->verbose > 1)
+                fprintf(stderr, "  LU %s: pdt=%d\n", hctl, pdt);
+}
+
+/* Adds the transport specific objects for target 't' on host 'h' and
+ * returns (in tdir) the directory under which its LUs are placed. */
+static void
+mk_target(int mode, const char * hdir, int h,
+          int t, char * tdir, int tdir_len)
+{
+        char d[PATH_MAX];
+        char cd[PATH_MAX];
+        char b[256];
+
+        switch (mode) {
+        case MODE_SAS:
+                /* hostH/port-H:T/end_device-H:T/targetH:0:T */
+                xsnprintf(d, sizeof(d), "%s/port-%d:%d", hdir, h, t);
+                xsnprintf(cd, sizeof(cd), "%s/phy-%d:%d", d, h, t);
+                mkdirs(cd);
+                xsnprintf(cd, sizeof(cd), "%s/sas_port/port-%d:%d", d, h, t);
+                wr("1", "%s/num_phys", cd);
+                lnk(d, "%s/device", cd);
+                lnk(cd, "sys/class/sas_port/port-%d:%d", h, t);
+                xsnprintf(d, sizeof(d), "%s/port-%d:%d/end_device-%d:%d",
+                          hdir, h, t, h, t);
+                xsnprintf(cd, sizeof(cd), "%s/sas_device/end_device-%d:%d", d,
+                          h, t);
+                xsnprintf(b, sizeof(b), "0x5000c500%04x%04x", h, t);
+                wr(b, "%s/sas_address", cd);
+                xsnprintf(b, sizeof(b), "%d", t);
+                wr(b, "%s/bay_identifier", cd);
+                wr(b, "%s/phy_identifier", cd);
+                xsnprintf(b, sizeof(b), "0x500a0b8%07x", h);
+                wr(b, "%s/enclosure_identifier", cd);
+                wr("none", "%s/initiator_port_protocols", cd);
+                wr("ssp", "%s/target_port_protocols", cd);
+                wr("end device", "%s/device_type", cd);
+                lnk(d, "%s/device", cd);
+                lnk(cd, "sys/class/sas_device/end_device-%d:%d", h, t);
+                xsnprintf(cd, sizeof(cd), "%s/sas_end_device/end_device-%d:%d",
+                          d, h, t);
+                wr("5000", "%s/I_T_nexus_loss_timeout", cd);
+                wr("5000", "%s/initiator_response_timeout", cd);
+                wr("1", "%s/ready_led_meaning", cd);
+                wr("0", "%s/tlr_enabled", cd);
+                wr("0", "%s/tlr_supported", cd);
+                lnk(d, "%s/device", cd);
+                lnk(cd, "sys/class/sas_end_device/end_device-%d:%d", h, t);
+                xsnprintf(tdir, tdir_len, "%s/target%d:0:%d", d, h, t);
+                break;
+        case MODE_FC:
+                xsnprintf(d, sizeof(d), "%s/rport-%d:0-%d", hdir, h, t);
+                xsnprintf(cd, sizeof(cd), "%s/fc_remote_ports/rport-%d:0-%d",
+                          d, h, t);
+                xsnprintf(b, sizeof(b), "0x2000%04x%08x", h, t);
+                wr(b, "%s/node_name", cd);
+                xsnprintf(b, sizeof(b), "0x2100%04x%08x", h, t);
+                wr(b, "%s/port_name", cd);
+                xsnprintf(b, sizeof(b), "0x%02x%04x", h, t);
+                wr(b, "%s/port_id", cd);
+                wr("Online", "%s/port_state", cd);
+                wr("FCP Target", "%s/roles", cd);
+                xsnprintf(b, sizeof(b), "%d", t);
+                wr(b, "%s/scsi_target_id", cd);
+                wr("Class 3", "%s/supported_classes", cd);
+                wr("5", "%s/fast_io_fail_tmo", cd);
+                wr("30", "%s/dev_loss_tmo", cd);
+                lnk(d, "%s/device", cd);
+                lnk(cd, "sys/class/fc_remote_ports/rport-%d:0-%d", h, t);
+                xsnprintf(tdir, tdir_len, "%s/target%d:0:%d", d, h, t);
+                xsnprintf(cd, sizeof(cd), "%s/fc_transport/target%d:0:%d",
+                          tdir, h, t);
+                xsnprintf(b, sizeof(b), "0x2000%04x%08x", h, t);
+                wr(b, "%s/node_name", cd);
+                xsnprintf(b, sizeof(b), "0x2100%04x%08x", h, t);
+                wr(b, "%s/port_name", cd);
+                xsnprintf(b, sizeof(b), "0x%02x%04x", h, t);
+                wr(b, "%s/port_id", cd);
+                lnk(tdir, "%s/device", cd);
+                lnk(cd, "sys/class/fc_transport/target%d:0:%d", h, t);
+                break;
+        case MODE_ISCSI:
+        {
+                int sn = iscsi_session_count++;
+
+                xsnprintf(d, sizeof(d), "%s/session%d", hdir, sn);
+                xsnprintf(cd, sizeof(cd), "%s/iscsi_session/session%d", d, sn);
+                xsnprintf(b, sizeof(b), "iqn.2018-10.org.example:tgt%d.%d", h,
+                          t);
+                wr(b, "%s/targetname", cd);
+                wr("1", "%s/tpgt", cd);
+                wr("1", "%s/data_pdu_in_order", cd);
+                wr("1", "%s/data_seq_in_order", cd);
+                wr("0", "%s/erl", cd);
+                wr("262144", "%s/first_burst_len", cd);
+                wr("Yes", "%s/initial_r2t", cd);
+                wr("16776192", "%s/max_burst_len", cd);
+                wr("1", "%s/max_outstanding_r2t", cd);
+                wr("120", "%s/recovery_tmo", cd);
+                wr("LOGGED_IN", "%s/state", cd);
+                lnk(d, "%s/device", cd);
+                lnk(cd, "sys/class/iscsi_session/session%d", sn);
+                xsnprintf(cd, sizeof(cd),
+                          "%s/connection%d:0/iscsi_connection/connection%d:0",
+                          d, sn, sn);
+                xsnprintf(b, sizeof(b), "192.0.2.%d", 1 + (t % 250));
+                wr(b, "%s/persistent_address", cd);
+                wr(b, "%s/address", cd);
+                wr("3260", "%s/persistent_port", cd);
+                wr("3260", "%s/port", cd);
+                lnk(cd, "sys/class/iscsi_connection/connection%d:0", sn);
+                xsnprintf(tdir, tdir_len, "%s/target%d:0:%d", d, h, t);
+                break;
+        }
+        case MODE_SPI:
+                xsnprintf(tdir, tdir_len, "%s/target%d:0:%d", hdir, h, t);
+                xsnprintf(cd, sizeof(cd), "%s/spi_transport/target%d:0:%d",
+                          tdir, h, t);
+                wr("1", "%s/dt", cd);
+                wr("127", "%s/max_offset", cd);
+                wr("1", "%s/max_width", cd);
+                wr("6.25", "%s/min_period", cd);
+                wr("127", "%s/offset", cd);
+                wr("6.25", "%s/period", cd);
+                wr("1", "%s/width", cd);
+                lnk(tdir, "%s/device", cd);
+                lnk(cd, "sys/class/spi_transport/target%d:0:%d", h, t);
+                break;
+        default:
+                xsnprintf(tdir, tdir_len, "%s/target%d:0:%d", hdir, h, t);
+                break;
+        }
+        mkdirs(tdir);
+        {
+                char * cp = strrchr(tdir, '/');
+
+                lnk(tdir, "sys/bus/scsi/devices/%s", cp + 1);
+        }
+}
+
+/* Adds the ses enclosure of SAS host 'h', whose LU (H:0:ntgt:0) is in
+ * 'tdir', with one slot per target holding that target's LUN 0. 'hdir' is
+ * the directory holding the targets' SAS ports. */
+static void
+mk_enclosure(const char * hdir, const char * tdir, int h, int ntgt)
+{
+        int t;
+        char ed[PATH_MAX];
+        char cd[PATH_MAX];
+        char ld[PATH_MAX];
+        char b[256];
+
+        xsnprintf(ld, sizeof(ld), "%s/%d:0:%d:0", tdir, h, ntgt);
+        xsnprintf(ed, sizeof(ed), "%s/enclosure/%d:0:%d:0", ld, h, ntgt);
+        xsnprintf(b, sizeof(b), "0x500a0b8%07x", h);
+        wr(b, "%s/id", ed);
+        xsnprintf(b, sizeof(b), "%d", ntgt);
+        wr(b, "%s/components", ed);
+        lnk(ld, "%s/device", ed);
+        lnk(ed, "sys/class/enclosure/%d:0:%d:0", h, ntgt);
+        for (t = 0; t < ntgt; ++t) {
+                xsnprintf(cd, sizeof(cd), "%s/Slot %02d", ed, t);
+                xsnprintf(b, sizeof(b), "%d", t);
+                wr(b, "%s/slot", cd);
+                wr("array device", "%s/type", cd);
+                wr("OK", "%s/status", cd);
+                wr("0", "%s/fault", cd);
+                wr((t % 7) ? "0" : "1", "%s/locate", cd);
+                wr("1", "%s/active", cd);
+                xsnprintf(ld, sizeof(ld), "%s/port-%d:%d/end_device-%d:%d/"
+                          "target%d:0:%d/%d:0:%d:0", hdir, h, t, h, t, h, t,
+                          h, t);
+                lnk(ld, "%s/device", cd);
+                lnk(cd, "%s/enclosure_device:Slot %02d", ld, t);
+        }
+}
+
+static void
+mk_host(const struct gen_opts * op, int h)
+{
+        int mode = op->mode;
+        int t, l, k, ntgt;
+        const char * proc_name;
+        char hdir[PATH_MAX];
+        char pdir[PATH_MAX];    /* parent of the targets' SAS ports */
+        char tdir[PATH_MAX];
+        char cd[PATH_MAX];
+        char pd[PATH_MAX];
+        char b[256];
+
+        if (MODE_MIX == mode)
+                mode = h % MODE_MIX;
+        switch (mode) {
+        case MODE_SAS:
+                proc_name = "mpt3sas";
+                xsnprintf(hdir, sizeof(hdir), "sys/devices/pci0000:00/"
+                          "0000:00:%02x.0/0000:%02x:00.0/host%d", h & 0x1f,
+                          h + 1, h);
+                break;
+        case MODE_FC:
+                proc_name = "qla2xxx";
+                xsnprintf(hdir, sizeof(hdir), "sys/devices/pci0000:00/"
+                          "0000:00:%02x.0/0000:%02x:00.0/host%d", h & 0x1f,
+                          h + 1, h);
+                break;
+        case MODE_ISCSI:
+                proc_name = "iscsi_tcp";
+                xsnprintf(hdir, sizeof(hdir), "sys/devices/platform/host%d",
+                          h);
+                break;
+        case MODE_SPI:
+                proc_name = "sym53c8xx";
+                xsnprintf(hdir, sizeof(hdir), "sys/devices/pci0000:00/"
+                          "0000:00:%02x.0/host%d", h & 0x1f, h);
+                break;
+        case MODE_SATA:
+                proc_name = "ahci";
+                xsnprintf(hdir, sizeof(hdir), "sys/devices/pci0000:00/"
+                          "0000:00:1f.2/ata%d/host%d", h + 1, h);
+                break;
+        case MODE_USB:
+        default:
+                proc_name = "usb-storage";
+                xsnprintf(hdir, sizeof(hdir), "sys/devices/pci0000:00/"
+                          "0000:00:14.0/usb2/2-%d/2-%d:1.0/host%d", h + 1,
+                          h + 1, h);
+                break;
+        }
+        mkdirs(hdir);
+        lnk(hdir, "sys/bus/scsi/devices/host%d", h);
+        xsnprintf(cd, sizeof(cd), "%s/scsi_host/host%d", hdir, h);
+        wr(proc_name, "%s/proc_name", cd);
+        wr("1024", "%s/can_queue", cd);
+        wr("7", "%s/cmd_per_lun", cd);
+        wr("0", "%s/host_busy", cd);
+        wr("128", "%s/sg_tablesize", cd);
+        wr("running", "%s/state", cd);
+        wr("0", "%s/unchecked_isa_dma", cd);
+        xsnprintf(b, sizeof(b), "%d", h);
+        wr(b, "%s/unique_id", cd);
+        lnk(hdir, "%s/device", cd);
+        lnk(cd, "sys/class/scsi_host/host%d", h);
+
+        switch (mode) {
+        case MODE_SAS:
+                for (k = 0; k < 8; ++k) {
+                        xsnprintf(cd, sizeof(cd), "%s/phy-%d:%d", hdir, h, k);
+                        mkdirs(cd);
+                        xsnprintf(cd, sizeof(cd), "%s/phy-%d:%d/sas_phy/"
+                                  "phy-%d:%d", hdir, h, k, h, k);
+                        xsnprintf(b, sizeof(b), "0x500605b0%08x", h);
+                        wr(b, "%s/sas_address", cd);
+                        xsnprintf(b, sizeof(b), "%d", k);
+                        wr(b, "%s/phy_identifier", cd);
+                        wr("end device", "%s/device_type", cd);
+                        wr("ssp,stp,smp", "%s/initiator_port_protocols", cd);
+                        wr("none", "%s/target_port_protocols", cd);
+                        wr("0", "%s/invalid_dword_count", cd);
+                        wr("0", "%s/loss_of_dword_sync_count", cd);
+                        wr("0", "%s/phy_reset_problem_count", cd);
+                        wr("0", "%s/running_disparity_error_count", cd);
+                        wr("3.0 Gbit", "%s/minimum_linkrate", cd);
+                        wr("3.0 Gbit", "%s/minimum_linkrate_hw", cd);
+                        wr("12.0 Gbit", "%s/maximum_linkrate", cd);
+                        wr("12.0 Gbit", "%s/maximum_linkrate_hw", cd);
+                        wr("12.0 Gbit", "%s/negotiated_linkrate", cd);
+                        xsnprintf(pd, sizeof(pd), "%s/phy-%d:%d", hdir, h,
+                                  k);
+                        lnk(pd, "%s/device", cd);
+                        lnk(cd, "sys/class/sas_phy/phy-%d:%d", h, k);
+                }
+                xsnprintf(cd, sizeof(cd), "%s/sas_host/host%d", hdir, h);
+                lnk(hdir, "%s/device", cd);
+                lnk(cd, "sys/class/sas_host/host%d", h);
+                /* hostH/port-H:0/expander-H:0/port-H:0:0/expander-H:1 ... */
+                xsnprintf(pdir, sizeof(pdir), "%s", hdir);
+                for (k = 0; k < op->num_expanders; ++k) {
+                        if (0 == k)
+                                xsnprintf(cd, sizeof(cd), "%s/port-%d:0/"
+                                          "expander-%d:0", pdir, h, h);
+                        else
+                                xsnprintf(cd, sizeof(cd), "%s/port-%d:%d:0/"
+                                          "expander-%d:%d", pdir, h, k - 1,
+                                          h, k);
+                        wr("edge expander", "%s/sas_device/device_type", cd);
+                        lnk(cd, "sys/class/sas_expander/expander-%d:%d", h,
+                            k);
+                        xsnprintf(pdir, sizeof(pdir), "%s", cd);
+                }
+                break;
+        case MODE_FC:
+                xsnprintf(cd, sizeof(cd), "%s/fc_host/host%d", hdir, h);
+                xsnprintf(b, sizeof(b), "0x2100%04x%08x", h, 0xffff);
+                wr(b, "%s/port_name", cd);
+                xsnprintf(b, sizeof(b), "0x2000%04x%08x", h, 0xffff);
+                wr(b, "%s/node_name", cd);
+                wr(b, "%s/fabric_name", cd);
+                xsnprintf(b, sizeof(b), "0x%02x0000", h);
+                wr(b, "%s/port_id", cd);
+                wr("QLE2742 FW:v8.08.05 DVR:v10.00.00.06-k",
+                   "%s/symbolic_name", cd);
+                wr("Online", "%s/port_state", cd);
+                wr("NPort (fabric via point-to-point)", "%s/port_type", cd);
+                wr("32 Gbit", "%s/speed", cd);
+                wr("8 Gbit, 16 Gbit, 32 Gbit", "%s/supported_speeds", cd);
+                wr("Class 3", "%s/supported_classes", cd);
+                wr("2048 bytes", "%s/maxframe_size", cd);
+                wr("254", "%s/max_npiv_vports", cd);
+                wr("0", "%s/npiv_vports_inuse", cd);
+                wr("wwpn (World Wide Port Name)", "%s/tgtid_bind_type", cd);
+                wr("0x00 0x00 0x01 0x00", "%s/active_fc4s", cd);
+                wr("0x00 0x00 0x01 0x00", "%s/supported_fc4s", cd);
+                lnk(hdir, "%s/device", cd);
+                lnk(cd, "sys/class/fc_host/host%d", h);
+                break;
+        case MODE_ISCSI:
+                xsnprintf(cd, sizeof(cd), "%s/iscsi_host/host%d", hdir, h);
+                wr("default", "%s/netdev", cd);
+                lnk(hdir, "%s/device", cd);
+                lnk(cd, "sys/class/iscsi_host/host%d", h);
+                break;
+        case MODE_SPI:
+                xsnprintf(cd, sizeof(cd), "%s/spi_host/host%d", hdir, h);
+                wr("LVD", "%s/signalling", cd);
+                lnk(hdir, "%s/device", cd);
+                lnk(cd, "sys/class/spi_host/host%d", h);
+                break;
+        default:
+                break;
+        }
+
+        if (MODE_SAS != mode)
+                xsnprintf(pdir, sizeof(pdir), "%s", hdir);
+        ntgt = op->num_targets;
+        for (t = 0; t < ntgt; ++t) {
+                mk_target(mode, pdir, h, t, tdir, sizeof(tdir));
+                for (l = 0; l < op->num_luns; ++l)
+                        mk_lu(op, mode, tdir, h, 0, t, l, 0);
+        }
+        /* extra non-disk LUs make the non_sg paths in lsscsi do work */
+        if (MODE_SAS == mode) {
+                mk_target(mode, pdir, h, ntgt, tdir, sizeof(tdir));
+                mk_lu(op, mode, tdir, h, 0, ntgt, 0, 13);
+                if (op->num_luns > 0)
+                        mk_enclosure(pdir, tdir, h, ntgt);
+        } else if (MODE_SPI == mode) {
+                mk_target(mode, hdir, h, ntgt, tdir, sizeof(tdir));
+                mk_lu(op, mode, tdir, h, 0, ntgt, 0, 1);
+        }
+        if (op->verbose)
+                fprintf(stderr, "host%d: %s, %d targets\n", h,
+                        mode_names[mode], ntgt);
+}
+
+static void
+mk_nvme(const struct gen_opts * op, int n)
+{
+        int k, maj_min;
+        char pdir[PATH_MAX];
+        char cdir[PATH_MAX];
+        char nsdir[PATH_MAX];
+        char hd[PATH_MAX];
+        char b[256];
+
+        xsnprintf(pdir, sizeof(pdir), "sys/devices/pci0000:00/0000:00:%02x.0/"
+                  "0000:%02x:00.0", 2 + (n & 0xf), 0x40 + n);
+        wr("0x8086", "%s/vendor", pdir);
+        wr("0x0a54", "%s/device", pdir);
+        wr("0x8086", "%s/subsystem_vendor", pdir);
+        wr("0x4712", "%s/subsystem_device", pdir);
+        wr("4", "%s/current_link_width", pdir);
+        wr("8 GT/s", "%s/current_link_speed", pdir);
+        xsnprintf(cdir, sizeof(cdir), "%s/nvme/nvme%d", pdir, n);
+        xsnprintf(b, sizeof(b), "nvme%d", n);
+        wr_dev(cdir, 243, n, b, NULL);
+        xsnprintf(b, sizeof(b), "%d", n + 1);
+        wr(b, "%s/cntlid", cdir);
+        wr("INTEL SSDPE2KX040T8                     ", "%s/model", cdir);
+        xsnprintf(b, sizeof(b), "PHLJ9%06dX4P0DGN  ", n);
+        wr(b, "%s/serial", cdir);
+        wr("VDV10131", "%s/firmware_rev", cdir);
+        wr("pcie", "%s/transport", cdir);
+        wr("live", "%s/state", cdir);
+        xsnprintf(b, sizeof(b), "nqn.2014.08.org.nvmexpress:80868086PHLJ9"
+                  "%06dX4P0DGN  INTEL SSDPE2KX040T8", n);
+        wr(b, "%s/subsysnqn", cdir);
+        lnk(pdir, "%s/device", cdir);
+        lnk(cdir, "sys/class/nvme/nvme%d", n);
+        if (! op->no_dev)
+                mknode(false, 243, n, "dev/nvme%d", n);
+        for (k = 1; k <= op->num_nvme_ns; ++k) {
+                maj_min = (n * op->num_nvme_ns) + k - 1;
+                xsnprintf(nsdir, sizeof(nsdir), "%s/nvme%dn%d", cdir, n, k);
+                xsnprintf(b, sizeof(b), "nvme%dn%d", n, k);
+                wr_dev(nsdir, 259, maj_min, b, "disk");
+                xsnprintf(b, sizeof(b), "eui.0100000001000000e4d25c%02x%04x"
+                          "0000", n, k);
+                wr(b, "%s/wwid", nsdir);
+                xsnprintf(b, sizeof(b), "%d", k);
+                wr(b, "%s/nsid", nsdir);
+                wr("7814037168", "%s/size", nsdir);
+                wr("0", "%s/capability", nsdir);
+                wr("0", "%s/ext_range", nsdir);
+                wr("0", "%s/hidden", nsdir);
+                wr("0", "%s/range", nsdir);
+                wr("0", "%s/removable", nsdir);
+                wr("1023", "%s/queue/nr_requests", nsdir);
+                wr("128", "%s/queue/read_ahead_kb", nsdir);
+                wr("write through", "%s/queue/write_cache", nsdir);
+                wr("512", "%s/queue/logical_block_size", nsdir);
+                wr("512", "%s/queue/physical_block_size", nsdir);
+                xsnprintf(hd, sizeof(hd), "%s/holders", nsdir);
+                mkdirs(hd);
+                lnk(cdir, "%s/device", nsdir);
+                lnk(nsdir, "sys/class/block/nvme%dn%d", n, k);
+                lnk(nsdir, "sys/block/nvme%dn%d", n, k);
+                if (! op->no_dev) {
+                        mknode(true, 259, maj_min, "dev/nvme%dn%d", n, k);
+                        xsnprintf(b, sizeof(b), "dev/nvme%dn%d", n, k);
+                        lnk(b, "dev/disk/by-id/nvme-eui.0100000001000000"
+                            "e4d25c%02x%04x0000", n, k);
+                }
+        }
+}
+
+static int
+get_num(const char * arg, const char * name)
+{
+        char * cp;
+        long v;
+
+        v = strtol(arg, &cp, 10);
+        if ((cp == arg) || *cp || (v < 0) || (v > 1000000)) {
+                fprintf(stderr, "bad argument to --%s: %s\n", name, arg);
+                exit(1);
+        }
+        return (int)v;
+}
+
+int
+main(int argc, char * argv[])
+{
+        int c, k;
+        struct gen_opts opts;
+        struct gen_opts * op = &opts;
+
+        memset(op, 0, sizeof(opts));
+        op->num_hosts = 2;
+        op->num_targets = 2;
+        op->num_luns = 2;
+        op->num_nvme_ctls = 1;
+        op->num_nvme_ns = 2;
+        op->mode = MODE_MIX;
+        while (1) {
+                int option_index = 0;
+
+                c = getopt_long(argc, argv, "DE:hH:L:m:M:n:N:T:vV",
+                                long_options, &option_index);
+                if (c == -1)
+                        break;
+                switch (c) {
+                case 'D':
+                        op->no_dev = true;
+                        break;
+                case 'E':
+                        op->num_expanders = get_num(optarg, "expanders");
+                        break;
+                case 'h':
+                case '?':
+                        usage();
+                        return ('h' == c) ? 0 : 1;
+                case 'H':
+                        op->num_hosts = get_num(optarg, "hosts");
+                        break;
+                case 'L':
+                        op->num_luns = get_num(optarg, "luns");
+                        break;
+                case 'm':
+                        for (k = 0; mode_names[k]; ++k) {
+                                if (0 == strcmp(optarg, mode_names[k]))
+                                        break;
+                        }
+                        if (NULL == mode_names[k]) {
+                                fprintf(stderr, "unknown --mode=%s\n",
+                                        optarg);
+                                return 1;
+                        }
+                        op->mode = k;
+                        break;
+                case 'M':
+                        op->mpath_every = get_num(optarg, "mpath");
+                        break;
+                case 'n':
+                        op->num_nvme_ctls = get_num(optarg, "nvme");
+                        break;
+                case 'N':
+                        op->num_nvme_ns = get_num(optarg, "namespaces");
+                        break;
+                case 'T':
+                        op->num_targets = get_num(optarg, "targets");
+                        break;
+                case 'v':
+                        ++op->verbose;
+                        break;
+                case 'V':
+                        fprintf(stderr, "version: %s\n", version_str);
+                        return 0;
+                default:
+                        usage();
+                        return 1;
+                }
+        }
+        if (optind + 1 != argc) {
+                usage();
+                return 1;
+        }
+        xsnprintf(root, sizeof(root), "%s", argv[optind]);
+        k = strlen(root);
+        while ((k > 1) && ('/' == root[k - 1]))
+                root[--k] = '\0';
+        mkdirs("sys/bus/scsi/devices");
+        mkdirs("sys/class/scsi_host");
+        mkdirs("sys/class/scsi_device");
+        mkdirs("sys/kernel");
+        wr("1", "sys/kernel/uevent_seqnum");
+        if (! op->no_dev)
+                mkdirs("dev/disk/by-id");
+
+        for (k = 0; k < op->num_hosts; ++k)
+                mk_host(op, k);
+        for (k = 0; k < op->num_nvme_ctls; ++k)
+                mk_nvme(op, k);
+        if (op->verbose)
+                fprintf(stderr, "%ld files, %d disks, %d sg devices, %d "
+                        "NVMe controllers\n", files_made, sd_count, sg_count,
+                        op->num_nvme_ctls);
+        return 0;
+}
@@ -0,0 +1,65 @@
+#!/bin/sh
+# Checks that listing one SCSI host (e.g. 'lsscsi 2'), which walks that
+# host's sysfs subtree, finds the same LUs as the full listing does via
+# /sys/bus/scsi/devices . Trees come from mk_fake_sysfs, including SAS
+# targets placed behind several cascaded expanders.
+#
+# Run by 'make check'. Takes the lsscsi and mk_fake_sysfs binaries from
+# LSSCSI and GEN if set.
+
+BIN=${LSSCSI:-../src/lsscsi}
+GEN=${GEN:-./mk_fake_sysfs}
+DIR=${TMPDIR:-/tmp}/lsscsi_test.$$
+
+trap 'rm -rf "$DIR"' 0 1 2 15
+
+fails=0
+
+# $1: tree name, $2: number of hosts, remaining: mk_fake_sysfs options
+check_tree()
+{
+        name=$1
+        nh=$2
+        shift 2
+        root=$DIR/$name
+        if ! "$GEN" -D "$@" "$root" ; then
+                echo "FAIL: $name: mk_fake_sysfs $*"
+                fails=$((fails + 1))
+                return
+        fi
+        "$BIN" --sysfsroot="$root/sys" > "$DIR/all" 2>/dev/null
+        h=0
+        while [ $h -lt $nh ] ; do
+                grep "^\[$h:" "$DIR/all" > "$DIR/want"
+                "$BIN" --sysfsroot="$root/sys" $h > "$DIR/got" 2>/dev/null
+                if [ ! -s "$DIR/want" ] ; then
+                        echo "FAIL: $name: host $h has no LUs"
+                        fails=$((fails + 1))
+                elif ! cmp -s "$DIR/want" "$DIR/got" ; then
+                        echo "FAIL: $name: 'lsscsi $h' differs from" \
+                             "the full listing"
+                        diff "$DIR/want" "$DIR/got"
+                        fails=$((fails + 1))
+                fi
+                h=$((h + 1))
+        done
+}
+
+for f in "$BIN" "$GEN" ; do
+        if [ ! -x "$f" ] ; then
+                echo "$f: not found or not executable" >&2
+                exit 1
+        fi
+done
+mkdir -p "$DIR" || exit 1
+
+check_tree mix 6 -H 6 -m mix
+check_tree sas_direct 2 -H 2 -m sas
+check_tree sas_3_expanders 2 -H 2 -m sas -E 3
+check_tree sas_8_expanders 1 -H 1 -m sas -E 8 -T 4
+
+if [ $fails -gt 0 ] ; then
+        echo "$fails host filter check(s) failed"
+        exit 1
+fi
+exit 0